@@ -0,0 +1,234 @@
+#include "AllocTracker.h"
+
+#ifdef MAINT_ALLOC_TRACKING
+
+#	include <algorithm>
+#	include <cstdint>
+#	include <cstdlib>
+#	include <new>
+
+namespace
+{
+	using MAINT::ALLOC::Region;
+	using MAINT::ALLOC::RegionStats;
+
+	// Placed right in front of every block so frees can be attributed to the region that allocated them.
+	struct alignas(16) Header
+	{
+		std::size_t size;
+		void* base;  // what malloc returned, over-aligned blocks start further in
+		Region region;
+	};
+
+	std::array<RegionStats, static_cast<std::size_t>(Region::kCount)> Stats{};
+
+	thread_local Region CurrentRegion = Region::kOther;
+	thread_local std::uint64_t ThreadAllocations = 0;
+	thread_local MAINT::ALLOC::Scope* CurrentScope = nullptr;
+
+	void* Allocate(std::size_t size, std::size_t alignment = alignof(Header))
+	{
+		// malloc already returns blocks aligned for the header, only larger alignments need slack
+		alignment = (std::max)(alignment, alignof(Header));
+		const auto& slack = alignment > alignof(Header) ? alignment - 1 : 0;
+		const auto& base = std::malloc(sizeof(Header) + slack + size);
+		if (!base)
+			return nullptr;
+		const auto& block = (reinterpret_cast<std::uintptr_t>(base) + sizeof(Header) + alignment - 1) & ~(alignment - 1);
+		auto header = reinterpret_cast<Header*>(block) - 1;
+		header->size = size;
+		header->base = base;
+		header->region = CurrentRegion;
+		++ThreadAllocations;
+
+		auto& stats = Stats[static_cast<std::size_t>(header->region)];
+		stats.allocations.fetch_add(1, std::memory_order_relaxed);
+		stats.bytes.fetch_add(size, std::memory_order_relaxed);
+		const auto& live = stats.live.fetch_add(static_cast<std::int64_t>(size), std::memory_order_relaxed) + static_cast<std::int64_t>(size);
+		auto peak = stats.peak.load(std::memory_order_relaxed);
+		while (live > peak && !stats.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+		return header + 1;
+	}
+
+	void* AllocateOrThrow(std::size_t size, std::size_t alignment = alignof(Header))
+	{
+		if (auto ptr = Allocate(size ? size : 1, alignment))
+			return ptr;
+		throw std::bad_alloc();
+	}
+
+	void Free(void* ptr)
+	{
+		if (!ptr)
+			return;
+		auto header = static_cast<Header*>(ptr) - 1;
+		Stats[static_cast<std::size_t>(header->region)].live.fetch_sub(static_cast<std::int64_t>(header->size), std::memory_order_relaxed);
+		std::free(header->base);
+	}
+}
+
+// Every replaceable form, aligned and nothrow included, so no allocation of the plugin bypasses the accounting
+// and no block ends up freed by a different allocator than the one that handed it out.
+void* operator new(std::size_t size)
+{
+	return AllocateOrThrow(size);
+}
+
+void* operator new[](std::size_t size)
+{
+	return AllocateOrThrow(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	return AllocateOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return AllocateOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return Allocate(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return Allocate(size ? size : 1);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return Allocate(size ? size : 1, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return Allocate(size ? size : 1, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* ptr) noexcept
+{
+	Free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	Free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+	Free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+	Free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+	Free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+	Free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept
+{
+	Free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept
+{
+	Free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	Free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	Free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	Free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	Free(ptr);
+}
+
+namespace MAINT
+{
+	namespace ALLOC
+	{
+		RegionStats& StatsOf(Region region)
+		{
+			return Stats[static_cast<std::size_t>(region)];
+		}
+
+		Scope::Scope(Region region) :
+			Current(region),
+			Previous(CurrentRegion),
+			Parent(CurrentScope),
+			StartAllocations(ThreadAllocations),
+			Start(std::chrono::steady_clock::now())
+		{
+			CurrentRegion = region;
+			CurrentScope = this;
+		}
+
+		Scope::~Scope()
+		{
+			CurrentRegion = Previous;
+			CurrentScope = Parent;
+			// Nested scopes are accounted to their own region, not to the budget of this one
+			const auto& allocations = ThreadAllocations - StartAllocations;
+			const auto& own = allocations - NestedAllocations;
+			if (Parent)
+				Parent->NestedAllocations += allocations;
+			const auto& elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start).count();
+			auto& stats = StatsOf(Current);
+			stats.passes.fetch_add(1, std::memory_order_relaxed);
+			stats.nanoseconds.fetch_add(static_cast<std::uint64_t>(elapsed), std::memory_order_relaxed);
+			auto worst = stats.maxPerPass.load(std::memory_order_relaxed);
+			while (own > worst && !stats.maxPerPass.compare_exchange_weak(worst, own, std::memory_order_relaxed)) {}
+#	ifdef MAINT_ALLOC_BUDGETS
+			const auto& limit = Budgets[static_cast<std::size_t>(Current)];
+			const auto& budget = limit > (std::numeric_limits<std::uint64_t>::max)() / Units ? limit : limit * Units;
+			if (own > budget)
+				util::report_and_fail(std::format("{} made {} allocations, its budget is {}", ToString(Current), own, budget));
+#	endif
+		}
+
+		void Report()
+		{
+			logger::info("Allocations per region:");
+			for (std::size_t i = 0; i < Stats.size(); ++i) {
+				auto const& stats = Stats[i];
+				const auto& passes = stats.passes.load(std::memory_order_relaxed);
+				const auto& allocations = stats.allocations.load(std::memory_order_relaxed);
+				if (passes == 0 && allocations == 0)
+					continue;
+				const auto& perPass = passes > 0 ? static_cast<double>(allocations) / passes : 0.0;
+				const auto& avgMs = passes > 0 ? stats.nanoseconds.load(std::memory_order_relaxed) / 1e6 / passes : 0.0;
+				logger::info("\t{}: {} passes, avg {:.3f}ms, {} allocations ({:.1f}/pass, at most {}), {} bytes, {} live, peak {}",
+					ToString(static_cast<Region>(i)), passes, avgMs, allocations, perPass, stats.maxPerPass.load(std::memory_order_relaxed),
+					stats.bytes.load(std::memory_order_relaxed), stats.live.load(std::memory_order_relaxed), stats.peak.load(std::memory_order_relaxed));
+			}
+		}
+	}
+}
+
+#endif
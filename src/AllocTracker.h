@@ -0,0 +1,124 @@
+#pragma once
+
+// Opt-in heap accounting for the plugin's own code. Configuring with -DMAINT_ALLOC_TRACKING=ON replaces the
+// plugin's operator new/delete (the game and other plugins are unaffected) and attributes every allocation
+// to the innermost MAINT_ALLOC_REGION on the allocating thread. -DMAINT_ALLOC_BUDGETS=ON additionally fails
+// hard as soon as a single pass through a region allocates more than its budget.
+// Without the option MAINT_ALLOC_REGION expands to nothing.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+
+namespace MAINT
+{
+	namespace ALLOC
+	{
+		enum class Region : std::uint8_t
+		{
+			kOther,
+			kValidation,
+			kCast,
+			kLoad,
+			kSave,
+			kReload,
+			kDump,
+			kBatch,
+			kCount
+		};
+
+		constexpr std::string_view ToString(Region region)
+		{
+			switch (region) {
+			case Region::kOther:
+				return "Other";
+			case Region::kValidation:
+				return "Validation";
+			case Region::kCast:
+				return "Cast";
+			case Region::kLoad:
+				return "Load";
+			case Region::kSave:
+				return "Save";
+			case Region::kReload:
+				return "Reload";
+			case Region::kDump:
+				return "Dump";
+			case Region::kBatch:
+				return "Batch";
+			default:
+				return "Unknown";
+			}
+		}
+
+		// Allocations a single pass through a region may make when budgets are enforced, not counting nested
+		// regions. Provisional: Report logs the most any pass made, measure a session before tightening them.
+		inline constexpr std::array<std::uint64_t, static_cast<std::size_t>(Region::kCount)> Budgets{
+			(std::numeric_limits<std::uint64_t>::max)(),  // kOther
+			64,                                         // kValidation, one sweep
+			256,                                        // kCast, one maintained spell
+			65536,                                      // kLoad, purge + mapping
+			4096,                                       // kSave, one mapping write
+			(std::numeric_limits<std::uint64_t>::max)(),  // kReload, config poll and reapplying a changed config
+			(std::numeric_limits<std::uint64_t>::max)(),  // kDump, flight recorder snapshot
+			256                                         // kBatch, per spell of a batch, see MAINT_ALLOC_SCALE
+		};
+
+#ifdef MAINT_ALLOC_TRACKING
+		struct RegionStats
+		{
+			std::atomic<std::uint64_t> allocations;
+			std::atomic<std::uint64_t> bytes;
+			std::atomic<std::int64_t> live;
+			std::atomic<std::int64_t> peak;
+			std::atomic<std::uint64_t> passes;
+			std::atomic<std::uint64_t> nanoseconds;
+			std::atomic<std::uint64_t> maxPerPass;  // own allocations of the worst single pass
+		};
+
+		RegionStats& StatsOf(Region region);
+
+		// Attributes allocations of the current thread to region until destroyed, and times the pass. Scopes nest,
+		// the allocations of an inner scope count towards its own region only.
+		class Scope
+		{
+		public:
+			explicit Scope(Region region);
+			~Scope();
+
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+			// For passes that handle a variable number of items, the budget is multiplied by units.
+			void ScaleBudget(std::uint64_t units)
+			{
+				Units = (std::max)(units, std::uint64_t{ 1 });
+			}
+
+		private:
+			Region Current;
+			Region Previous;
+			Scope* Parent;
+			std::uint64_t StartAllocations;
+			std::uint64_t NestedAllocations = 0;
+			std::uint64_t Units = 1;
+			std::chrono::steady_clock::time_point Start;
+		};
+
+		// Logs allocations, bytes, peak live memory and average time per pass of every region entered so far.
+		void Report();
+#endif
+	}
+}
+
+#ifdef MAINT_ALLOC_TRACKING
+#	define MAINT_ALLOC_REGION(region) MAINT::ALLOC::Scope maintAllocScope(MAINT::ALLOC::Region::region)
+#	define MAINT_ALLOC_SCALE(units) maintAllocScope.ScaleBudget(units)
+#else
+#	define MAINT_ALLOC_REGION(region) static_cast<void>(0)
+#	define MAINT_ALLOC_SCALE(units) static_cast<void>(0)
+#endif
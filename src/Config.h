@@ -0,0 +1,383 @@
+#pragma once
+
+#include "Formula.h"
+#include "Rules.h"
+#include "SnapshotCell.h"
+
+#include <SimpleIni.h>
+
+namespace MAINT
+{
+	namespace CONFIG
+	{
+		inline constexpr std::string_view MAP_FILE		= "Data/SKSE/Plugins/MaintainedMagicNG.ini";
+		inline constexpr std::string_view CONFIG_FILE	= "Data/SKSE/Plugins/MaintainedMagicNG.Config.ini";
+
+		struct Settings
+		{
+			spdlog::level::level_enum LogLevel;
+			bool DoSilenceFX;
+			bool AggregateUpkeep;
+			long CostBaseDuration;
+			float CostReductionExponent;
+			float ValidationInterval;
+			float ValidationIntervalMax;
+			float ExperienceInterval;
+			float TaskJitter;
+			long WorkerThreads;
+			long MaintainAllHotkey;
+			std::string EventTraceFile;
+			std::string TimelineFile;
+			long TimelineBufferEvents;
+			std::string FlightRecorderFile;
+			std::string TelemetryEndpoint;
+			std::string RuleCastingTypes;
+			std::string RuleDeliveries;
+			std::string RuleAnyDeliveryArchetypes;
+			std::string RuleExcludedArchetypes;
+			std::string RuleExcludedKeywords;
+			std::string RuleKeepFXArchetypes;
+			float RuleMinDuration;
+			float RuleMinCost;
+			std::string CostFormula;
+			// Raw [COST_FORMULAS] section, school or archetype name = formula
+			std::vector<std::pair<std::string, std::string>> CostFormulaOverrides;
+		};
+
+		class ConfigBase
+		{
+		private:
+			CSimpleIniA Ini;
+			std::string IniPath;
+			ConfigBase(std::string const& iniPath) :
+				IniPath(iniPath)
+			{
+				logger::info("Load INI: {}", iniPath);
+				Ini.SetUnicode();
+				Ini.LoadFile(iniPath.c_str());
+			}
+
+		public:
+			template <const std::string_view& IniPath>
+			static ConfigBase* GetSingleton()
+			{
+				static ConfigBase instance{ std::string(IniPath) };
+				return &instance;
+			}
+
+			bool HasKey(const std::string& section, const std::string& key)
+			{
+				return Ini.KeyExists(section.c_str(), key.c_str());
+			}
+
+			bool HasSection(const std::string& section)
+			{
+				return Ini.SectionExists(section.c_str());
+			}
+
+			const std::vector<std::pair<std::string, std::string>> GetAllKeyValuePairs(const std::string& section) const
+			{
+				std::vector<std::pair<std::string, std::string>> ret;
+				CSimpleIniA::TNamesDepend keys;
+				Ini.GetAllKeys(section.c_str(), keys);
+				for (auto& key : keys) {
+					auto val = Ini.GetValue(section.c_str(), key.pItem);
+					ret.push_back({ key.pItem, val });
+				}
+
+				return ret;
+			}
+
+			std::vector<std::string> GetAllSections() const
+			{
+				std::vector<std::string> ret;
+				CSimpleIniA::TNamesDepend sections;
+				Ini.GetAllSections(sections);
+				for (auto& section : sections)
+					ret.emplace_back(section.pItem);
+				return ret;
+			}
+
+			void DeleteSection(const std::string& section)
+			{
+				Ini.Delete(section.c_str(), nullptr, true);
+			}
+
+			void DeleteKey(const std::string& section, const std::string& key)
+			{
+				Ini.Delete(section.c_str(), key.c_str());
+			}
+
+			std::string GetValue(const std::string& section, const std::string& key)
+			{
+				return Ini.GetValue(section.c_str(), key.c_str());
+			}
+
+			long GetLongValue(const std::string& section, const std::string& key)
+			{
+				return Ini.GetLongValue(section.c_str(), key.c_str());
+			}
+
+			bool GetBoolValue(const std::string& section, const std::string& key)
+			{
+				return Ini.GetBoolValue(section.c_str(), key.c_str());
+			}
+
+			double GetDoubleValue(const std::string& section, const std::string& key)
+			{
+				return Ini.GetDoubleValue(section.c_str(), key.c_str());
+			}
+
+			void SetValue(const std::string& section, const std::string& key, const std::string& value, const std::string& comment = std::string())
+			{
+				Ini.SetValue(section.c_str(), key.c_str(), value.c_str(), comment.length() > 0 ? comment.c_str() : (const char*)0);
+			}
+
+			void SetBoolValue(const std::string& section, const std::string& key, const bool value, const std::string& comment = std::string())
+			{
+				Ini.SetBoolValue(section.c_str(), key.c_str(), value, comment.length() > 0 ? comment.c_str() : (const char*)0);
+			}
+
+			void SetLongValue(const std::string& section, const std::string& key, const long value, const std::string& comment = std::string())
+			{
+				Ini.SetLongValue(section.c_str(), key.c_str(), value, comment.length() > 0 ? comment.c_str() : (const char*)0);
+			}
+
+			void SetDoubleValue(const std::string& section, const std::string& key, const double value, const std::string& comment = std::string())
+			{
+				Ini.SetDoubleValue(section.c_str(), key.c_str(), value, comment.length() > 0 ? comment.c_str() : (const char*)0);
+			}
+
+			void Reload()
+			{
+				Ini.Reset();
+				Ini.LoadFile(IniPath.c_str());
+			}
+
+			void Save()
+			{
+				Ini.SaveFile(IniPath.c_str());
+			}
+
+			ConfigBase(ConfigBase const&) = delete;
+			void operator=(ConfigBase const&) = delete;
+		};
+
+		namespace SCHEMA
+		{
+			template <class T>
+			struct MemberType;
+
+			template <class C, class T>
+			struct MemberType<T C::*>
+			{
+				using type = T;
+			};
+
+			template <class T>
+			struct Choice
+			{
+				std::string_view name;
+				T value;
+			};
+
+			template <class T>
+			inline constexpr std::span<const Choice<T>> ChoicesFor{};
+
+			inline constexpr std::array LogLevels{
+				Choice<spdlog::level::level_enum>{ "off", spdlog::level::level_enum::off },
+				Choice<spdlog::level::level_enum>{ "info", spdlog::level::level_enum::info },
+				Choice<spdlog::level::level_enum>{ "debug", spdlog::level::level_enum::debug },
+			};
+
+			template <>
+			inline constexpr std::span<const Choice<spdlog::level::level_enum>> ChoicesFor<spdlog::level::level_enum>{ LogLevels };
+
+			// One entry per INI key, bound to the Settings field it fills. Numeric values outside [min, max] are clamped.
+			template <auto Member>
+			struct Key
+			{
+				using value_type = typename MemberType<decltype(Member)>::type;
+				using default_type = std::conditional_t<std::is_same_v<value_type, std::string>, std::string_view, value_type>;
+				static constexpr auto member = Member;
+
+				const char* section;
+				const char* name;
+				default_type def;
+				const char* comment;
+				double min = -std::numeric_limits<double>::infinity();
+				double max = std::numeric_limits<double>::infinity();
+			};
+
+			inline constexpr auto Keys = std::make_tuple(
+				Key<&Settings::LogLevel>{ "CONFIG", "LogLevel", spdlog::level::level_enum::off,
+					"# Options: off, info, debug" },
+				Key<&Settings::DoSilenceFX>{ "CONFIG", "SilencePersistentSpellFX", false,
+					"# If true, will disable persistent spell visuals on maintained spells. This includes flesh spell FX, the aura of Cloak spells, pretty much everything else." },
+				Key<&Settings::AggregateUpkeep>{ "CONFIG", "AggregateUpkeepDebuff", false,
+					"# If true, the player carries a single Magicka debuff for the upkeep of all maintained spells instead of one per spell.\n# Halves the effects the plugin adds to the player. Existing saves are converted on load." },
+				Key<&Settings::CostBaseDuration>{ "CONFIG", "CostNeutralDuration", 60,
+					"# At this BASE spell duration, maintenance cost will be equal to its casting cost. Shorter spells will be more expensive, longer will be cheaper.\n# Reduce to make maintenance cheaper across the board.\n# Set to 0 to disable all cost scaling and only use the spell's casting cost.",
+					0.0, 86400.0 },
+				Key<&Settings::CostReductionExponent>{ "CONFIG", "CostReductionExponent", 0.0f,
+					"# Determines the impact of long durations on maintenance cost.\n# If this is set to 2.0 and a spell would last twice as long as CostNeutralDuration, its upkeep cost would be 1/4th compared to leaving this at 0.0\n# 1.0 would halve the cost. -1.0 would double it instead.\n# 0.0 = Disabled",
+					-16.0, 16.0 },
+				Key<&Settings::CostFormula>{ "CONFIG", "CostFormula", FORMULA::DEFAULT_UPKEEP_COST,
+					"# Upkeep cost of a maintained spell. The default reproduces CostNeutralDuration and CostReductionExponent.\n# Variables: BaseCost, BaseDuration, Duration, Skill, Count (spells maintained), NeutralDuration, Exponent\n# Operators: + - * / ^ < <= > >= == != && || ! and cond ? a : b\n# Functions: min, max, clamp, pow, sqrt, abs, round, floor, ceil, log, exp\n# Add a [COST_FORMULAS] section to override it per school (Alteration = ...) or per archetype of the first effect (Cloak = ...), archetypes win." },
+				Key<&Settings::ValidationInterval>{ "CONFIG", "ValidationInterval", 2.5f,
+					"# Seconds between checks whether maintained spells are still active on the player.",
+					0.5, 60.0 },
+				Key<&Settings::ValidationIntervalMax>{ "CONFIG", "ValidationIntervalMax", 20.0f,
+					"# While checks find nothing to do, the time between them doubles up to this many seconds.\n# Combat, equipping, casting or a dispelled maintained spell bring it back to ValidationInterval.\n# Set to the same value as ValidationInterval to always check at that rate.",
+					0.5, 300.0 },
+				Key<&Settings::ExperienceInterval>{ "CONFIG", "ExperienceInterval", 300.0f,
+					"# Seconds between skill experience awards for maintained spells.",
+					10.0, 3600.0 },
+				Key<&Settings::TaskJitter>{ "CONFIG", "TaskJitter", 0.1f,
+					"# Each periodic check is randomly moved by up to this fraction of its interval, so it doesn't line up with other mods' work.",
+					0.0, 0.5 },
+				Key<&Settings::WorkerThreads>{ "CONFIG", "WorkerThreads", 0,
+					"# Background threads for parsing and cost math. 0 picks one per spare CPU core, at most 4.\n# Takes effect after restarting the game.",
+					0.0, 16.0 },
+				Key<&Settings::MaintainAllHotkey>{ "CONFIG", "MaintainAllHotkey", 0,
+					"# DirectInput scan code of a key that maintains every spell you currently have active on yourself at once, e.g. 47 for V.\n# If Magicka doesn't cover all of them, the cheapest are maintained first. 0 disables the key.\n# Scripts can do the same with MaintainedMagicNG.MaintainActiveBuffs().",
+					0.0, 255.0 },
+				Key<&Settings::EventTraceFile>{ "DEBUG", "EventTraceFile", "",
+					"# If set, records a binary trace of casts, validation sweeps and load/save events to this file, for replay with TraceReplay.\n# Leave empty to disable. Example: Data/SKSE/Plugins/MaintainedMagicNG.trace" },
+				Key<&Settings::TimelineFile>{ "DEBUG", "TimelineFile", "",
+					"# If set, writes a timeline of the plugin's hooks to this file as Chrome trace JSON, which opens in Perfetto (ui.perfetto.dev).\n# Leave empty to disable. Example: Data/SKSE/Plugins/MaintainedMagicNG.timeline.json" },
+				Key<&Settings::TimelineBufferEvents>{ "DEBUG", "TimelineBufferEvents", 16384,
+					"# Events each thread can buffer between two timeline flushes. Further events are dropped.",
+					1024.0, 1048576.0 },
+				Key<&Settings::FlightRecorderFile>{ "DEBUG", "FlightRecorderFile", "Data/SKSE/Plugins/MaintainedMagicNG.flight.txt",
+					"# The plugin always remembers its last few thousand validation decisions. They are written to this file when a maintained spell is\n# dropped for anything but being dispelled, when Mind Crush hits, or when \"dump\" is sent to the TelemetryEndpoint.\n# Leave empty to never write it." },
+				Key<&Settings::TelemetryEndpoint>{ "DEBUG", "TelemetryEndpoint", "",
+					"# If set, serves live statistics at this local named pipe. Connect, send \"stats\" and read back one line of JSON.\n# Leave empty to disable. Example: \\\\.\\pipe\\MaintainedMagicNG" },
+				Key<&Settings::RuleCastingTypes>{ "RULES", "CastingTypes", RULES::DEFAULT_CASTING_TYPES,
+					"# Comma separated lists. Which spells can be maintained is decided by these rules, in this order.\n# Casting types that can be maintained. Options: ConstantEffect, FireAndForget, Concentration, Scroll" },
+				Key<&Settings::RuleMinDuration>{ "RULES", "MinDuration", RULES::DEFAULT_MIN_DURATION,
+					"# Spells lasting this many seconds or less cannot be maintained.",
+					0.0, 86400.0 },
+				Key<&Settings::RuleMinCost>{ "RULES", "MinCost", RULES::DEFAULT_MIN_COST,
+					"# Spells costing this much Magicka or less cannot be maintained.",
+					0.0, 100000.0 },
+				Key<&Settings::RuleExcludedKeywords>{ "RULES", "ExcludedKeywords", RULES::DEFAULT_EXCLUDED_KEYWORDS,
+					"# Editor IDs of keywords that exclude a spell. Keywords of plugins that are not loaded are ignored." },
+				Key<&Settings::RuleAnyDeliveryArchetypes>{ "RULES", "AnyDeliveryArchetypes", RULES::DEFAULT_ANY_DELIVERY_ARCHETYPES,
+					"# Archetypes of the first effect that can be maintained regardless of the spell's delivery." },
+				Key<&Settings::RuleDeliveries>{ "RULES", "Deliveries", RULES::DEFAULT_DELIVERIES,
+					"# Deliveries all other spells must have. Options: Self, Touch, Aimed, TargetActor, TargetLocation" },
+				Key<&Settings::RuleExcludedArchetypes>{ "RULES", "ExcludedArchetypes", RULES::DEFAULT_EXCLUDED_ARCHETYPES,
+					"# Archetypes of the first effect that cannot be maintained." },
+				Key<&Settings::RuleKeepFXArchetypes>{ "RULES", "KeepFXArchetypes", RULES::DEFAULT_KEEP_FX_ARCHETYPES,
+					"# Effect archetypes whose persistent visuals are kept with SilencePersistentSpellFX, as they would be pointless without them." });
+
+			template <class T>
+			constexpr std::string_view NameOf(T const& value)
+			{
+				for (auto const& choice : ChoicesFor<T>) {
+					if (choice.value == value)
+						return choice.name;
+				}
+				return ChoicesFor<T>.front().name;
+			}
+
+			inline Settings Defaults()
+			{
+				Settings settings;
+				std::apply([&](auto const&... keys) {
+					((settings.*(std::remove_cvref_t<decltype(keys)>::member) = typename std::remove_cvref_t<decltype(keys)>::value_type(keys.def)), ...);
+				},
+					Keys);
+				return settings;
+			}
+
+			// Reads a single key into its field, writing the default first if the key is missing.
+			// Returns true if the file was changed.
+			template <auto Member>
+			bool Read(ConfigBase* const& ini, Settings& settings, Key<Member> const& key)
+			{
+				using T = typename Key<Member>::value_type;
+				auto& field = settings.*Member;
+				const bool missing = !ini->HasKey(key.section, key.name);
+
+				if constexpr (std::is_same_v<T, bool>) {
+					if (missing)
+						ini->SetBoolValue(key.section, key.name, key.def, key.comment);
+					field = ini->GetBoolValue(key.section, key.name);
+				} else if constexpr (std::is_integral_v<T>) {
+					if (missing)
+						ini->SetLongValue(key.section, key.name, static_cast<long>(key.def), key.comment);
+					field = static_cast<T>(ini->GetLongValue(key.section, key.name));
+				} else if constexpr (std::is_floating_point_v<T>) {
+					if (missing)
+						ini->SetDoubleValue(key.section, key.name, static_cast<double>(key.def), key.comment);
+					field = static_cast<T>(ini->GetDoubleValue(key.section, key.name));
+				} else if constexpr (std::is_same_v<T, std::string>) {
+					if (missing)
+						ini->SetValue(key.section, key.name, std::string(key.def), key.comment);
+					field = ini->GetValue(key.section, key.name);
+				} else {
+					if (missing)
+						ini->SetValue(key.section, key.name, std::string(NameOf(key.def)), key.comment);
+					auto const& value = ini->GetValue(key.section, key.name);
+					auto const& choices = ChoicesFor<T>;
+					auto const& it = std::find_if(choices.begin(), choices.end(), [&](auto const& choice) { return choice.name == value; });
+					field = it != choices.end() ? it->value : key.def;
+				}
+
+				if constexpr (std::is_arithmetic_v<T> && !std::is_same_v<T, bool>) {
+					if (static_cast<double>(field) < key.min || static_cast<double>(field) > key.max) {
+						logger::warn("{} is outside of [{}, {}], clamping", key.name, key.min, key.max);
+						field = static_cast<T>(std::clamp(static_cast<double>(field), key.min, key.max));
+					}
+				}
+
+				if constexpr (std::is_enum_v<T>)
+					logger::info("{} is {}", key.name, NameOf(field));
+				else
+					logger::info("{} is {}", key.name, field);
+				return missing;
+			}
+
+			// Fills every field of the schema. Missing defaults are only added in memory, the caller writes the file
+			// back when missingDefaults is set, on the game thread.
+			inline Settings Load(ConfigBase* const& ini, bool& missingDefaults)
+			{
+				Settings settings;
+				missingDefaults = std::apply([&](auto const&... keys) { return (Read(ini, settings, keys) | ...); }, Keys);
+				return settings;
+			}
+		}
+
+		class SettingsStore
+		{
+		public:
+			// Pins the active settings without locking. Keep the view for as long as its fields are used, a
+			// reload published in the meantime is only reclaimed once the view is released.
+			static SnapshotCell<Settings>::View Get()
+			{
+				return Cell.Read();
+			}
+
+			// Superseded snapshots are freed as soon as no reader holds them anymore.
+			static void Publish(Settings const& settings)
+			{
+				Cell.Publish(settings);
+			}
+
+		private:
+			static inline SnapshotCell<Settings> Cell{ SCHEMA::Defaults() };
+		};
+
+		inline SnapshotCell<Settings>::View Current()
+		{
+			return SettingsStore::Get();
+		}
+
+		// Polled from the validation tick. Compares the config file's mtime and re-reads it on a worker thread on change.
+		void PollForChanges();
+		// Returns true once for every reload that was published since the last call.
+		bool ConsumeReload();
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "TraceFormat.h"
+
+namespace MAINT
+{
+	// Opt-in recorder writing everything the plugin reacts to into a binary trace (see TraceFormat.h),
+	// which tools/TraceReplay can feed back through the validation logic offline.
+	class EventRecorder
+	{
+	public:
+		static EventRecorder& GetSingleton()
+		{
+			static EventRecorder instance;
+			return instance;
+		}
+
+		// Starts a new trace at path, or stops recording if path is empty. Reopening the same path is a no-op.
+		void Open(std::string const& path)
+		{
+			std::lock_guard<std::mutex> guard(theMutex);
+			if (path == Path)
+				return;
+			Close();
+			Path = path;
+			if (Path.empty())
+				return;
+
+			File.open(Path, std::ios::binary | std::ios::trunc);
+			if (!File) {
+				logger::error("Failed to open event trace {}", Path);
+				return;
+			}
+			logger::info("Recording event trace to {}", Path);
+			Start = std::chrono::steady_clock::now();
+			Trace = std::make_unique<TRACE::Writer>(File);
+			Enabled.store(true, std::memory_order_release);
+		}
+
+		bool IsEnabled() const
+		{
+			return Enabled.load(std::memory_order_relaxed);
+		}
+
+		// Calls func(writer, timestamp) if recording. Costs a single relaxed load when disabled.
+		template <class Func>
+		void Record(Func&& func)
+		{
+			if (!IsEnabled())
+				return;
+			std::lock_guard<std::mutex> guard(theMutex);
+			if (!Trace)
+				return;
+			const auto& now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - Start).count();
+			func(*Trace, static_cast<std::uint64_t>(now));
+		}
+
+		void Flush()
+		{
+			if (!IsEnabled())
+				return;
+			std::lock_guard<std::mutex> guard(theMutex);
+			File.flush();
+		}
+
+	private:
+		EventRecorder() {}
+		EventRecorder(const EventRecorder&) = delete;
+		EventRecorder& operator=(const EventRecorder&) = delete;
+
+		void Close()
+		{
+			Enabled.store(false, std::memory_order_release);
+			Trace.reset();
+			if (File.is_open())
+				File.close();
+		}
+
+		std::ofstream File;
+		std::unique_ptr<TRACE::Writer> Trace;
+		std::string Path;
+		std::chrono::steady_clock::time_point Start;
+		std::atomic<bool> Enabled{ false };
+		std::mutex theMutex;
+	};
+}
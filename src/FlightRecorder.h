@@ -0,0 +1,268 @@
+#pragma once
+
+// Always-on flight recorder for the validation logic. Casts, maintain attempts, sweeps, every verdict and the
+// effects behind a failed one are kept as fixed-size records in a ring that overwrites its oldest entries. The
+// ring is only written out, as text, when something goes wrong or on request, so diagnosing a dropped spell no
+// longer needs debug logging. Recording is lock-free and safe from any thread: one fetch_add and a few relaxed
+// stores into a slot guarded by its own sequence number.
+
+#include "Validation.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace MAINT
+{
+	namespace FLIGHT
+	{
+		enum class Kind : std::uint8_t
+		{
+			kCast,       // subject: spell
+			kMaintain,   // subject: base, other: maintained or 0, value: upkeep, detail: Outcome
+			kSweep,      // count: maintained, count2: removed, other: active effects, value: milliseconds
+			kVerdict,    // subject: base, other: maintained, count: effects, count2: grouped effects, extra: exclusives, detail: Verdict
+			kEffect,     // subject: source spell, other: maintained it counted towards, value: duration, value2: elapsed, detail: flags
+			kRemoval,    // subject: base, other: maintained, detail: Verdict
+			kReprice,    // subject: base, value: old upkeep, value2: new upkeep
+			kMindCrush,  // count: maintained, value: magicka, value2: total upkeep
+			kMessage     // detail: Message
+		};
+
+		enum class Outcome : std::uint8_t
+		{
+			kMaintained,
+			kNotMaintainable,
+			kNoMagicka,
+			kAlreadyMaintained,
+			kNoFormIDs
+		};
+
+		enum class Message : std::uint8_t
+		{
+			kPreLoad,
+			kPostLoad,
+			kNewGame,
+			kSave
+		};
+
+		struct Record
+		{
+			std::uint64_t time = 0;  // microseconds since the recorder was created, set by Push
+			std::uint32_t subject = 0;
+			std::uint32_t other = 0;
+			float value = 0.0f;
+			float value2 = 0.0f;
+			std::uint16_t count = 0;
+			std::uint16_t count2 = 0;
+			std::uint16_t extra = 0;
+			Kind kind = Kind::kCast;
+			std::uint8_t detail = 0;
+		};
+		static_assert(sizeof(Record) == 32 && std::is_trivially_copyable_v<Record>);
+
+		template <std::size_t Capacity>
+		class Recorder
+		{
+			static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+			static constexpr std::size_t WORDS = sizeof(Record) / sizeof(std::uint64_t);
+
+			// sequence is 2 * index + 1 while the record of that index is written, 2 * index + 2 once it's complete
+			struct Slot
+			{
+				std::atomic<std::uint64_t> sequence{ 0 };
+				std::array<std::atomic<std::uint64_t>, WORDS> words{};
+			};
+
+		public:
+			void Push(Record record)
+			{
+				record.time = Now();
+				std::uint64_t words[WORDS];
+				std::memcpy(words, &record, sizeof(record));
+
+				const auto& index = Head.fetch_add(1, std::memory_order_relaxed);
+				auto& slot = Slots[index & (Capacity - 1)];
+				slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_release);
+				for (std::size_t i = 0; i < WORDS; ++i)
+					slot.words[i].store(words[i], std::memory_order_relaxed);
+				slot.sequence.store(2 * index + 2, std::memory_order_release);
+			}
+
+			// Complete records, oldest first. Records being written or overwritten while copying are left out.
+			std::vector<Record> Snapshot() const
+			{
+				const auto& head = Head.load(std::memory_order_acquire);
+				const auto& first = head > Capacity ? head - Capacity : 0;
+				std::vector<Record> ret;
+				ret.reserve(static_cast<std::size_t>(head - first));
+				for (auto index = first; index < head; ++index) {
+					auto const& slot = Slots[index & (Capacity - 1)];
+					const auto& before = slot.sequence.load(std::memory_order_acquire);
+					if (before != 2 * index + 2)
+						continue;
+					std::uint64_t words[WORDS];
+					for (std::size_t i = 0; i < WORDS; ++i)
+						words[i] = slot.words[i].load(std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_acquire);
+					if (slot.sequence.load(std::memory_order_relaxed) != before)
+						continue;
+					std::memcpy(&ret.emplace_back(), words, sizeof(Record));
+				}
+				return ret;
+			}
+
+			std::uint64_t Recorded() const
+			{
+				return Head.load(std::memory_order_relaxed);
+			}
+
+			std::uint64_t Now() const
+			{
+				return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - Start).count());
+			}
+
+			static constexpr std::size_t GetCapacity()
+			{
+				return Capacity;
+			}
+
+		private:
+			std::array<Slot, Capacity> Slots{};
+			std::atomic<std::uint64_t> Head{ 0 };
+			const std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+		};
+
+		constexpr std::string_view ToString(Outcome outcome)
+		{
+			switch (outcome) {
+			case Outcome::kMaintained:
+				return "maintained";
+			case Outcome::kNotMaintainable:
+				return "not maintainable";
+			case Outcome::kNoMagicka:
+				return "not enough Magicka";
+			case Outcome::kAlreadyMaintained:
+				return "already maintained";
+			case Outcome::kNoFormIDs:
+				return "no free FormIDs";
+			default:
+				return "unknown";
+			}
+		}
+
+		constexpr std::string_view ToString(Message message)
+		{
+			switch (message) {
+			case Message::kPreLoad:
+				return "loading save";
+			case Message::kPostLoad:
+				return "save loaded";
+			case Message::kNewGame:
+				return "new game";
+			case Message::kSave:
+				return "saving";
+			default:
+				return "unknown";
+			}
+		}
+
+		// One line per record, timestamps relative to now. nameOf(FormID) returns a display name or an empty string.
+		template <class NameOf>
+		void WriteText(std::ostream& out, std::span<const Record> records, std::string_view reason, std::uint64_t now, NameOf&& nameOf)
+		{
+			char line[512];
+			const auto& form = [&](std::uint32_t formID) {
+				const std::string& name = nameOf(formID);
+				char id[16];
+				std::snprintf(id, sizeof(id), "0x%08" PRIX32, formID);
+				return name.empty() ? std::string(id) : name + " (" + id + ")";
+			};
+			const auto& verdict = [](std::uint8_t detail) { return std::string(VALIDATION::ToString(static_cast<VALIDATION::Verdict>(detail))); };
+
+			out << "Flight recorder dump: " << reason << "\n";
+			out << records.size() << " records\n\n";
+			for (auto const& r : records) {
+				const auto& age = static_cast<double>(static_cast<std::int64_t>(r.time) - static_cast<std::int64_t>(now)) / 1e6;
+				std::string text;
+				switch (r.kind) {
+				case Kind::kCast:
+					text = "cast      " + form(r.subject);
+					break;
+				case Kind::kMaintain:
+					std::snprintf(line, sizeof(line), "maintain  %s: %s, upkeep %.1f", form(r.subject).c_str(), ToString(static_cast<Outcome>(r.detail)).data(), r.value);
+					text = line;
+					break;
+				case Kind::kSweep:
+					std::snprintf(line, sizeof(line), "sweep     %u maintained, %" PRIu32 " active effects, %u removed, %.3fms", r.count, r.other, r.count2, r.value);
+					text = line;
+					break;
+				case Kind::kVerdict:
+					std::snprintf(line, sizeof(line), "verdict   %s of %s: %s, expects %u effects (%u exclusive), found %u", form(r.other).c_str(), form(r.subject).c_str(),
+						verdict(r.detail).c_str(), r.count, r.extra, r.count2);
+					text = line;
+					break;
+				case Kind::kEffect:
+					std::snprintf(line, sizeof(line), "  effect  from %s for %s, duration %.1f, elapsed %.1f%s%s%s", form(r.subject).c_str(), form(r.other).c_str(), r.value, r.value2,
+						r.detail & VALIDATION::ActiveEffectFact::kMaintainedKeyword ? ", maintained keyword" : "",
+						r.detail & VALIDATION::ActiveEffectFact::kInactive ? ", inactive" : "",
+						r.detail & VALIDATION::ActiveEffectFact::kFromSpell ? "" : ", not from a spell");
+					text = line;
+					break;
+				case Kind::kRemoval:
+					text = "removed   " + form(r.other) + " of " + form(r.subject) + ": " + verdict(r.detail);
+					break;
+				case Kind::kReprice:
+					std::snprintf(line, sizeof(line), "reprice   %s from %.1f to %.1f", form(r.subject).c_str(), r.value, r.value2);
+					text = line;
+					break;
+				case Kind::kMindCrush:
+					std::snprintf(line, sizeof(line), "MINDCRUSH Magicka %.1f with %u maintained spells draining %.1f", r.value, r.count, r.value2);
+					text = line;
+					break;
+				case Kind::kMessage:
+					text = "message   " + std::string(ToString(static_cast<Message>(r.detail)));
+					break;
+				default:
+					text = "unknown record";
+					break;
+				}
+				std::snprintf(line, sizeof(line), "%12.6fs  ", age);
+				out << line << text << "\n";
+			}
+		}
+
+		// FormIDs a dump refers to, for resolving their names up front.
+		inline void CollectFormIDs(std::span<const Record> records, std::vector<std::uint32_t>& out)
+		{
+			for (auto const& r : records) {
+				switch (r.kind) {
+				case Kind::kCast:
+				case Kind::kMaintain:
+				case Kind::kReprice:
+					out.push_back(r.subject);
+					break;
+				case Kind::kVerdict:
+				case Kind::kEffect:
+				case Kind::kRemoval:
+					out.push_back(r.subject);
+					out.push_back(r.other);
+					break;
+				default:
+					break;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+// Occupancy bitmap over a fixed range of indices. A summary word tracks which 64-bit words are full,
+// so allocating is two bit scans and freeing is two bit clears, independent of how many are taken.
+template <std::size_t Capacity>
+class OccupancyBitmap
+{
+	static_assert(Capacity % 64 == 0 && Capacity <= 64 * 64, "Capacity must fit into a single summary word");
+	static constexpr std::size_t WORDS = Capacity / 64;
+
+private:
+	std::array<uint64_t, WORDS> Words{};
+	uint64_t FullWords = 0;
+	std::size_t Used = 0;
+
+public:
+	static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+	std::size_t Allocate()
+	{
+		const auto& freeWord = static_cast<std::size_t>(std::countr_one(FullWords));
+		if (freeWord >= WORDS)
+			return npos;
+		const auto& index = freeWord * 64 + static_cast<std::size_t>(std::countr_one(Words[freeWord]));
+		Reserve(index);
+		return index;
+	}
+
+	// Returns false if the index was already taken.
+	bool Reserve(std::size_t index)
+	{
+		auto& word = Words[index / 64];
+		const uint64_t bit = uint64_t{ 1 } << (index % 64);
+		if (word & bit)
+			return false;
+		word |= bit;
+		if (word == ~uint64_t{ 0 })
+			FullWords |= uint64_t{ 1 } << (index / 64);
+		++Used;
+		return true;
+	}
+
+	void Free(std::size_t index)
+	{
+		auto& word = Words[index / 64];
+		const uint64_t bit = uint64_t{ 1 } << (index % 64);
+		if (!(word & bit))
+			return;
+		word &= ~bit;
+		FullWords &= ~(uint64_t{ 1 } << (index / 64));
+		--Used;
+	}
+
+	bool Test(std::size_t index) const
+	{
+		return (Words[index / 64] >> (index % 64)) & 1;
+	}
+
+	std::size_t Count() const
+	{
+		return Used;
+	}
+
+	void Clear()
+	{
+		Words.fill(0);
+		FullWords = 0;
+		Used = 0;
+	}
+
+	template <class Func>
+	void ForEach(Func&& func) const
+	{
+		for (std::size_t w = 0; w < WORDS; ++w) {
+			for (auto bits = Words[w]; bits != 0; bits &= bits - 1)
+				func(w * 64 + static_cast<std::size_t>(std::countr_zero(bits)));
+		}
+	}
+};
+
+namespace MAINT
+{
+	// Hands out FormIDs for generated spells from the plugin's 0xFF03Fxxx range. IDs are reused once
+	// their spells are purged or dropped, and IDs found to belong to other forms are never handed out.
+	class FormIDAllocator
+	{
+	public:
+		static constexpr RE::FormID FORMID_BASE = 0xFF03F000;
+		static constexpr std::size_t FORMID_RANGE = 0x1000;
+
+		static FormIDAllocator& GetSingleton()
+		{
+			static FormIDAllocator instance;
+			return instance;
+		}
+
+		static constexpr bool Owns(RE::FormID const& formID)
+		{
+			return formID >= FORMID_BASE && formID < FORMID_BASE + FORMID_RANGE;
+		}
+
+		// Returns 0x0 once the range is exhausted.
+		RE::FormID Allocate()
+		{
+			while (true) {
+				const auto& index = Used.Allocate();
+				if (index == Used.npos) {
+					logger::error("FormID range 0x{:08X} is exhausted", FORMID_BASE);
+					return 0x0;
+				}
+				const auto& formID = FORMID_BASE + static_cast<RE::FormID>(index);
+				const auto& form = ClaimedElsewhere(formID);
+				if (!form)
+					return formID;
+				logger::warn("FormID 0x{:08X} is already claimed by {} ({})", formID, form->GetName(), RE::FormTypeToString(form->GetFormType()));
+				Foreign.Reserve(index);
+			}
+		}
+
+		// Marks an ID restored from the savegame mapping as taken. Returns false if it already was.
+		bool Claim(RE::FormID const& formID)
+		{
+			if (!Owns(formID))
+				return false;
+			return Used.Reserve(formID - FORMID_BASE);
+		}
+
+		bool IsForeign(RE::FormID const& formID) const
+		{
+			return Owns(formID) && Foreign.Test(formID - FORMID_BASE);
+		}
+
+		void Release(RE::FormID const& formID)
+		{
+			if (!Owns(formID) || Foreign.Test(formID - FORMID_BASE))
+				return;
+			Used.Free(formID - FORMID_BASE);
+		}
+
+		// Frees everything. Which IDs other forms hold depends on the load order, so ScanForCollisions finds
+		// them again for every savegame.
+		void Reset()
+		{
+			Used.Clear();
+			Foreign.Clear();
+		}
+
+		// Checks the IDs taken in the bitmap against the live forms and marks those held by someone else as
+		// foreign. Free IDs aren't looked up here, Allocate checks each one before handing it out. Must run
+		// while none of our own spells are alive, i.e. right after a purge.
+		std::size_t ScanForCollisions()
+		{
+			std::size_t found = 0;
+			Used.ForEach([&](std::size_t index) {
+				const auto& formID = FORMID_BASE + static_cast<RE::FormID>(index);
+				if (const auto& form = ClaimedElsewhere(formID)) {
+					logger::debug("FormID 0x{:08X} is already claimed by {} ({})", formID, form->GetName(), RE::FormTypeToString(form->GetFormType()));
+					Foreign.Reserve(index);
+					++found;
+				}
+			});
+			return found;
+		}
+
+		// Serializes the occupancy as a list of hex ranges, e.g. "0x000-0x00B,0x010"
+		std::string Serialize() const
+		{
+			std::string ret;
+			std::size_t runStart = Used.npos;
+			std::size_t runEnd = Used.npos;
+			const auto& flush = [&]() {
+				if (runStart == Used.npos)
+					return;
+				if (!ret.empty())
+					ret += ',';
+				ret += runStart == runEnd ? std::format("0x{:03X}", runStart) : std::format("0x{:03X}-0x{:03X}", runStart, runEnd);
+			};
+			Used.ForEach([&](std::size_t index) {
+				if (runEnd != Used.npos && index == runEnd + 1) {
+					runEnd = index;
+					return;
+				}
+				flush();
+				runStart = runEnd = index;
+			});
+			flush();
+			return ret;
+		}
+
+		void Deserialize(std::string_view const& ranges)
+		{
+			constexpr auto parseIndex = [](std::string_view part, std::size_t& out) {
+				if (part.starts_with("0x"))
+					part.remove_prefix(2);
+				auto const& [ptr, ec] = std::from_chars(part.data(), part.data() + part.size(), out, 16);
+				return ec == std::errc() && ptr == part.data() + part.size() && out < FORMID_RANGE;
+			};
+
+			std::size_t pos = 0;
+			while (pos < ranges.size()) {
+				const auto comma = (std::min)(ranges.find(',', pos), ranges.size());
+				const auto& part = ranges.substr(pos, comma - pos);
+				pos = comma + 1;
+
+				const auto& dash = part.find('-');
+				std::size_t first = 0;
+				std::size_t last = 0;
+				if (!parseIndex(part.substr(0, dash), first) || !parseIndex(dash == std::string_view::npos ? part : part.substr(dash + 1), last)) {
+					logger::warn("Malformed FormID range '{}'", part);
+					continue;
+				}
+				for (auto index = first; index <= last; ++index)
+					Used.Reserve(index);
+			}
+		}
+
+		std::size_t Count() const
+		{
+			return Used.Count();
+		}
+
+	private:
+		FormIDAllocator() {}
+		FormIDAllocator(const FormIDAllocator&) = delete;
+		FormIDAllocator& operator=(const FormIDAllocator&) = delete;
+
+		// Our own purged and dropped spells are flagged deleted, their IDs are free to be reused.
+		static RE::TESForm* ClaimedElsewhere(RE::FormID const& formID)
+		{
+			const auto& form = RE::TESForm::LookupByID(formID);
+			return form && !form->IsDeleted() ? form : nullptr;
+		}
+
+		OccupancyBitmap<FORMID_RANGE> Used;
+		OccupancyBitmap<FORMID_RANGE> Foreign;
+	};
+}
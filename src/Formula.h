@@ -0,0 +1,566 @@
+#pragma once
+
+// Engine independent part of the upkeep cost formulas. A formula from the config is parsed once and compiled to
+// a flat register bytecode: variables and constants live in fixed registers, temporaries are allocated like a
+// stack, constant subexpressions are folded and conditionals are branchless selects. Evaluating it for every
+// maintained spell is then a tight loop over a few dozen instructions.
+//
+//   expr    := or [ '?' expr ':' expr ]
+//   or      := and { '||' and }
+//   and     := compare { '&&' compare }
+//   compare := sum [ ('<' | '<=' | '>' | '>=' | '==' | '!=') sum ]
+//   sum     := product { ('+' | '-') product }
+//   product := unary { ('*' | '/') unary }
+//   unary   := ('-' | '!') unary | power
+//   power   := primary [ '^' unary ]
+//   primary := number | variable | function '(' expr { ',' expr } ')' | '(' expr ')'
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace MAINT
+{
+	namespace FORMULA
+	{
+		enum Variable : std::uint8_t
+		{
+			kBaseCost,         // casting cost with the caster's cost modifiers
+			kBaseDuration,     // duration of the first effect as authored
+			kDuration,         // duration the caster actually got, BaseDuration if unknown
+			kSkill,            // caster's level in the spell's school
+			kCount,            // spells maintained, including this one
+			kNeutralDuration,  // CostNeutralDuration
+			kExponent,         // CostReductionExponent
+			kVariableCount
+		};
+
+		inline constexpr std::array<std::string_view, kVariableCount> VARIABLES{
+			"BaseCost", "BaseDuration", "Duration", "Skill", "Count", "NeutralDuration", "Exponent"
+		};
+
+		using Inputs = std::array<float, kVariableCount>;
+
+		// Same curve as the cost calculation before formulas existed: squared ratio below the neutral duration,
+		// sqrt ratio to the power of the exponent above it, corrected for the duration the caster actually got.
+		inline constexpr std::string_view DEFAULT_UPKEEP_COST =
+			"NeutralDuration == 0 ? BaseCost : round(BaseCost"
+			" * (BaseDuration < NeutralDuration ? (NeutralDuration / max(1, BaseDuration)) ^ 2 : sqrt(NeutralDuration / max(1, BaseDuration)) ^ Exponent)"
+			" * (Duration != BaseDuration ? sqrt(BaseDuration / Duration) : 1)"
+			" * (Duration > BaseDuration ? (NeutralDuration / Duration) ^ Exponent : 1))";
+
+		// DEFAULT_UPKEEP_COST written out by hand. Programs compiled from the default text evaluate this instead of
+		// interpreting it, FormulaBench checks that both agree.
+		inline float DefaultUpkeepCost(Inputs const& in)
+		{
+			const auto& neutralDuration = in[kNeutralDuration];
+			const auto& exponent = in[kExponent];
+			const auto& baseCost = in[kBaseCost];
+			if (neutralDuration == 0.0f)
+				return baseCost;
+
+			const auto& baseDuration = in[kBaseDuration];
+			const auto& duration = in[kDuration];
+			const auto clampedBase = (std::max)(1.0f, baseDuration);
+			auto mult = clampedBase < neutralDuration ? std::pow(neutralDuration / clampedBase, 2.0f) : std::pow(std::sqrt(neutralDuration / clampedBase), exponent);
+			if (duration != baseDuration)
+				mult *= std::sqrt(baseDuration / duration);
+			if (duration > baseDuration)
+				mult *= std::pow(neutralDuration / duration, exponent);
+			return std::round(baseCost * mult);
+		}
+
+		enum class Op : std::uint8_t
+		{
+			kAdd,
+			kSub,
+			kMul,
+			kDiv,
+			kPow,
+			kNeg,
+			kNot,
+			kLess,
+			kLessEqual,
+			kGreater,
+			kGreaterEqual,
+			kEqual,
+			kNotEqual,
+			kAnd,
+			kOr,
+			kSelect,  // a ? b : c
+			kMin,
+			kMax,
+			kClamp,   // clamp(a, b, c)
+			kSqrt,
+			kAbs,
+			kRound,
+			kFloor,
+			kCeil,
+			kLog,
+			kExp
+		};
+
+		struct Instruction
+		{
+			Op op;
+			std::uint8_t dst;
+			std::uint8_t a;
+			std::uint8_t b;
+			std::uint8_t c;
+		};
+
+		inline float Apply(Op op, float a, float b, float c)
+		{
+			switch (op) {
+			case Op::kAdd:
+				return a + b;
+			case Op::kSub:
+				return a - b;
+			case Op::kMul:
+				return a * b;
+			case Op::kDiv:
+				return a / b;
+			case Op::kPow:
+				return std::pow(a, b);
+			case Op::kNeg:
+				return -a;
+			case Op::kNot:
+				return a == 0.0f ? 1.0f : 0.0f;
+			case Op::kLess:
+				return a < b ? 1.0f : 0.0f;
+			case Op::kLessEqual:
+				return a <= b ? 1.0f : 0.0f;
+			case Op::kGreater:
+				return a > b ? 1.0f : 0.0f;
+			case Op::kGreaterEqual:
+				return a >= b ? 1.0f : 0.0f;
+			case Op::kEqual:
+				return a == b ? 1.0f : 0.0f;
+			case Op::kNotEqual:
+				return a != b ? 1.0f : 0.0f;
+			case Op::kAnd:
+				return a != 0.0f && b != 0.0f ? 1.0f : 0.0f;
+			case Op::kOr:
+				return a != 0.0f || b != 0.0f ? 1.0f : 0.0f;
+			case Op::kSelect:
+				return a != 0.0f ? b : c;
+			case Op::kMin:
+				return (std::min)(a, b);
+			case Op::kMax:
+				return (std::max)(a, b);
+			case Op::kClamp:
+				return (std::min)((std::max)(a, b), c);
+			case Op::kSqrt:
+				return std::sqrt(a);
+			case Op::kAbs:
+				return std::abs(a);
+			case Op::kRound:
+				return std::round(a);
+			case Op::kFloor:
+				return std::floor(a);
+			case Op::kCeil:
+				return std::ceil(a);
+			case Op::kLog:
+				return std::log(a);
+			case Op::kExp:
+				return std::exp(a);
+			default:
+				return 0.0f;
+			}
+		}
+
+		class Program
+		{
+		public:
+			static constexpr std::size_t MAX_REGISTERS = 256;
+
+			float Evaluate(Inputs const& inputs) const
+			{
+				float out = 0.0f;
+				EvaluateBatch({ &inputs, 1 }, { &out, 1 });
+				return out;
+			}
+
+			// Constants are loaded once per batch, only the variables change between spells.
+			void EvaluateBatch(std::span<const Inputs> inputs, std::span<float> out) const
+			{
+				if (Native) {
+					const auto count = (std::min)(inputs.size(), out.size());
+					for (std::size_t i = 0; i < count; ++i)
+						out[i] = Native(inputs[i]);
+					return;
+				}
+				std::array<float, MAX_REGISTERS> r;
+				std::copy(Constants.begin(), Constants.end(), r.begin() + kVariableCount);
+				const auto count = (std::min)(inputs.size(), out.size());
+				for (std::size_t i = 0; i < count; ++i) {
+					std::copy(inputs[i].begin(), inputs[i].end(), r.begin());
+					for (auto const& ins : Code)
+						r[ins.dst] = Apply(ins.op, r[ins.a], r[ins.b], r[ins.c]);
+					out[i] = r[Result];
+				}
+			}
+
+			bool Uses(Variable variable) const
+			{
+				return (UsedVariables >> variable) & 1;
+			}
+
+			std::size_t Size() const
+			{
+				return Code.size();
+			}
+
+			std::string const& Source() const
+			{
+				return Text;
+			}
+
+			bool IsNative() const
+			{
+				return Native != nullptr;
+			}
+
+			// Drops the native shortcut, so the compiled code runs even for the default formula.
+			void Interpret()
+			{
+				Native = nullptr;
+			}
+
+		private:
+			friend class Compiler;
+
+			std::string Text;
+			std::vector<Instruction> Code;
+			std::vector<float> Constants;
+			std::uint8_t Result = 0;
+			std::uint32_t UsedVariables = 0;
+			float (*Native)(Inputs const&) = nullptr;
+		};
+
+		class Compiler
+		{
+		public:
+			// Returns false and describes the first problem in error if the text is not a valid formula.
+			static bool Compile(std::string_view text, Program& program, std::string& error)
+			{
+				Compiler compiler(text);
+				const auto& result = compiler.Expression();
+				compiler.SkipSpace();
+				if (compiler.Error.empty() && compiler.Pos < text.size())
+					compiler.Fail("unexpected '" + std::string(1, text[compiler.Pos]) + "'");
+				if (!compiler.Error.empty()) {
+					error = compiler.Error;
+					return false;
+				}
+				compiler.Out.Text = text;
+				compiler.Out.Result = result;
+				// Most users never touch the formula, they get the curve without an interpreter in between
+				if (text == DEFAULT_UPKEEP_COST)
+					compiler.Out.Native = DefaultUpkeepCost;
+				program = std::move(compiler.Out);
+				return true;
+			}
+
+		private:
+			using Reg = std::uint8_t;
+
+			explicit Compiler(std::string_view text) :
+				Text(text)
+			{}
+
+			Reg Expression()
+			{
+				const auto& condition = Or();
+				if (!Accept("?"))
+					return condition;
+				const auto& whenTrue = Expression();
+				if (!Accept(":")) {
+					Fail("expected ':'");
+					return condition;
+				}
+				const auto& whenFalse = Expression();
+				return Emit(Op::kSelect, condition, whenTrue, whenFalse);
+			}
+
+			Reg Or()
+			{
+				auto left = And();
+				while (Accept("||"))
+					left = Emit(Op::kOr, left, And());
+				return left;
+			}
+
+			Reg And()
+			{
+				auto left = Compare();
+				while (Accept("&&"))
+					left = Emit(Op::kAnd, left, Compare());
+				return left;
+			}
+
+			Reg Compare()
+			{
+				const auto& left = Sum();
+				if (Accept("<="))
+					return Emit(Op::kLessEqual, left, Sum());
+				if (Accept(">="))
+					return Emit(Op::kGreaterEqual, left, Sum());
+				if (Accept("=="))
+					return Emit(Op::kEqual, left, Sum());
+				if (Accept("!="))
+					return Emit(Op::kNotEqual, left, Sum());
+				if (Accept("<"))
+					return Emit(Op::kLess, left, Sum());
+				if (Accept(">"))
+					return Emit(Op::kGreater, left, Sum());
+				return left;
+			}
+
+			Reg Sum()
+			{
+				auto left = Product();
+				while (true) {
+					if (Accept("+"))
+						left = Emit(Op::kAdd, left, Product());
+					else if (Accept("-"))
+						left = Emit(Op::kSub, left, Product());
+					else
+						return left;
+				}
+			}
+
+			Reg Product()
+			{
+				auto left = Unary();
+				while (true) {
+					if (Accept("*"))
+						left = Emit(Op::kMul, left, Unary());
+					else if (Accept("/"))
+						left = Emit(Op::kDiv, left, Unary());
+					else
+						return left;
+				}
+			}
+
+			Reg Unary()
+			{
+				if (Accept("-"))
+					return Emit(Op::kNeg, Unary());
+				if (Accept("!"))
+					return Emit(Op::kNot, Unary());
+				return Power();
+			}
+
+			Reg Power()
+			{
+				const auto& base = Primary();
+				if (Accept("^"))
+					return Emit(Op::kPow, base, Unary());
+				return base;
+			}
+
+			Reg Primary()
+			{
+				SkipSpace();
+				if (!Error.empty() || Pos >= Text.size()) {
+					Fail("unexpected end of formula");
+					return 0;
+				}
+				if (Accept("(")) {
+					const auto& inner = Expression();
+					if (!Accept(")"))
+						Fail("expected ')'");
+					return inner;
+				}
+
+				const auto& c = Text[Pos];
+				if ((c >= '0' && c <= '9') || c == '.') {
+					float value = 0.0f;
+					auto const& [ptr, ec] = std::from_chars(Text.data() + Pos, Text.data() + Text.size(), value);
+					if (ec != std::errc()) {
+						Fail("malformed number");
+						return 0;
+					}
+					Pos = static_cast<std::size_t>(ptr - Text.data());
+					return Constant(value);
+				}
+
+				const auto start = Pos;
+				while (Pos < Text.size() && (std::isalnum(static_cast<unsigned char>(Text[Pos])) || Text[Pos] == '_'))
+					++Pos;
+				const auto& name = Text.substr(start, Pos - start);
+				if (name.empty()) {
+					Fail("unexpected '" + std::string(1, c) + "'");
+					return 0;
+				}
+
+				if (!Accept("(")) {
+					for (std::uint8_t v = 0; v < kVariableCount; ++v) {
+						if (VARIABLES[v] == name) {
+							Out.UsedVariables |= 1u << v;
+							return v;
+						}
+					}
+					Fail("unknown variable '" + std::string(name) + "'");
+					return 0;
+				}
+
+				std::vector<Reg> args;
+				if (!Accept(")")) {
+					do
+						args.push_back(Expression());
+					while (Accept(","));
+					if (!Accept(")"))
+						Fail("expected ')'");
+				}
+				return Call(name, args);
+			}
+
+			Reg Call(std::string_view name, std::vector<Reg> const& args)
+			{
+				struct Function
+				{
+					std::string_view name;
+					Op op;
+					std::size_t arity;
+				};
+				constexpr std::array<Function, 11> FUNCTIONS{ {
+					{ "sqrt", Op::kSqrt, 1 },
+					{ "abs", Op::kAbs, 1 },
+					{ "round", Op::kRound, 1 },
+					{ "floor", Op::kFloor, 1 },
+					{ "ceil", Op::kCeil, 1 },
+					{ "log", Op::kLog, 1 },
+					{ "exp", Op::kExp, 1 },
+					{ "pow", Op::kPow, 2 },
+					{ "clamp", Op::kClamp, 3 },
+					{ "min", Op::kMin, 2 },
+					{ "max", Op::kMax, 2 },
+				} };
+
+				// min and max take any number of arguments
+				if ((name == "min" || name == "max") && args.size() >= 2) {
+					auto result = args.front();
+					for (std::size_t i = 1; i < args.size(); ++i)
+						result = Emit(name == "min" ? Op::kMin : Op::kMax, result, args[i]);
+					return result;
+				}
+				for (auto const& function : FUNCTIONS) {
+					if (function.name != name)
+						continue;
+					if (args.size() != function.arity) {
+						Fail(std::string(name) + " takes " + std::to_string(function.arity) + " argument(s)");
+						return 0;
+					}
+					return Emit(function.op, args[0], args.size() > 1 ? args[1] : 0, args.size() > 2 ? args[2] : 0);
+				}
+				Fail("unknown function '" + std::string(name) + "'");
+				return 0;
+			}
+
+			// Operands that are all constants are folded right away, otherwise the operands' temporaries are
+			// released and the result takes the lowest free one.
+			Reg Emit(Op op, Reg a, Reg b = 0, Reg c = 0)
+			{
+				if (!Error.empty())
+					return 0;
+				const auto& arity = op == Op::kSelect || op == Op::kClamp ? 3 : (op == Op::kNeg || op == Op::kNot || op >= Op::kSqrt ? 1 : 2);
+				if (IsConstant(a) && (arity < 2 || IsConstant(b)) && (arity < 3 || IsConstant(c)))
+					return Constant(Apply(op, ValueOf(a), ValueOf(b), ValueOf(c)));
+				if (op == Op::kSelect && IsConstant(a))
+					return ValueOf(a) != 0.0f ? b : c;
+				if (op == Op::kPow && IsConstant(b) && ValueOf(b) == 2.0f)
+					return Emit(Op::kMul, a, a);
+
+				Release(c);
+				Release(b);
+				Release(a);
+				const auto& dst = Allocate();
+				Out.Code.push_back({ op, dst, a, b, c });
+				return dst;
+			}
+
+			Reg Constant(float value)
+			{
+				const auto& it = std::find(Out.Constants.begin(), Out.Constants.end(), value);
+				if (it != Out.Constants.end())
+					return static_cast<Reg>(kVariableCount + (it - Out.Constants.begin()));
+				if (kVariableCount + Out.Constants.size() >= Program::MAX_REGISTERS / 2) {
+					Fail("too many constants");
+					return 0;
+				}
+				Out.Constants.push_back(value);
+				return static_cast<Reg>(kVariableCount + Out.Constants.size() - 1);
+			}
+
+			bool IsConstant(Reg reg) const
+			{
+				return reg >= kVariableCount && reg < TempBase();
+			}
+
+			float ValueOf(Reg reg) const
+			{
+				return Out.Constants[reg - kVariableCount];
+			}
+
+			// Variables and constants share the lower half of the registers, temporaries take the upper half.
+			static constexpr Reg TempBase()
+			{
+				return static_cast<Reg>(Program::MAX_REGISTERS / 2);
+			}
+
+			Reg Allocate()
+			{
+				if (TempTop >= Program::MAX_REGISTERS) {
+					Fail("formula is too complex");
+					return 0;
+				}
+				return static_cast<Reg>(TempTop++);
+			}
+
+			void Release(Reg reg)
+			{
+				if (reg >= TempBase())
+					TempTop = (std::min)(TempTop, static_cast<std::size_t>(reg));
+			}
+
+			void SkipSpace()
+			{
+				while (Pos < Text.size() && std::isspace(static_cast<unsigned char>(Text[Pos])))
+					++Pos;
+			}
+
+			bool Accept(std::string_view token)
+			{
+				SkipSpace();
+				if (!Error.empty() || Text.substr(Pos, token.size()) != token)
+					return false;
+				// A lone '<' must not eat the start of '<=', same for the other two character operators
+				if (token.size() == 1 && Pos + 1 < Text.size() && Text[Pos + 1] == '=' && (token == "<" || token == ">" || token == "!"))
+					return false;
+				Pos += token.size();
+				return true;
+			}
+
+			void Fail(std::string const& message)
+			{
+				if (Error.empty())
+					Error = message + " at " + std::to_string(Pos);
+			}
+
+			std::string_view Text;
+			std::size_t Pos = 0;
+			std::size_t TempTop = TempBase();
+			std::string Error;
+			Program Out;
+		};
+	}
+}
@@ -0,0 +1,495 @@
+#pragma once
+
+// Plugin-wide worker pool. Pure computation such as parsing, diffing and cost math runs on the workers, work that
+// touches the engine is handed to the game thread through the main queue, which UpdatePCMod drains every frame.
+// Every worker owns a deque: it pushes and pops its own jobs at the back, idle workers steal from the front of
+// the others. Jobs submitted with Cancel::kOnLoad are dropped unstarted once a save is loaded, along with
+// everything chained to them.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace MAINT
+{
+	namespace JOBS
+	{
+		enum class Affinity : std::uint8_t
+		{
+			kWorker,
+			kMain  // runs when the game thread drains the main queue
+		};
+
+		enum class Cancel : std::uint8_t
+		{
+			kNever,
+			kOnLoad
+		};
+
+		class Pool;
+
+		namespace DETAIL
+		{
+			// run(false) executes the work, run(true) finishes it as cancelled without running it.
+			struct Task
+			{
+				std::function<void(bool)> run;
+				std::uint64_t epoch;  // 0 if the task can't be cancelled
+			};
+
+			struct Nothing
+			{};
+
+			template <class T, class Func>
+			struct ContinuationResult
+			{
+				using type = std::invoke_result_t<Func&, T const&>;
+			};
+
+			template <class Func>
+			struct ContinuationResult<void, Func>
+			{
+				using type = std::invoke_result_t<Func&>;
+			};
+
+			template <class T>
+			struct State
+			{
+				enum class Status : std::uint8_t
+				{
+					kPending,
+					kDone,
+					kCancelled
+				};
+
+				std::mutex mutex;
+				std::condition_variable finished;
+				Status status = Status::kPending;
+				std::conditional_t<std::is_void_v<T>, Nothing, std::optional<T>> value;
+				std::exception_ptr error;
+				std::vector<std::function<void(bool)>> continuations;  // called with true if cancelled
+
+				void Finish(Status result)
+				{
+					std::vector<std::function<void(bool)>> pending;
+					{
+						std::lock_guard<std::mutex> guard(mutex);
+						status = result;
+						pending.swap(continuations);
+						finished.notify_all();
+					}
+					for (auto& next : pending)
+						next(result == Status::kCancelled);
+				}
+
+				// Runs next right away if the state already finished.
+				void OnFinish(std::function<void(bool)> next)
+				{
+					Status current;
+					{
+						std::lock_guard<std::mutex> guard(mutex);
+						current = status;
+						if (current == Status::kPending) {
+							continuations.push_back(std::move(next));
+							return;
+						}
+					}
+					next(current == Status::kCancelled);
+				}
+			};
+
+			template <class T, class Body>
+			void Run(State<T>& state, Body&& body)
+			{
+				try {
+					if constexpr (std::is_void_v<T>)
+						body();
+					else
+						state.value.emplace(body());
+				} catch (...) {
+					state.error = std::current_exception();
+				}
+				state.Finish(State<T>::Status::kDone);
+			}
+		}
+
+		template <class T>
+		class Job
+		{
+		public:
+			Job() = default;
+
+			bool Valid() const
+			{
+				return State != nullptr;
+			}
+
+			// Finished or cancelled.
+			bool IsDone() const
+			{
+				std::lock_guard<std::mutex> guard(State->mutex);
+				return State->status != DETAIL::State<T>::Status::kPending;
+			}
+
+			bool IsCancelled() const
+			{
+				std::lock_guard<std::mutex> guard(State->mutex);
+				return State->status == DETAIL::State<T>::Status::kCancelled;
+			}
+
+			// Blocks until the job finished or was cancelled, workers run other jobs meanwhile. Never wait on the game
+			// thread for a job that needs the main queue.
+			void Wait() const;
+
+			// The job's result, rethrows what it threw. Only valid for finished jobs that weren't cancelled.
+			decltype(auto) Get() const
+			{
+				Wait();
+				if (State->error)
+					std::rethrow_exception(State->error);
+				if constexpr (!std::is_void_v<T>)
+					return static_cast<T const&>(*State->value);
+			}
+
+			// Runs next with the result once this job finished, on a worker or on the game thread. Continuations of a
+			// failed or cancelled job don't run, they fail or cancel along with it.
+			template <class Func>
+			auto Then(Func&& next, Affinity affinity = Affinity::kWorker) const;
+
+		private:
+			friend class Pool;
+			template <class>
+			friend class Job;
+
+			Job(Pool* owner, std::shared_ptr<DETAIL::State<T>> state, std::uint64_t epoch) :
+				Owner(owner),
+				State(std::move(state)),
+				Epoch(epoch)
+			{}
+
+			Pool* Owner = nullptr;
+			std::shared_ptr<DETAIL::State<T>> State;
+			std::uint64_t Epoch = 0;
+		};
+
+		class Pool
+		{
+		public:
+			struct Counters
+			{
+				std::uint64_t executed;
+				std::uint64_t stolen;
+				std::uint64_t cancelled;
+			};
+
+			Pool() = default;
+			Pool(const Pool&) = delete;
+			Pool& operator=(const Pool&) = delete;
+
+			~Pool()
+			{
+				Stop();
+			}
+
+			static Pool& GetSingleton()
+			{
+				static Pool instance;
+				return instance;
+			}
+
+			// Without workers every job runs inline on the thread that submits it.
+			void Start(std::size_t count)
+			{
+				Stop();
+				Stopping = false;
+				for (std::size_t i = 0; i < count; ++i)
+					Queues.push_back(std::make_unique<Queue>());
+				for (std::size_t i = 0; i < count; ++i)
+					Workers.emplace_back([this, i]() { WorkerLoop(i); });
+			}
+
+			// Joins the workers, jobs they didn't get to are cancelled.
+			void Stop()
+			{
+				{
+					std::lock_guard<std::mutex> guard(SleepMutex);
+					Stopping = true;
+					Sleep.notify_all();
+				}
+				for (auto& worker : Workers)
+					worker.join();
+				Workers.clear();
+				for (auto& queue : Queues) {
+					for (auto& task : queue->tasks)
+						task.run(true);
+				}
+				Queues.clear();
+				Queued.store(0, std::memory_order_relaxed);
+			}
+
+			std::size_t WorkerCount() const
+			{
+				return Workers.size();
+			}
+
+			template <class Func>
+			auto Submit(Func&& func, Affinity affinity = Affinity::kWorker, Cancel cancel = Cancel::kNever)
+			{
+				using Result = std::invoke_result_t<std::decay_t<Func>&>;
+				auto state = std::make_shared<DETAIL::State<Result>>();
+				const auto epoch = cancel == Cancel::kOnLoad ? LoadEpoch.load(std::memory_order_acquire) : 0;
+				Job<Result> ret(this, state, epoch);
+				Enqueue(affinity, epoch, [state, body = std::forward<Func>(func)](bool cancelled) mutable {
+					if (cancelled)
+						state->Finish(DETAIL::State<Result>::Status::kCancelled);
+					else
+						DETAIL::Run(*state, body);
+				});
+				return ret;
+			}
+
+			// Calls func(i) for every i < count on the workers and the calling thread, returns once all calls are done
+			// and rethrows the first exception one of them threw.
+			template <class Func>
+			void ParallelFor(std::size_t count, Func&& func)
+			{
+				if (count == 0)
+					return;
+				std::atomic<std::size_t> next{ 0 };
+				std::size_t running = (std::min)(Workers.size(), count - 1);
+				std::mutex doneMutex;
+				std::condition_variable done;
+				std::exception_ptr error;
+				const auto& work = [&]() {
+					try {
+						for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;)
+							func(i);
+					} catch (...) {
+						std::lock_guard<std::mutex> guard(doneMutex);
+						if (!error)
+							error = std::current_exception();
+						next.store(count, std::memory_order_relaxed);
+					}
+				};
+				for (std::size_t helper = running; helper > 0; --helper) {
+					Enqueue(Affinity::kWorker, 0, [&](bool) {
+						work();
+						std::lock_guard<std::mutex> guard(doneMutex);
+						if (--running == 0)
+							done.notify_all();
+					});
+				}
+				work();
+
+				std::unique_lock<std::mutex> lock(doneMutex);
+				while (running > 0) {
+					// Helpers may still sit in this worker's own deque
+					if (IsWorkerThread()) {
+						lock.unlock();
+						const auto& helped = RunOne(CurrentWorker);
+						lock.lock();
+						if (helped)
+							continue;
+					}
+					done.wait_for(lock, std::chrono::milliseconds(1));
+				}
+				if (error)
+					std::rethrow_exception(error);
+			}
+
+			// Game thread only. Runs what was queued for the main thread so far, jobs queued meanwhile wait for the next call.
+			std::size_t DrainMain()
+			{
+				// Called every frame, the lock is only taken once there is something to run
+				if (!HasMainWork.load(std::memory_order_acquire))
+					return 0;
+				std::vector<DETAIL::Task> tasks;
+				{
+					std::lock_guard<std::mutex> guard(MainMutex);
+					tasks.swap(MainQueue);
+					HasMainWork.store(false, std::memory_order_relaxed);
+				}
+				for (auto& task : tasks)
+					Execute(task);
+				return tasks.size();
+			}
+
+			// Everything submitted with Cancel::kOnLoad until now is cancelled instead of run.
+			void CancelOnLoad()
+			{
+				LoadEpoch.fetch_add(1, std::memory_order_acq_rel);
+			}
+
+			bool IsWorkerThread() const
+			{
+				return CurrentPool == this;
+			}
+
+			Counters GetCounters() const
+			{
+				return { Executed.load(std::memory_order_relaxed), Stolen.load(std::memory_order_relaxed), Cancelled.load(std::memory_order_relaxed) };
+			}
+
+		private:
+			template <class>
+			friend class Job;
+
+			struct Queue
+			{
+				std::mutex mutex;
+				std::deque<DETAIL::Task> tasks;
+			};
+
+			void Enqueue(Affinity affinity, std::uint64_t epoch, std::function<void(bool)> run)
+			{
+				DETAIL::Task task{ std::move(run), epoch };
+				if (affinity == Affinity::kMain) {
+					std::lock_guard<std::mutex> guard(MainMutex);
+					MainQueue.push_back(std::move(task));
+					HasMainWork.store(true, std::memory_order_release);
+					return;
+				}
+				if (Queues.empty()) {
+					Execute(task);
+					return;
+				}
+				const auto& target = IsWorkerThread() ? CurrentWorker : NextInjection.fetch_add(1, std::memory_order_relaxed) % Queues.size();
+				{
+					std::lock_guard<std::mutex> guard(Queues[target]->mutex);
+					Queues[target]->tasks.push_back(std::move(task));
+				}
+				Queued.fetch_add(1, std::memory_order_release);
+				std::lock_guard<std::mutex> guard(SleepMutex);
+				Sleep.notify_one();
+			}
+
+			void Execute(DETAIL::Task& task)
+			{
+				const auto& cancelled = task.epoch != 0 && task.epoch != LoadEpoch.load(std::memory_order_acquire);
+				(cancelled ? Cancelled : Executed).fetch_add(1, std::memory_order_relaxed);
+				task.run(cancelled);
+			}
+
+			// Pops the newest job of the own deque or steals the oldest of another one. Returns false if all are empty.
+			bool RunOne(std::size_t self)
+			{
+				std::optional<DETAIL::Task> task;
+				{
+					auto& own = *Queues[self];
+					std::lock_guard<std::mutex> guard(own.mutex);
+					if (!own.tasks.empty()) {
+						task.emplace(std::move(own.tasks.back()));
+						own.tasks.pop_back();
+					}
+				}
+				for (std::size_t i = 1; !task && i < Queues.size(); ++i) {
+					auto& victim = *Queues[(self + i) % Queues.size()];
+					std::lock_guard<std::mutex> guard(victim.mutex);
+					if (!victim.tasks.empty()) {
+						task.emplace(std::move(victim.tasks.front()));
+						victim.tasks.pop_front();
+						Stolen.fetch_add(1, std::memory_order_relaxed);
+					}
+				}
+				if (!task)
+					return false;
+				Queued.fetch_sub(1, std::memory_order_relaxed);
+				Execute(*task);
+				return true;
+			}
+
+			void WorkerLoop(std::size_t self)
+			{
+				CurrentPool = this;
+				CurrentWorker = self;
+				while (true) {
+					if (RunOne(self))
+						continue;
+					std::unique_lock<std::mutex> lock(SleepMutex);
+					Sleep.wait(lock, [&]() { return Stopping || Queued.load(std::memory_order_acquire) > 0; });
+					if (Stopping)
+						break;
+				}
+				CurrentPool = nullptr;
+			}
+
+			static inline thread_local const Pool* CurrentPool = nullptr;
+			static inline thread_local std::size_t CurrentWorker = 0;
+
+			std::vector<std::unique_ptr<Queue>> Queues;
+			std::vector<std::thread> Workers;
+			std::atomic<std::size_t> Queued{ 0 };
+			std::atomic<std::size_t> NextInjection{ 0 };
+			std::mutex SleepMutex;
+			std::condition_variable Sleep;
+			bool Stopping = false;
+
+			std::mutex MainMutex;
+			std::vector<DETAIL::Task> MainQueue;
+			std::atomic<bool> HasMainWork{ false };
+
+			std::atomic<std::uint64_t> LoadEpoch{ 1 };
+			std::atomic<std::uint64_t> Executed{ 0 };
+			std::atomic<std::uint64_t> Stolen{ 0 };
+			std::atomic<std::uint64_t> Cancelled{ 0 };
+		};
+
+		template <class T>
+		void Job<T>::Wait() const
+		{
+			const auto& pending = [&]() { return State->status == DETAIL::State<T>::Status::kPending; };
+			std::unique_lock<std::mutex> lock(State->mutex);
+			while (pending()) {
+				if (Owner->IsWorkerThread()) {
+					lock.unlock();
+					const auto& helped = Owner->RunOne(Pool::CurrentWorker);
+					lock.lock();
+					if (helped)
+						continue;
+					State->finished.wait_for(lock, std::chrono::milliseconds(1), [&]() { return !pending(); });
+				} else
+					State->finished.wait(lock, [&]() { return !pending(); });
+			}
+		}
+
+		template <class T>
+		template <class Func>
+		auto Job<T>::Then(Func&& next, Affinity affinity) const
+		{
+			using Result = typename DETAIL::ContinuationResult<T, std::decay_t<Func>>::type;
+			using NextState = DETAIL::State<Result>;
+			auto nextState = std::make_shared<NextState>();
+			State->OnFinish([owner = Owner, source = State, nextState, body = std::forward<Func>(next), affinity, epoch = Epoch](bool cancelled) mutable {
+				if (cancelled || source->error) {
+					nextState->error = source->error;
+					nextState->Finish(cancelled ? NextState::Status::kCancelled : NextState::Status::kDone);
+					return;
+				}
+				owner->Enqueue(affinity, epoch, [source, nextState, body = std::move(body)](bool cancelled) mutable {
+					if (cancelled) {
+						nextState->Finish(NextState::Status::kCancelled);
+						return;
+					}
+					DETAIL::Run(*nextState, [&]() {
+						if constexpr (std::is_void_v<T>)
+							return body();
+						else
+							return body(static_cast<T const&>(*source->value));
+					});
+				});
+			});
+			return Job<Result>(Owner, std::move(nextState), Epoch);
+		}
+	}
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+// Engine independent part of the spell eligibility rules. The [RULES] section of the config is compiled once
+// into bitmasks over archetypes, delivery and casting types plus a list of resolved keywords, so deciding
+// whether a cast can be maintained is a handful of mask tests without any string handling.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace MAINT
+{
+	namespace RULES
+	{
+		using Mask = std::uint64_t;
+
+		// Indices follow RE::EffectSetting::Archetype, RE::MagicSystem::Delivery and RE::MagicSystem::CastingType.
+		inline constexpr std::array<std::string_view, 47> ARCHETYPES{
+			"ValueModifier", "Script", "Dispel", "CureDisease", "Absorb", "DualValueModifier", "Calm", "Demoralize",
+			"Frenzy", "Disarm", "CommandSummoned", "Invisibility", "Light", "Darkness", "NightEye", "Lock",
+			"Open", "BoundWeapon", "SummonCreature", "DetectLife", "Telekinesis", "Paralysis", "Reanimate", "SoulTrap",
+			"TurnUndead", "Guide", "WerewolfFeed", "CureParalysis", "CureAddiction", "CurePoison", "Concussion", "ValueAndParts",
+			"AccumulateMagnitude", "Stagger", "PeakValueModifier", "Cloak", "Werewolf", "SlowTime", "Rally", "EnhanceWeapon",
+			"SpawnHazard", "Etherealize", "Banish", "SpawnScriptedRef", "Disguise", "GrabActor", "VampireLord"
+		};
+		inline constexpr std::array<std::string_view, 5> DELIVERIES{ "Self", "Touch", "Aimed", "TargetActor", "TargetLocation" };
+		inline constexpr std::array<std::string_view, 4> CASTING_TYPES{ "ConstantEffect", "FireAndForget", "Concentration", "Scroll" };
+
+		inline constexpr std::string_view DEFAULT_CASTING_TYPES = "FireAndForget";
+		inline constexpr std::string_view DEFAULT_DELIVERIES = "Self";
+		inline constexpr std::string_view DEFAULT_ANY_DELIVERY_ARCHETYPES = "SummonCreature";
+		inline constexpr std::string_view DEFAULT_EXCLUDED_ARCHETYPES = "BoundWeapon";
+		inline constexpr std::string_view DEFAULT_EXCLUDED_KEYWORDS = "_m3HealerDummySpell";
+		inline constexpr std::string_view DEFAULT_KEEP_FX_ARCHETYPES = "Light, BoundWeapon, Disguise, SummonCreature, NightEye, Invisibility, Guide, Werewolf, WerewolfFeed";
+		inline constexpr float DEFAULT_MIN_DURATION = 5.0f;
+		inline constexpr float DEFAULT_MIN_COST = 5.0f;
+
+		template <std::size_t N>
+		constexpr std::optional<std::uint8_t> IndexOf(std::array<std::string_view, N> const& names, std::string_view name)
+		{
+			constexpr auto lower = [](char c) { return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c; };
+			for (std::size_t i = 0; i < N; ++i) {
+				if (names[i].size() == name.size() && std::equal(name.begin(), name.end(), names[i].begin(), [&](char a, char b) { return lower(a) == lower(b); }))
+					return static_cast<std::uint8_t>(i);
+			}
+			return std::nullopt;
+		}
+
+		// Calls func for every trimmed, non-empty entry of a comma separated list.
+		template <class Func>
+		void ForEachEntry(std::string_view list, Func&& func)
+		{
+			while (!list.empty()) {
+				const auto comma = (std::min)(list.find(','), list.size());
+				auto entry = list.substr(0, comma);
+				list.remove_prefix((std::min)(comma + 1, list.size()));
+				while (!entry.empty() && (entry.front() == ' ' || entry.front() == '\t'))
+					entry.remove_prefix(1);
+				while (!entry.empty() && (entry.back() == ' ' || entry.back() == '\t'))
+					entry.remove_suffix(1);
+				if (!entry.empty())
+					func(entry);
+			}
+		}
+
+		template <std::size_t N>
+		Mask CompileMask(std::array<std::string_view, N> const& names, std::string_view list, std::string_view key, std::vector<std::string>& problems)
+		{
+			Mask ret = 0;
+			ForEachEntry(list, [&](std::string_view entry) {
+				if (const auto& index = IndexOf(names, entry))
+					ret |= Mask{ 1 } << *index;
+				else
+					problems.push_back(std::string(key) + ": unknown name '" + std::string(entry) + "'");
+			});
+			return ret;
+		}
+
+		// The rules as written in the config, before compilation.
+		struct RuleText
+		{
+			std::string_view castingTypes;
+			std::string_view deliveries;
+			std::string_view anyDeliveryArchetypes;
+			std::string_view excludedArchetypes;
+			std::string_view excludedKeywords;
+			std::string_view keepFXArchetypes;
+			float minDuration;
+			float minCost;
+		};
+
+		// What the rules need to know about a spell, gathered once per cast.
+		struct SpellFacts
+		{
+			bool isScroll;
+			bool isEnchantment;
+			std::uint32_t effectCount;
+			std::uint8_t castingType;
+			std::uint8_t delivery;
+			std::uint8_t archetype;  // of the first effect
+			float duration;          // of the first effect
+			float cost;              // with the caster's cost modifiers
+			float baseCost;          // without
+		};
+
+		enum class Verdict : std::uint8_t
+		{
+			kMaintainable,
+			kScroll,
+			kEnchantment,
+			kNoEffects,
+			kCastingType,
+			kTooShort,
+			kTooCheap,
+			kExcludedKeyword,
+			kDelivery,
+			kExcludedArchetype
+		};
+
+		constexpr std::string_view ToString(Verdict verdict)
+		{
+			switch (verdict) {
+			case Verdict::kMaintainable:
+				return "Spell is maintainable";
+			case Verdict::kScroll:
+				return "Spell is Scroll";
+			case Verdict::kEnchantment:
+				return "Spell is Enchantment";
+			case Verdict::kNoEffects:
+				return "Spell has no effects";
+			case Verdict::kCastingType:
+				return "Spell casting type is not allowed";
+			case Verdict::kTooShort:
+				return "Spell duration is too short";
+			case Verdict::kTooCheap:
+				return "Spell cost is too low";
+			case Verdict::kExcludedKeyword:
+				return "Spell has an excluded keyword";
+			case Verdict::kDelivery:
+				return "Spell delivery is not allowed for its archetype";
+			case Verdict::kExcludedArchetype:
+				return "Spell archetype is excluded";
+			default:
+				return "Unknown";
+			}
+		}
+
+		template <class Keyword>
+		struct RuleSet
+		{
+			Mask castingTypes = 0;
+			Mask deliveries = 0;
+			Mask anyDeliveryArchetypes = 0;
+			Mask excludedArchetypes = 0;
+			Mask keepFXArchetypes = 0;
+			float minDuration = 0.0f;
+			float minCost = 0.0f;
+			std::vector<Keyword> excludedKeywords;
+
+			// hasKeyword(Keyword) tells whether the spell carries a keyword, it is only asked about resolved ones.
+			template <class HasKeyword>
+			Verdict Evaluate(SpellFacts const& spell, HasKeyword&& hasKeyword) const
+			{
+				if (spell.isScroll)
+					return Verdict::kScroll;
+				if (spell.isEnchantment)
+					return Verdict::kEnchantment;
+				if (spell.effectCount == 0)
+					return Verdict::kNoEffects;
+				if (!Test(castingTypes, spell.castingType))
+					return Verdict::kCastingType;
+				if (spell.duration <= minDuration)
+					return Verdict::kTooShort;
+				if (spell.cost <= minCost && spell.baseCost <= minCost)
+					return Verdict::kTooCheap;
+				for (auto const& keyword : excludedKeywords) {
+					if (hasKeyword(keyword))
+						return Verdict::kExcludedKeyword;
+				}
+				if (Test(anyDeliveryArchetypes, spell.archetype))
+					return Verdict::kMaintainable;
+				if (!Test(deliveries, spell.delivery))
+					return Verdict::kDelivery;
+				if (Test(excludedArchetypes, spell.archetype))
+					return Verdict::kExcludedArchetype;
+				return Verdict::kMaintainable;
+			}
+
+			bool KeepsFX(std::uint8_t archetype) const
+			{
+				return Test(keepFXArchetypes, archetype);
+			}
+
+		private:
+			static bool Test(Mask mask, std::uint8_t index)
+			{
+				return index < 64 && ((mask >> index) & 1);
+			}
+		};
+
+		// resolveKeyword(std::string_view) returns the keyword with that editor ID, or a null Keyword if no loaded plugin
+		// has it, which is fine for keywords of optional mods. Unknown archetype, delivery and casting type names are
+		// skipped and reported in problems.
+		template <class Keyword, class Resolve>
+		RuleSet<Keyword> Compile(RuleText const& text, Resolve&& resolveKeyword, std::vector<std::string>& problems)
+		{
+			RuleSet<Keyword> ret;
+			ret.castingTypes = CompileMask(CASTING_TYPES, text.castingTypes, "CastingTypes", problems);
+			ret.deliveries = CompileMask(DELIVERIES, text.deliveries, "Deliveries", problems);
+			ret.anyDeliveryArchetypes = CompileMask(ARCHETYPES, text.anyDeliveryArchetypes, "AnyDeliveryArchetypes", problems);
+			ret.excludedArchetypes = CompileMask(ARCHETYPES, text.excludedArchetypes, "ExcludedArchetypes", problems);
+			ret.keepFXArchetypes = CompileMask(ARCHETYPES, text.keepFXArchetypes, "KeepFXArchetypes", problems);
+			ret.minDuration = text.minDuration;
+			ret.minCost = text.minCost;
+			ForEachEntry(text.excludedKeywords, [&](std::string_view entry) {
+				if (const Keyword& keyword = resolveKeyword(entry))
+					ret.excludedKeywords.push_back(keyword);
+			});
+			return ret;
+		}
+	}
+}
@@ -2,224 +2,409 @@
 
 namespace MAINT
 {
-	static std::vector<RE::Effect*> SilenceSpellFX(RE::SpellItem* const& theSpell)
+	void CompileRules(CONFIG::Settings const& settings)
 	{
-		std::vector<RE::Effect*> ret;
+		const RULES::RuleText text{
+			settings.RuleCastingTypes,
+			settings.RuleDeliveries,
+			settings.RuleAnyDeliveryArchetypes,
+			settings.RuleExcludedArchetypes,
+			settings.RuleExcludedKeywords,
+			settings.RuleKeepFXArchetypes,
+			settings.RuleMinDuration,
+			settings.RuleMinCost
+		};
+		std::vector<std::string> problems;
+		Rules = RULES::Compile<RE::BGSKeyword*>(text, [](std::string_view editorID) {
+			const auto& keyword = RE::TESForm::LookupByEditorID<RE::BGSKeyword>(editorID);
+			if (!keyword)
+				logger::info("Excluded keyword {} is not loaded", editorID);
+			return keyword;
+		}, problems);
+		for (auto const& problem : problems)
+			logger::warn("[RULES] {}", problem);
+
+		// Our own spells and the explicit opt-out are never up for debate
+		auto const& forms = FORMS::GetSingleton();
+		Rules.excludedKeywords.insert(Rules.excludedKeywords.begin(), { forms.KywdMaintainedSpell, forms.KywdExcludeFromSystem });
+		logger::info("Compiled rules with {} excluded keywords", Rules.excludedKeywords.size());
+	}
+
+	static std::size_t SilenceSpellFX(RE::SpellItem* const& theSpell)
+	{
+		std::vector<RE::EffectSetting*> toSilence;
 		for (auto const& eff : theSpell->effects) {
-			bool const& persists = eff->baseEffect->data.flags.any(RE::EffectSetting::EffectSettingData::Flag::kFXPersist);
-			if (persists) {
-				switch (eff->baseEffect->GetArchetype()) {
-				case RE::EffectSetting::Archetype::kLight:
-				case RE::EffectSetting::Archetype::kBoundWeapon:
-				case RE::EffectSetting::Archetype::kDisguise:
-				case RE::EffectSetting::Archetype::kSummonCreature:
-				case RE::EffectSetting::Archetype::kNightEye:
-				case RE::EffectSetting::Archetype::kInvisibility:
-				case RE::EffectSetting::Archetype::kGuide:
-				case RE::EffectSetting::Archetype::kWerewolf:
-				case RE::EffectSetting::Archetype::kWerewolfFeed:
-					logger::info("{} fx will not be silenced", eff->baseEffect->GetName());
-					break;
-				default:
-					eff->baseEffect->data.flags.reset(RE::EffectSetting::EffectSettingData::Flag::kFXPersist);
-					ret.emplace_back(eff);
-				}
+			auto const& setting = eff->baseEffect;
+			if (std::find(toSilence.begin(), toSilence.end(), setting) != toSilence.end())
+				continue;
+			if (Rules.KeepsFX(static_cast<std::uint8_t>(setting->GetArchetype()))) {
+				if (setting->data.flags.any(RE::EffectSetting::EffectSettingData::Flag::kFXPersist))
+					logger::info("{} fx will not be silenced", setting->GetName());
+				continue;
 			}
+			toSilence.emplace_back(setting);
 		}
-		return ret;
+		return MAINT::FXSuppressionRegistry::GetSingleton().Suppress(toSilence);
 	}
 
 	static bool IsMaintainable(RE::SpellItem* const& theSpell, RE::Actor* const& theCaster)
 	{
-		if (theSpell->As<RE::ScrollItem>()) {
-			logger::info("Spell is Scroll");
-			return false;
-		}
-		if (theSpell->As<RE::EnchantmentItem>()) {
-			logger::info("Spell is Enchantment");
-			return false;
-		}
-		if (theSpell->effects.empty()) {
-			logger::info("Spell has no effects");
-			return false;
-		}
-		if (theSpell->data.castingType != RE::MagicSystem::CastingType::kFireAndForget) {
-			logger::info("Spell is not FF");
-			return false;
-		}
-		if (theSpell->effects.front()->GetDuration() <= 5.0) {
-			logger::info("Spell has duration of 5 seconds or less");
-			return false;
-		}
-		if (theSpell->CalculateMagickaCost(theCaster) <= 5.0 && theSpell->CalculateMagickaCost(nullptr) <= 5.0) {
-			logger::info("Spell has cost of 5 or less");
+		const auto& hasEffects = !theSpell->effects.empty();
+		const RULES::SpellFacts facts{
+			theSpell->As<RE::ScrollItem>() != nullptr,
+			theSpell->As<RE::EnchantmentItem>() != nullptr,
+			theSpell->effects.size(),
+			static_cast<std::uint8_t>(theSpell->data.castingType),
+			static_cast<std::uint8_t>(theSpell->data.delivery),
+			hasEffects ? static_cast<std::uint8_t>(theSpell->effects.front()->baseEffect->GetArchetype()) : std::uint8_t{ 0 },
+			hasEffects ? static_cast<float>(theSpell->effects.front()->GetDuration()) : 0.0f,
+			theSpell->CalculateMagickaCost(theCaster),
+			theSpell->CalculateMagickaCost(nullptr)
+		};
+		const auto& verdict = Rules.Evaluate(facts, [&](RE::BGSKeyword* const& keyword) { return theSpell->HasKeyword(keyword); });
+		if (verdict != RULES::Verdict::kMaintainable) {
+			logger::info("{}", RULES::ToString(verdict));
 			return false;
 		}
+		return true;
+	}
 
-		if (theSpell->HasKeyword(MAINT::FORMS::GetSingleton().KywdMaintainedSpell)) {
-			logger::info("Spell has Maintained keyword");
-			return false;
-		}
-		if (theSpell->HasKeyword(MAINT::FORMS::GetSingleton().KywdExcludeFromSystem)) {
-			logger::info("Spell has exclusion keyword");
-			return false;
-		}
-		if (theSpell->HasKeywordString("_m3HealerDummySpell")) {
-			logger::info("Spell has Allylink keyword");
-			return false;
-		}
-		const auto& archetype = theSpell->effects[0]->baseEffect->GetArchetype();
-		if (theSpell->data.delivery != RE::MagicSystem::Delivery::kSelf) {
-			if (archetype == RE::EffectSetting::Archetype::kSummonCreature)
-				return true;
-			logger::info("Spell does not target self, and is not summon");
-			return false;
-		}
-		if (archetype == RE::EffectSetting::Archetype::kBoundWeapon) {
-			logger::info("Spell is bound weapon");
-			return false;
+	// Names of generated spells are interned once per base spell and shared by its maintained and debuff spell.
+	static RE::BSFixedString const& MaintainedNameOf(RE::SpellItem* const& theSpell)
+	{
+		static NameCache<RE::FormID, RE::BSFixedString> names;
+		return names.Get(theSpell->GetFormID(), theSpell->fullName, "Maintained ");
+	}
+
+	// Sizes the keyword array of a freshly created spell once, AddKeyword would reallocate it for every keyword.
+	static void AssignKeywords(RE::SpellItem* const& target, RE::BGSKeywordForm const* source, std::initializer_list<RE::BGSKeyword*> extra)
+	{
+		const auto& sourceKeywords = source ? std::span<RE::BGSKeyword* const>(source->keywords, source->numKeywords) : std::span<RE::BGSKeyword* const>();
+		const auto& [keywords, count] = KEYWORDS::Merge(sourceKeywords, extra, [](std::size_t size) { return RE::calloc<RE::BGSKeyword*>(size); });
+		if (target->keywords)
+			RE::free(target->keywords);
+		target->keywords = keywords;
+		target->numKeywords = count;
+	}
+
+	// Name, description, keywords and equip slot only matter once a spell is known to be in use. Spells restored
+	// from a savegame mapping start out as bare skeletons, which is all the engine needs to bind saved references.
+	static void DecorateMaintainSpell(RE::SpellItem* const& infiniteSpell, RE::SpellItem* const& theSpell)
+	{
+		infiniteSpell->fullName = MaintainedNameOf(theSpell);
+		infiniteSpell->descriptionText = theSpell->descriptionText;
+
+		infiniteSpell->equipSlot = theSpell->equipSlot;
+		//MAINT::FORMS::GetSingleton().EquipSlotVoice;
+
+		RE::BGSKeyword* cloakKeyword = nullptr;
+		for (auto const& eff : theSpell->effects) {
+			if (eff->baseEffect->HasArchetype(RE::EffectSetting::Archetype::kCloak)) {
+				cloakKeyword = MAINT::FORMS::GetSingleton().KywdMagicCloak;
+				break;
+			}
 		}
-		return true;
+		AssignKeywords(infiniteSpell, theSpell, { cloakKeyword, MAINT::FORMS::GetSingleton().KywdMaintainedSpell });
 	}
 
-	static RE::SpellItem* CreateMaintainSpell(RE::SpellItem* const& theSpell)
+	// theSpell is null for the aggregate debuff, which carries the upkeep of all maintained spells.
+	static void DecorateDebuffSpell(RE::SpellItem* const& debuffSpell, RE::SpellItem* const& theSpell)
+	{
+		static const RE::BSFixedString aggregateName{ "Maintained Spells" };
+		debuffSpell->fullName = theSpell ? MaintainedNameOf(theSpell) : aggregateName;
+		//debuffSpell->descriptionText = theSpell->descriptionText;
+
+		debuffSpell->equipSlot = MAINT::FORMS::GetSingleton().EquipSlotVoice;
+
+		AssignKeywords(debuffSpell, nullptr, { MAINT::FORMS::GetSingleton().KywdMaintainedSpell });
+	}
+
+	static RE::SpellItem* CreateMaintainSpell(RE::SpellItem* const& theSpell, RE::FormID formID = 0x0, bool decorate = true)
 	{
 		static auto const& spellFactory = RE::IFormFactory::GetConcreteFormFactoryByType<RE::SpellItem>();
 		const auto& fileString = theSpell->GetFile(0) ? theSpell->GetFile(0)->GetFilename() : "VIRTUAL";
 		logger::info("Maintainify({}, 0x{:08X}~{})", theSpell->GetName(), theSpell->GetLocalFormID(), fileString);
 
-		auto infiniteSpell = spellFactory->Create();
-		infiniteSpell->SetFormID(MAINT::FORMS::GetSingleton().NextFormID(), false);
+		if (formID == 0x0 && (formID = MAINT::FORMS::GetSingleton().NextFormID()) == 0x0)
+			return nullptr;
 
-		infiniteSpell->fullName = std::format("Maintained {}", theSpell->GetFullName());
+		auto infiniteSpell = spellFactory->Create();
+		infiniteSpell->SetFormID(formID, false);
 
 		infiniteSpell->data = theSpell->data;
 		//RE::SpellItem::Data{ theSpell->data };
 		infiniteSpell->avEffectSetting = theSpell->avEffectSetting;
 		infiniteSpell->boundData = theSpell->boundData;
-		infiniteSpell->descriptionText = theSpell->descriptionText;
-
-		infiniteSpell->equipSlot = theSpell->equipSlot;
-		//MAINT::FORMS::GetSingleton().EquipSlotVoice;
 
 		infiniteSpell->data.spellType = RE::MagicSystem::SpellType::kAbility;
 		infiniteSpell->SetDelivery(RE::MagicSystem::Delivery::kSelf);
 		infiniteSpell->SetCastingType(RE::MagicSystem::CastingType::kConstantEffect);
 
-		for (uint32_t i = 0; i < theSpell->numKeywords; ++i)
-			infiniteSpell->AddKeyword(theSpell->GetKeywordAt(i).value());
-
-		for (auto const& eff : theSpell->effects) {
-			if (eff->baseEffect->HasArchetype(RE::EffectSetting::Archetype::kCloak)) {
-				infiniteSpell->AddKeyword(MAINT::FORMS::GetSingleton().KywdMagicCloak);
-				break;
-			}
-		}
-
-		infiniteSpell->AddKeyword(MAINT::FORMS::GetSingleton().KywdMaintainedSpell);
-
 		infiniteSpell->effects = theSpell->effects;
 
+		if (decorate)
+			DecorateMaintainSpell(infiniteSpell, theSpell);
 		return infiniteSpell;
 	}
 
-	static RE::SpellItem* CreateDebuffSpell(RE::SpellItem* const& theSpell, float const& magnitude)
+	static RE::SpellItem* CreateDebuffSpell(RE::SpellItem* const& theSpell, float const& magnitude, RE::FormID formID = 0x0, bool decorate = true)
 	{
 		static auto const& debuffSpellTemplate = MAINT::FORMS::GetSingleton().SpelMagickaDebuffTemplate;
 
 		static auto const& spellFactory = RE::IFormFactory::GetConcreteFormFactoryByType<RE::SpellItem>();
-		const auto& fileString = theSpell->GetFile(0) ? theSpell->GetFile(0)->GetFilename() : "VIRTUAL";
-		logger::info("Debuffify({}, 0x{:08X}~{})", theSpell->GetName(), theSpell->GetLocalFormID(), fileString);
+		if (theSpell) {
+			const auto& fileString = theSpell->GetFile(0) ? theSpell->GetFile(0)->GetFilename() : "VIRTUAL";
+			logger::info("Debuffify({}, 0x{:08X}~{})", theSpell->GetName(), theSpell->GetLocalFormID(), fileString);
+		} else
+			logger::info("Debuffify(aggregate)");
 
-		auto debuffSpell = spellFactory->Create();
-		debuffSpell->SetFormID(MAINT::FORMS::GetSingleton().NextFormID(), false);
+		if (formID == 0x0 && (formID = MAINT::FORMS::GetSingleton().NextFormID()) == 0x0)
+			return nullptr;
 
-		debuffSpell->fullName = std::format("Maintained {}", theSpell->GetFullName());
+		auto debuffSpell = spellFactory->Create();
+		debuffSpell->SetFormID(formID, false);
 
 		debuffSpell->data = RE::SpellItem::Data{ debuffSpellTemplate->data };
 
 		debuffSpell->avEffectSetting = debuffSpellTemplate->avEffectSetting;
 		debuffSpell->boundData = debuffSpellTemplate->boundData;
-		//debuffSpell->descriptionText = theSpell->descriptionText;
-
-		debuffSpell->equipSlot = MAINT::FORMS::GetSingleton().EquipSlotVoice;
 
 		debuffSpell->data.spellType = RE::MagicSystem::SpellType::kAbility;
 		debuffSpell->SetDelivery(RE::MagicSystem::Delivery::kSelf);
 		debuffSpell->SetCastingType(RE::MagicSystem::CastingType::kConstantEffect);
 
-		debuffSpell->AddKeyword(MAINT::FORMS::GetSingleton().KywdMaintainedSpell);
-		debuffSpell->effects.emplace_back(debuffSpellTemplate->effects.front());
-		debuffSpell->effects.back()->effectItem.magnitude = magnitude;
-
+		// Every debuff gets an Effect of its own, sharing the template's would make all of them carry whichever
+		// magnitude was written last. The template's conditions aren't copied, the debuff has none.
+		const auto& templateEffect = debuffSpellTemplate->effects.front();
+		auto effect = new RE::Effect();
+		effect->effectItem = templateEffect->effectItem;
+		effect->effectItem.magnitude = magnitude;
+		effect->baseEffect = templateEffect->baseEffect;
+		effect->cost = templateEffect->cost;
+		debuffSpell->effects.reserve(1);
+		debuffSpell->effects.emplace_back(effect);
+
+		if (decorate)
+			DecorateDebuffSpell(debuffSpell, theSpell);
 		return debuffSpell;
 	}
 
+	// Flags a generated spell as deleted and hands its FormID back to the allocator.
+	static void DiscardSpell(RE::SpellItem* const& theSpell)
+	{
+		theSpell->SetDelete(true);
+		MAINT::FormIDAllocator::GetSingleton().Release(theSpell->GetFormID());
+	}
+
+	static float TotalUpkeep(MAINT::CACHE::MaintainedState const& state)
+	{
+		float total = 0.0f;
+		for (const auto& cost : state.Spells.Costs())
+			total += cost;
+		return total;
+	}
+
+	// Brings the aggregate debuff in line with the summed upkeep. It is created along with the first maintained
+	// spell, only reapplied when the sum changed and dropped along with the last one.
+	static void SyncAggregateDebuff(RE::Actor* const& theActor)
+	{
+		const auto& state = MAINT::CACHE::Store.Read();
+		auto aggregate = state->AggregateDebuff;
+		if (state->Spells.empty()) {
+			if (aggregate) {
+				theActor->RemoveSpell(aggregate);
+				DiscardSpell(aggregate);
+				MAINT::CACHE::Store.Update([](auto& next) { next.AggregateDebuff = nullptr; });
+			}
+			return;
+		}
+
+		const auto& total = TotalUpkeep(*state);
+		if (!aggregate) {
+			aggregate = CreateDebuffSpell(nullptr, total);
+			if (!aggregate) {
+				logger::error("No free FormID for the aggregate upkeep debuff");
+				return;
+			}
+			MAINT::CACHE::Store.Update([&](auto& next) { next.AggregateDebuff = aggregate; });
+			theActor->AddSpell(aggregate);
+			return;
+		}
+
+		// The aggregate owns its Effect like every debuff, so its magnitude is exactly what was last applied
+		// and no per-spell reprice can have touched it
+		auto& magnitude = aggregate->effects.front()->effectItem.magnitude;
+		if (magnitude == total && theActor->HasSpell(aggregate))
+			return;
+		logger::info("\tAggregate upkeep from {} to {} Magicka", magnitude, total);
+		magnitude = total;
+		// Constant effects only pick up a new magnitude when they are reapplied
+		theActor->RemoveSpell(aggregate);
+		theActor->AddSpell(aggregate);
+	}
+
+	// Moves the maintained spells between their own debuffs and the aggregate one, for saves made in the other
+	// mode and for config changes. The costs are kept in the store either way, nothing gets repriced.
+	void ApplyUpkeepMode(RE::Actor* const& theActor)
+	{
+		const bool aggregate = MAINT::CONFIG::Current()->AggregateUpkeep;
+		std::vector<std::pair<MAINT::SlotHandle, MAINT::CACHE::DebuffSpell*>> converted;
+		{
+			const auto& state = MAINT::CACHE::Store.Read();
+			const auto& spells = state->Spells;
+			for (std::size_t i = 0; i < spells.size(); ++i) {
+				const auto& baseSpell = spells.Bases()[i];
+				const auto& debuffSpell = spells.Debuffs()[i];
+				if (aggregate && debuffSpell) {
+					theActor->RemoveSpell(debuffSpell);
+					DiscardSpell(debuffSpell);
+					converted.emplace_back(spells.HandleAt(i), nullptr);
+				} else if (!aggregate && !debuffSpell) {
+					const auto& ownDebuff = CreateDebuffSpell(baseSpell, spells.Costs()[i]);
+					if (!ownDebuff) {
+						logger::error("\tNo free FormID for the upkeep debuff of {}", baseSpell->GetName());
+						continue;
+					}
+					theActor->AddSpell(ownDebuff);
+					converted.emplace_back(spells.HandleAt(i), ownDebuff);
+				}
+			}
+		}
+		if (!converted.empty()) {
+			logger::info("ApplyUpkeepMode() moved {} spells to {} upkeep", converted.size(), aggregate ? "aggregate" : "per spell");
+			MAINT::CACHE::Store.Update([&](auto& next) {
+				for (const auto& [handle, debuffSpell] : converted) {
+					if (const auto& i = next.Spells.Find(handle); i != MAINT::CACHE::SpellTable::NPOS)
+						next.Spells.Debuffs()[i] = debuffSpell;
+				}
+			});
+		}
+
+		if (aggregate) {
+			SyncAggregateDebuff(theActor);
+		} else if (const auto& leftover = MAINT::CACHE::Store.Read()->AggregateDebuff) {
+			theActor->RemoveSpell(leftover);
+			DiscardSpell(leftover);
+			MAINT::CACHE::Store.Update([](auto& next) { next.AggregateDebuff = nullptr; });
+		}
+	}
+
 	static void BuildActiveSpellsCache()
 	{
+		MAINT_TIMELINE_SCOPE("BuildActiveSpellsCache");
 		logger::info("BuildActiveSpellsCache()");
 		static const auto& player = RE::PlayerCharacter::GetSingleton();
 		if (player == nullptr) {
 			logger::error("\tPlayer is NULL");
 			return;
 		}
+
+		// One pass over the player's spells and effects collects everything that refers to one of our spells
+		std::unordered_set<RE::FormID> inUse;
+		std::unordered_map<RE::FormID, RE::ActiveEffect*> firstEffects;
 		for (const auto& playerSpell : player->GetActorRuntimeData().addedSpells) {
-			if (!MAINT::CACHE::SpellToMaintainedSpell.containsKey(playerSpell))
+			if (playerSpell && MAINT::FormIDAllocator::Owns(playerSpell->GetFormID()))
+				inUse.insert(playerSpell->GetFormID());
+		}
+		for (auto const& aeff : *player->AsMagicTarget()->GetActiveEffectList()) {
+			if (!aeff->spell || !MAINT::FormIDAllocator::Owns(aeff->spell->GetFormID()))
 				continue;
-			MAINT::FORMS::GetSingleton().FlstMaintainedSpellToggle->AddForm(playerSpell);
+			inUse.insert(aeff->spell->GetFormID());
+			if (aeff->GetCasterActor().get() == player && !aeff->spell->effects.empty() && aeff->effect == aeff->spell->effects.front())
+				firstEffects.emplace(aeff->spell->GetFormID(), aeff);
 		}
 
-		auto const& activeEffects = player->AsMagicTarget()->GetActiveEffectList();
-		for (auto const& [baseSpell, maintData] : MAINT::CACHE::SpellToMaintainedSpell.GetForwardMap()) {
-			auto const& [maintSpell, debuffSpell] = maintData;
-			for (auto const& aeff : *activeEffects) {
-				if (aeff->spell == debuffSpell && aeff->GetCasterActor().get() == player && aeff->effect == debuffSpell->effects.front()) {
-					logger::info("Restoring {} magnitude to {}", debuffSpell->GetName(), abs(aeff->GetMagnitude()));
-					debuffSpell->effects.front()->effectItem.magnitude = abs(aeff->GetMagnitude());
-					break;
-				}
+		// Restored spells the save doesn't refer to anymore are dropped before they ever enter the store
+		std::vector<MAINT::CACHE::SpellTable::Row> claimed;
+		for (auto const& [baseSpell, maintSpell, debuffSpell, cost, duration] : MAINT::CACHE::PendingMappings) {
+			if (!inUse.contains(maintSpell->GetFormID())) {
+				logger::info("\tDropping unused mapping of {}", baseSpell->GetName());
+				DiscardSpell(maintSpell);
+				if (debuffSpell)
+					DiscardSpell(debuffSpell);
+				continue;
 			}
+			DecorateMaintainSpell(maintSpell, baseSpell);
+			if (debuffSpell)
+				DecorateDebuffSpell(debuffSpell, baseSpell);
+			// Mappings written before costs were stored fall back to the magnitude of the debuff's effect
+			auto restored = cost;
+			if (const auto& it = debuffSpell && cost <= 0.0f ? firstEffects.find(debuffSpell->GetFormID()) : firstEffects.end(); it != firstEffects.end())
+				restored = abs(it->second->GetMagnitude());
+			if (debuffSpell)
+				debuffSpell->effects.front()->effectItem.magnitude = restored;
+			claimed.push_back({ baseSpell, maintSpell, debuffSpell, restored, duration, baseSpell->GetAssociatedSkill(), MAINT::CACHE::SpellTable::kRestored });
+		}
+		logger::info("\tClaimed {} of {} mapped spells", claimed.size(), MAINT::CACHE::PendingMappings.size());
+		MAINT::CACHE::PendingMappings.clear();
+
+		auto aggregate = std::exchange(MAINT::CACHE::PendingAggregate, nullptr);
+		if (aggregate && !inUse.contains(aggregate->GetFormID())) {
+			DiscardSpell(aggregate);
+			aggregate = nullptr;
+		}
+		if (aggregate) {
+			DecorateDebuffSpell(aggregate, nullptr);
+			if (const auto& it = firstEffects.find(aggregate->GetFormID()); it != firstEffects.end())
+				aggregate->effects.front()->effectItem.magnitude = abs(it->second->GetMagnitude());
+		}
+
+		MAINT::CACHE::Store.Update([&](auto& next) {
+			for (auto const& row : claimed)
+				next.Spells.Insert(row);
+			next.AggregateDebuff = aggregate;
+		});
+
+		const auto& state = MAINT::CACHE::Store.Read();
+		for (const auto& playerSpell : player->GetActorRuntimeData().addedSpells) {
+			if (!state->Spells.Contains(playerSpell))
+				continue;
+			MAINT::FORMS::GetSingleton().FlstMaintainedSpellToggle->AddForm(playerSpell);
 		}
+
+		// The save may have been made with the other upkeep mode
+		ApplyUpkeepMode(player);
 	}
 
 	static void Purge()
 	{
 		logger::info("Purge()");
-		for (const auto& [k, v] : MAINT::CACHE::SpellToMaintainedSpell.GetForwardMap()) {
-			const auto& [maintSpell, debuffSpell] = v;
-			maintSpell->SetDelete(true);
-			debuffSpell->SetDelete(true);
+		MAINT::JOBS::Pool::GetSingleton().CancelOnLoad();
+		MAINT::CastQueue::GetSingleton().Clear();
+		{
+			const auto& state = MAINT::CACHE::Store.Read();
+			for (const auto& maintSpell : state->Spells.Maintained())
+				DiscardSpell(maintSpell);
+			for (const auto& debuffSpell : state->Spells.Debuffs()) {
+				if (debuffSpell)
+					DiscardSpell(debuffSpell);
+			}
+			if (state->AggregateDebuff)
+				DiscardSpell(state->AggregateDebuff);
+		}
+		for (auto const& pending : MAINT::CACHE::PendingMappings) {
+			DiscardSpell(pending.maintained);
+			if (pending.debuff)
+				DiscardSpell(pending.debuff);
 		}
+		MAINT::CACHE::PendingMappings.clear();
+		if (const auto& pending = std::exchange(MAINT::CACHE::PendingAggregate, nullptr))
+			DiscardSpell(pending);
 		MAINT::FORMS::GetSingleton().FlstMaintainedSpellToggle->ClearData();
-		MAINT::CACHE::SpellToMaintainedSpell.clear();
+		// Cleared rather than replaced, so handles taken before the load stay invalid
+		MAINT::CACHE::Store.Update([](auto& next) {
+			next.Spells.Clear();
+			next.AggregateDebuff = nullptr;
+		});
 	}
 
-	static void LoadSavegameMapping(const std::string& identifier)
+	// Runs at kPreLoadGame and still allocates a bare skeleton for every mapped spell: the engine binds the save's
+	// references to our FormIDs while it loads, so the forms must exist before it does. Only decorating them and
+	// publishing them to the store waits for BuildActiveSpellsCache, which deletes the skeletons nothing claimed.
+	static void LoadSavegameMapping(const std::string& identifier, const MAINT::PreparedMapping& mapping)
 	{
+		MAINT_TIMELINE_SCOPE("LoadSavegameMapping");
 		logger::info("LoadSavegameMapping({})", identifier);
-		constexpr auto getPluginNameWithLocalID = [](const std::string& part) -> std::pair<std::string, RE::FormID> {
-			std::size_t tildePos = part.find("~");
-
-			if (tildePos == std::string::npos)
-				return { std::string(), 0x0 };
-
-			std::string pluginName = part.substr(0, tildePos);
-			auto localFormID = lexical_cast_hex_to_formid(part.substr(tildePos + 1));
-			return { pluginName, localFormID };
-		};
-		constexpr auto getSpellIDWithDebuffID = [](const std::string& part) -> std::pair<RE::FormID, RE::FormID> {
-			std::size_t tildePos = part.find("~");
-
-			if (tildePos == std::string::npos)
-				return { 0x0, 0x0 };
-			try {
-				auto spellFormID = lexical_cast_hex_to_formid(part.substr(0, tildePos));
-				auto debuffFormID = lexical_cast_hex_to_formid(part.substr(tildePos + 1));
-				return { spellFormID, debuffFormID };
-			} catch (...) {
-				return { 0x0, 0x0 };
-			}
-		};
 
 		const auto& dataHandler = RE::TESDataHandler::GetSingleton();
 		if (!dataHandler) {
@@ -233,145 +418,423 @@ namespace MAINT
 			return;
 		}
 
-		const auto subSection = std::format("MAP:{}", identifier);
-		const auto ini = MAINT::CONFIG::ConfigBase::GetSingleton(MAINT::CONFIG::MAP_FILE);
-		for (const auto& [k, v] : ini->GetAllKeyValuePairs(subSection)) {
-			const auto& [plugin, formid] = getPluginNameWithLocalID(k);
-			const auto& [maintSpellFormID, debuffSpellFormID] = getSpellIDWithDebuffID(v);
-
+		const auto& allocator = MAINT::FormIDAllocator::GetSingleton();
+		for (const auto& [plugin, formid, maintSpellFormID, debuffSpellFormID, cost, duration] : mapping.spells) {
 			const auto& baseSpell = dataHandler->LookupForm<RE::SpellItem>(formid, plugin);
 			if (!baseSpell)
 				continue;
 
-			const auto& infSpell = CreateMaintainSpell(baseSpell);
+			// The save can only refer to the IDs it was written with, one taken by another form in the meantime
+			// would never be claimed. Spells saved with the aggregate debuff have none of their own.
+			if (maintSpellFormID == 0x0 || allocator.IsForeign(maintSpellFormID) || allocator.IsForeign(debuffSpellFormID)) {
+				logger::warn("\tCannot restore {}, its FormIDs are missing or taken", baseSpell->GetName());
+				continue;
+			}
+
+			// Only bare skeletons for now, the engine needs them to bind the save's references to our spells
+			const auto& infSpell = CreateMaintainSpell(baseSpell, maintSpellFormID, false);
 			if (!infSpell) {
 				logger::error("\tFailed to create Maintained Spell: {}", baseSpell->GetName());
 				return;
 			}
-			if (maintSpellFormID != 0x0)
-				infSpell->SetFormID(maintSpellFormID, false);
 
-			const auto& debuffSpell = CreateDebuffSpell(baseSpell, 0.0f);
-			if (!debuffSpell) {
+			RE::SpellItem* debuffSpell = nullptr;
+			if (debuffSpellFormID != 0x0 && !(debuffSpell = CreateDebuffSpell(baseSpell, 0.0f, debuffSpellFormID, false))) {
 				logger::error("\tFailed to create Maintained Spell: {}", baseSpell->GetName());
+				DiscardSpell(infSpell);
 				return;
 			}
-			if (debuffSpellFormID != 0x0)
-				debuffSpell->SetFormID(debuffSpellFormID, false);
-			MAINT::CACHE::SpellToMaintainedSpell.insert(baseSpell, { infSpell, debuffSpell });
+			MAINT::CACHE::PendingMappings.push_back({ baseSpell, infSpell, debuffSpell, cost, duration });
 		}
+
+		if (mapping.aggregate != 0x0 && !allocator.IsForeign(mapping.aggregate))
+			MAINT::CACHE::PendingAggregate = CreateDebuffSpell(nullptr, 0.0f, mapping.aggregate, false);
 	}
 
-	static auto CalculateUpkeepCost(RE::SpellItem* const& baseSpell, RE::Actor* const& theCaster)
+	static float FindRealDuration(RE::SpellItem* const& baseSpell, RE::Actor* const& theCaster)
 	{
-		static auto const& NEUTRAL_DURATION = static_cast<float>(MAINT::CONFIG::CostBaseDuration);
-		static auto const& EXPONENT = MAINT::CONFIG::CostReductionExponent;
-
-		logger::info("CalculateUpkeepCost()");
-		const auto& baseCost = baseSpell->CalculateMagickaCost(theCaster);
-
-		if (NEUTRAL_DURATION == 0.0F) {
-			return baseCost;
+		for (const auto& aeff : *theCaster->AsMagicTarget()->GetActiveEffectList()) {
+			if (aeff->spell == baseSpell && aeff->GetCasterActor().get() == theCaster && aeff->effect == baseSpell->effects.front())
+				return aeff->duration;
 		}
+		return static_cast<float>(baseSpell->effects.front()->GetDuration());
+	}
 
-		const auto& baseDuration = max(static_cast<uint32_t>(1u), baseSpell->effects.front()->GetDuration());
-		auto mult = baseDuration < NEUTRAL_DURATION ? powf(NEUTRAL_DURATION / baseDuration, 2.0) : powf(sqrt(NEUTRAL_DURATION / baseDuration), EXPONENT);
-
-		float baseDur = static_cast<float>(baseSpell->effects.front()->GetDuration());
-		float finalDur = baseDur;
-		for (const auto& aeff : *theCaster->AsMagicTarget()->GetActiveEffectList()) {
-			if (aeff->spell == baseSpell && aeff->GetCasterActor().get() == theCaster && aeff->effect == baseSpell->effects.front()) {
-				finalDur = aeff->duration;
-				const auto& durmult = sqrt(baseDur / finalDur);
-				mult *= durmult;
+	void CompileCostFormulas(CONFIG::Settings const& settings)
+	{
+		constexpr std::array<std::string_view, 5> SCHOOLS{ "Alteration", "Conjuration", "Destruction", "Illusion", "Restoration" };
+		const auto& compile = [&](std::string_view name, std::string_view text) -> std::optional<std::uint8_t> {
+			FORMULA::Program program;
+			std::string error;
+			if (!FORMULA::Compiler::Compile(text, program, error)) {
+				logger::warn("Cost formula {} does not compile: {}", name, error);
+				return std::nullopt;
+			}
+			logger::info("Cost formula {} compiled to {} instructions", name, program.Size());
+			Costs.Programs.push_back(std::move(program));
+			return static_cast<std::uint8_t>(Costs.Programs.size() - 1);
+		};
 
-				logger::info("NeutralDur {} vs BaseDur {} vs RealDur {} => Cost Mult: {}x", NEUTRAL_DURATION, baseDur, aeff->duration, mult);
-				break;
+		Costs = {};
+		if (!compile("CostFormula", settings.CostFormula))
+			compile("default", FORMULA::DEFAULT_UPKEEP_COST);
+		for (auto const& [name, text] : settings.CostFormulaOverrides) {
+			const auto& school = RULES::IndexOf(SCHOOLS, name);
+			const auto& archetype = RULES::IndexOf(RULES::ARCHETYPES, name);
+			if (!school && !archetype) {
+				logger::warn("[COST_FORMULAS] {} is neither a school nor an archetype", name);
+				continue;
+			}
+			if (const auto& index = compile(name, text)) {
+				if (school)
+					Costs.BySchool[*school] = *index;
+				else
+					Costs.ByArchetype[*archetype] = *index;
 			}
 		}
+	}
 
-		if (finalDur > baseDur) {
-			mult *= powf(NEUTRAL_DURATION / finalDur, EXPONENT);
-			logger::info("Mult after CostReductionExponent: {}x", mult);
-		}
+	std::size_t CostModel::IndexFor(RE::SpellItem* const& baseSpell) const
+	{
+		const auto& archetype = static_cast<std::size_t>(baseSpell->effects.front()->baseEffect->GetArchetype());
+		if (archetype < ByArchetype.size() && ByArchetype[archetype] != 0)
+			return ByArchetype[archetype];
+		const auto& school = static_cast<std::size_t>(baseSpell->GetAssociatedSkill()) - static_cast<std::size_t>(RE::ActorValue::kAlteration);
+		if (school < BySchool.size() && BySchool[school] != 0)
+			return BySchool[school];
+		return 0;
+	}
 
-		return roundf(baseCost * mult);
+	static FORMULA::Inputs UpkeepInputsOf(RE::SpellItem* const& baseSpell, RE::Actor* const& theCaster, float const& realDuration, RE::ActorValue const& skill, std::size_t const& count)
+	{
+		auto const& settings = MAINT::CONFIG::Current();
+		const auto& baseDuration = static_cast<float>(baseSpell->effects.front()->GetDuration());
+
+		FORMULA::Inputs inputs;
+		inputs[FORMULA::kBaseCost] = baseSpell->CalculateMagickaCost(theCaster);
+		inputs[FORMULA::kBaseDuration] = baseDuration;
+		inputs[FORMULA::kDuration] = realDuration > 0.0f ? realDuration : baseDuration;
+		inputs[FORMULA::kSkill] = skill != RE::ActorValue::kNone ? theCaster->AsActorValueOwner()->GetActorValue(skill) : 0.0f;
+		inputs[FORMULA::kCount] = static_cast<float>(count);
+		inputs[FORMULA::kNeutralDuration] = static_cast<float>(settings->CostBaseDuration);
+		inputs[FORMULA::kExponent] = settings->CostReductionExponent;
+		return inputs;
+	}
+
+	// Cost of a spell about to be maintained, on top of the ones already are.
+	static float CalculateUpkeepCost(RE::SpellItem* const& baseSpell, RE::Actor* const& theCaster, float const& realDuration)
+	{
+		const auto& count = MAINT::CACHE::Store.Read()->Spells.size() + 1;
+		const auto& program = Costs.Programs[Costs.IndexFor(baseSpell)];
+		const auto& cost = program.Evaluate(UpkeepInputsOf(baseSpell, theCaster, realDuration, baseSpell->GetAssociatedSkill(), count));
+		logger::info("CalculateUpkeepCost() = {} by {}", cost, program.Source());
+		return cost;
 	}
 
 	static void MaintainSpell(RE::SpellItem* const& baseSpell, RE::Actor* const& theCaster)
 	{
+		MAINT_TIMELINE_SCOPE("MaintainSpell");
 		logger::info("MaintainSpell({}, 0x{:08X})", baseSpell->GetName(), baseSpell->GetFormID());
+		const auto& record = [&](FLIGHT::Outcome outcome, float cost, RE::FormID maintained) {
+			Flight.Push({ .subject = baseSpell->GetFormID(), .other = maintained, .value = cost, .kind = FLIGHT::Kind::kMaintain, .detail = static_cast<uint8_t>(outcome) });
+		};
 
 		if (!IsMaintainable(baseSpell, theCaster)) {
+			record(FLIGHT::Outcome::kNotMaintainable, 0.0f, 0x0);
 			RE::DebugNotification(std::format("Cannot maintain {}.", baseSpell->GetName()).c_str());
 			return;
 		}
 
 		const auto& baseCost = baseSpell->CalculateMagickaCost(theCaster);
-		auto magCost = CalculateUpkeepCost(baseSpell, theCaster);
+		const auto& realDuration = FindRealDuration(baseSpell, theCaster);
+		auto magCost = CalculateUpkeepCost(baseSpell, theCaster, realDuration);
 
 		if (magCost > theCaster->AsActorValueOwner()->GetActorValue(RE::ActorValue::kMagicka) + baseCost) {
+			record(FLIGHT::Outcome::kNoMagicka, magCost, 0x0);
 			RE::DebugNotification(std::format("Need {} Magicka to maintain {}.", static_cast<uint32_t>(magCost), baseSpell->GetName()).c_str());
 			return;
 		}
 
-		if (MAINT::CACHE::SpellToMaintainedSpell.containsKey(baseSpell)) {
+		if (MAINT::CACHE::Store.Read()->Spells.Contains(baseSpell)) {
 			logger::info("\tActor already has constant version of {}.", baseSpell->GetName());
+			record(FLIGHT::Outcome::kAlreadyMaintained, magCost, 0x0);
 			return;
 		}
 
+		// With the aggregate debuff the spell gets no debuff of its own, its cost is added to the shared one
+		const bool aggregate = MAINT::CONFIG::Current()->AggregateUpkeep;
 		const auto& maintSpell = CreateMaintainSpell(baseSpell);
-		const auto& debuffSpell = CreateDebuffSpell(baseSpell, magCost);
+		const auto& debuffSpell = maintSpell && !aggregate ? CreateDebuffSpell(baseSpell, magCost) : nullptr;
+		if (!maintSpell || (!aggregate && !debuffSpell)) {
+			if (maintSpell)
+				DiscardSpell(maintSpell);
+			record(FLIGHT::Outcome::kNoFormIDs, magCost, 0x0);
+			RE::DebugNotification(std::format("Cannot maintain {}: no free FormIDs left.", baseSpell->GetName()).c_str());
+			return;
+		}
 
 		logger::info("\tRemoving Base Effect of {}", baseSpell->GetName());
 		auto handle = theCaster->GetHandle();
 		theCaster->AsMagicTarget()->DispelEffect(baseSpell, handle);
 		theCaster->AsActorValueOwner()->RestoreActorValue(RE::ACTOR_VALUE_MODIFIERS::ACTOR_VALUE_MODIFIER::kDamage, RE::ActorValue::kMagicka, baseCost);
 
-		if (MAINT::CONFIG::DoSilenceFX) {
+		if (MAINT::CONFIG::Current()->DoSilenceFX) {
 			logger::info("Silencing SpellFX");
-			for (auto const& eff : MAINT::SilenceSpellFX(maintSpell))
-				MAINT::UpdatePCHook::PushFXRestore(eff);
+			if (MAINT::SilenceSpellFX(maintSpell) > 0)
+				MAINT::UpdatePCHook::ResetEffCheckTimer();
 		}
 
 		logger::info("\tAdding Constant Effect with Maintain Cost of {}", magCost);
 		theCaster->AddSpell(maintSpell);
-		theCaster->AddSpell(debuffSpell);
-		MAINT::CACHE::SpellToMaintainedSpell.insert(baseSpell, { maintSpell, debuffSpell });
+		if (debuffSpell)
+			theCaster->AddSpell(debuffSpell);
+		MAINT::CACHE::Store.Update([&](auto& state) {
+			state.Spells.Insert({ baseSpell, maintSpell, debuffSpell, magCost, realDuration, baseSpell->GetAssociatedSkill() });
+		});
+		if (aggregate)
+			SyncAggregateDebuff(theCaster);
+		record(FLIGHT::Outcome::kMaintained, magCost, maintSpell->GetFormID());
 
 		MAINT::FORMS::GetSingleton().FlstMaintainedSpellToggle->AddForm(baseSpell);
+		if (Costs.Uses(FORMULA::kCount))
+			RecomputeUpkeepCosts(theCaster);
 		RE::DebugNotification(std::format("Maintaining {} for {} Magicka.", baseSpell->GetName(), static_cast<uint32_t>(magCost)).c_str());
 	}
 
+	// Maintains every spell the caster has active on itself and doesn't maintain yet: one pass over the active
+	// effects, one pricing pass per formula, one Magicka check and one store update for all of them. Returns the
+	// number of spells maintained.
+	std::size_t MaintainActiveBuffs(RE::Actor* const& theCaster)
+	{
+		MAINT_TIMELINE_SCOPE("MaintainActiveBuffs");
+		MAINT_ALLOC_REGION(kBatch);
+		logger::info("MaintainActiveBuffs()");
+		const auto& state = MAINT::CACHE::Store.Read();
+
+		struct Candidate
+		{
+			RE::SpellItem* spell;
+			float duration;
+			float cost;
+		};
+		std::vector<Candidate> candidates;
+		for (const auto& aeff : *theCaster->AsMagicTarget()->GetActiveEffectList()) {
+			const auto& spell = aeff->spell ? aeff->spell->As<RE::SpellItem>() : nullptr;
+			if (!spell || spell->effects.empty() || aeff->effect != spell->effects.front() || aeff->GetCasterActor().get() != theCaster)
+				continue;
+			if (aeff->flags.any(RE::ActiveEffect::Flag::kDispelled) || MAINT::FormIDAllocator::Owns(spell->GetFormID()) || state->Spells.Contains(spell))
+				continue;
+			if (std::any_of(candidates.begin(), candidates.end(), [&](auto const& candidate) { return candidate.spell == spell; }) || !IsMaintainable(spell, theCaster))
+				continue;
+			candidates.push_back({ spell, aeff->duration, 0.0f });
+		}
+		if (candidates.empty()) {
+			RE::DebugNotification("No active spells to maintain.");
+			return 0;
+		}
+		MAINT_ALLOC_SCALE(candidates.size());
+
+		// Priced as if all of them get maintained
+		const auto& count = state->Spells.size() + candidates.size();
+		std::vector<std::size_t> batch;
+		std::vector<FORMULA::Inputs> inputs;
+		std::vector<float> costs;
+		for (std::size_t program = 0; program < Costs.Programs.size(); ++program) {
+			batch.clear();
+			inputs.clear();
+			for (std::size_t i = 0; i < candidates.size(); ++i) {
+				if (Costs.IndexFor(candidates[i].spell) != program)
+					continue;
+				batch.push_back(i);
+				inputs.push_back(UpkeepInputsOf(candidates[i].spell, theCaster, candidates[i].duration, candidates[i].spell->GetAssociatedSkill(), count));
+			}
+			costs.resize(inputs.size());
+			Costs.Programs[program].EvaluateBatch(inputs, costs);
+			for (std::size_t b = 0; b < batch.size(); ++b)
+				candidates[batch[b]].cost = costs[b];
+		}
+
+		// Cheapest first, so Magicka that doesn't cover everything still maintains as many spells as it can
+		std::sort(candidates.begin(), candidates.end(), [](auto const& a, auto const& b) { return a.cost < b.cost; });
+		const auto& magicka = theCaster->AsActorValueOwner()->GetActorValue(RE::ActorValue::kMagicka);
+		float total = 0.0f;
+		std::size_t affordable = 0;
+		while (affordable < candidates.size() && total + candidates[affordable].cost <= magicka)
+			total += candidates[affordable++].cost;
+		for (std::size_t i = affordable; i < candidates.size(); ++i)
+			Flight.Push({ .subject = candidates[i].spell->GetFormID(), .value = candidates[i].cost, .kind = FLIGHT::Kind::kMaintain, .detail = static_cast<uint8_t>(FLIGHT::Outcome::kNoMagicka) });
+		if (affordable == 0) {
+			RE::DebugNotification(std::format("Need {} Magicka to maintain {}.", static_cast<uint32_t>(candidates.front().cost), candidates.front().spell->GetName()).c_str());
+			return 0;
+		}
+
+		const bool aggregate = MAINT::CONFIG::Current()->AggregateUpkeep;
+		std::vector<MAINT::CACHE::SpellTable::Row> rows;
+		for (std::size_t i = 0; i < affordable; ++i) {
+			auto const& candidate = candidates[i];
+			const auto& maintSpell = CreateMaintainSpell(candidate.spell);
+			const auto& debuffSpell = maintSpell && !aggregate ? CreateDebuffSpell(candidate.spell, candidate.cost) : nullptr;
+			if (!maintSpell || (!aggregate && !debuffSpell)) {
+				if (maintSpell)
+					DiscardSpell(maintSpell);
+				logger::warn("\tNo free FormIDs left, {} spells not maintained", affordable - i);
+				Flight.Push({ .subject = candidate.spell->GetFormID(), .value = candidate.cost, .kind = FLIGHT::Kind::kMaintain, .detail = static_cast<uint8_t>(FLIGHT::Outcome::kNoFormIDs) });
+				break;
+			}
+			rows.push_back({ candidate.spell, maintSpell, debuffSpell, candidate.cost, candidate.duration, candidate.spell->GetAssociatedSkill() });
+		}
+		if (rows.empty()) {
+			RE::DebugNotification(std::format("Cannot maintain {}: no free FormIDs left.", candidates.front().spell->GetName()).c_str());
+			return 0;
+		}
+
+		auto handle = theCaster->GetHandle();
+		const bool silence = MAINT::CONFIG::Current()->DoSilenceFX;
+		float maintainedCost = 0.0f;
+		for (auto const& row : rows) {
+			logger::info("\tMaintaining {} for {} Magicka", row.base->GetName(), row.cost);
+			theCaster->AsMagicTarget()->DispelEffect(row.base, handle);
+			if (silence)
+				MAINT::SilenceSpellFX(row.maintained);
+			theCaster->AddSpell(row.maintained);
+			if (row.debuff)
+				theCaster->AddSpell(row.debuff);
+			maintainedCost += row.cost;
+			Flight.Push({ .subject = row.base->GetFormID(), .other = row.maintained->GetFormID(), .value = row.cost, .kind = FLIGHT::Kind::kMaintain,
+				.detail = static_cast<uint8_t>(FLIGHT::Outcome::kMaintained) });
+		}
+		MAINT::UpdatePCHook::ResetEffCheckTimer();
+		MAINT::CACHE::Store.Update([&](auto& next) {
+			for (auto const& row : rows)
+				next.Spells.Insert(row);
+		});
+		if (aggregate)
+			SyncAggregateDebuff(theCaster);
+
+		const auto& toggleList = MAINT::FORMS::GetSingleton().FlstMaintainedSpellToggle;
+		for (auto const& row : rows)
+			toggleList->AddForm(row.base);
+		if (Costs.Uses(FORMULA::kCount))
+			RecomputeUpkeepCosts(theCaster);
+
+		auto summary = std::format("Maintaining {} spells for {} Magicka.", rows.size(), static_cast<uint32_t>(maintainedCost));
+		if (rows.size() < candidates.size())
+			summary += std::format(" {} more could not be maintained.", candidates.size() - rows.size());
+		RE::DebugNotification(summary.c_str());
+		return rows.size();
+	}
+
+	// Safe from any thread. The batch runs on the main thread with the next UpdatePCMod, unless a load comes first.
+	void RequestMaintainActiveBuffs()
+	{
+		JOBS::Pool::GetSingleton().Submit([]() {
+			if (const auto& player = RE::PlayerCharacter::GetSingleton())
+				MaintainActiveBuffs(player);
+		}, JOBS::Affinity::kMain, JOBS::Cancel::kOnLoad);
+	}
+
 	static void StoreSavegameMapping(const std::string& identifier)
 	{
+		MAINT_TIMELINE_SCOPE("StoreSavegameMapping");
 		logger::info("StoreSavegameMapping({})", identifier);
-		static auto ini = MAINT::CONFIG::ConfigBase::GetSingleton(MAINT::CONFIG::MAP_FILE);
-		const auto subSection = std::format("MAP:{}", identifier);
-		ini->DeleteSection(subSection);
-		for (const auto& [baseSpell, maintData] : MAINT::CACHE::SpellToMaintainedSpell.GetForwardMap()) {
-			const auto& [maintSpell, debuffSpell] = maintData;
-			auto keyString = std::format("{}~0x{:08X}", baseSpell->GetFile(0)->GetFilename(), baseSpell->GetLocalFormID());
-			auto rightHandSide = std::format("0x{:08X}~0x{:08X}", maintSpell->GetFormID(), debuffSpell->GetFormID());
-			ini->SetValue(subSection,
-				keyString,
-				rightHandSide,
-				std::format("# {}", baseSpell->GetName()));
+		static auto ini = MAINT::CONFIG::ConfigBase::GetSingleton<MAINT::CONFIG::MAP_FILE>();
+		// The preloader may still be reading the file
+		auto& preloader = MAINT::MappingPreloader::GetSingleton();
+		preloader.Wait();
+		MAINT::PreparedMapping written;
+		const auto& state = MAINT::CACHE::Store.Read();
+		auto& journal = MAINT::MappingJournal::GetSingleton();
+		const auto& outcome = journal.Write(ini, identifier, state.Generation(), [&]() {
+			MAINT::MappingSection section;
+			const auto& spells = state->Spells;
+			for (std::size_t i = 0; i < spells.size(); ++i) {
+				const auto& baseSpell = spells.Bases()[i];
+				const auto& maintSpell = spells.Maintained()[i];
+				const auto& debuffFormID = spells.Debuffs()[i] ? spells.Debuffs()[i]->GetFormID() : 0x0;
+				const auto& cost = spells.Costs()[i];
+				const auto& duration = spells.Durations()[i];
+				written.spells.push_back({ std::string(baseSpell->GetFile(0)->GetFilename()), baseSpell->GetLocalFormID(), maintSpell->GetFormID(), debuffFormID, cost, duration });
+				section.lines.push_back({ std::format("{}~0x{:08X}", baseSpell->GetFile(0)->GetFilename(), baseSpell->GetLocalFormID()),
+					std::format("0x{:08X}~0x{:08X}~{}~{}", maintSpell->GetFormID(), debuffFormID, cost, duration),
+					std::format("# {}", baseSpell->GetName()) });
+			}
+			written.allocation = section.allocation = MAINT::FormIDAllocator::GetSingleton().Serialize();
+			written.aggregate = section.aggregate = state->AggregateDebuff ? state->AggregateDebuff->GetFormID() : 0x0;
+			return section;
+		});
+
+		const auto& counters = journal.GetCounters();
+		switch (outcome) {
+		case MAINT::MappingJournal::Outcome::kSkipped:
+			logger::info("\tMapping unchanged, {} of {} saves skipped", counters.skipped, counters.saves);
+			return;
+		case MAINT::MappingJournal::Outcome::kAliased:
+			logger::info("\tMapping matches {}, {} of {} saves aliased", journal.GetLastTarget(), counters.aliased, counters.saves);
+			break;
+		default:
+			logger::info("\tMapping written, {} keys written, {} kept, {} deleted so far", counters.keysWritten, counters.keysKept, counters.keysDeleted);
+			break;
 		}
-		ini->Save();
+		preloader.Remember(identifier, std::move(written));
+	}
+
+	// Names are resolved here on the game thread, the file is written by a worker. Anomalies dump at most every
+	// 30 seconds, the ring still holds the ones in between when the next dump comes.
+	void DumpFlightRecorder(std::string_view reason, bool force)
+	{
+		MAINT_ALLOC_REGION(kDump);
+		const auto path = MAINT::CONFIG::Current()->FlightRecorderFile;
+		if (path.empty())
+			return;
+		static std::chrono::steady_clock::time_point lastDump{};
+		const auto& now = std::chrono::steady_clock::now();
+		if (!force && lastDump != std::chrono::steady_clock::time_point{} && now - lastDump < std::chrono::seconds(30))
+			return;
+		lastDump = now;
+
+		auto records = Flight.Snapshot();
+		const auto& dumpTime = Flight.Now();
+		std::vector<uint32_t> formIDs;
+		FLIGHT::CollectFormIDs(records, formIDs);
+		std::unordered_map<uint32_t, std::string> names;
+		for (const auto& formID : formIDs) {
+			if (names.contains(formID))
+				continue;
+			const auto& form = formID ? RE::TESForm::LookupByID(formID) : nullptr;
+			names.emplace(formID, form ? form->GetName() : "");
+		}
+
+		logger::info("Dumping {} flight records to {}: {}", records.size(), path, reason);
+		JOBS::Pool::GetSingleton().Submit([records = std::move(records), names = std::move(names), reason = std::string(reason), path = path, dumpTime]() {
+			static std::mutex fileMutex;
+			std::lock_guard guard(fileMutex);
+			std::ofstream file(path, std::ios::trunc);
+			if (!file) {
+				logger::error("Cannot write the flight recorder to {}", path);
+				return;
+			}
+			FLIGHT::WriteText(file, records, reason, dumpTime, [&](uint32_t formID) {
+				const auto& name = names.find(formID);
+				return name != names.end() ? name->second : std::string();
+			});
+		});
 	}
 
 	void AwardPlayerExperience(RE::PlayerCharacter* const& player)
 	{
-		for (const auto& [baseSpell, _] : MAINT::CACHE::SpellToMaintainedSpell.GetForwardMap()) {
-			const auto& baseCost = baseSpell->CalculateMagickaCost(nullptr);
-			player->AddSkillExperience(baseSpell->GetAssociatedSkill(), baseCost);
+		const auto& state = MAINT::CACHE::Store.Read();
+		const auto& spells = state->Spells;
+		for (std::size_t i = 0; i < spells.size(); ++i) {
+			const auto& baseCost = spells.Bases()[i]->CalculateMagickaCost(nullptr);
+			player->AddSkillExperience(spells.Skills()[i], baseCost);
 		}
 	}
 
 	void CheckUpkeepValidity(RE::Actor* const& theActor)
 	{
-		if (MAINT::CACHE::SpellToMaintainedSpell.empty()) {
+		MAINT_TIMELINE_SCOPE("CheckUpkeepValidity");
+		const auto& state = MAINT::CACHE::Store.Read();
+		if (state->Spells.empty()) {
 			return;
 		}
 
@@ -380,60 +843,100 @@ namespace MAINT
 			return;
 		}
 
-		const auto& map = MAINT::CACHE::SpellToMaintainedSpell.GetForwardMap();
-		const auto totalMagDrain = std::accumulate(map.begin(), map.end(), 0.0f,
-			[&](float current, const std::pair<RE::SpellItem*, MAINT::CACHE::MaintainedSpell>& maintSpell) {
-				const auto& [baseSpell, maintSpellData] = maintSpell;
-				const auto& [infSpell, debuffSpell] = maintSpellData;
-				return current + debuffSpell->effects.front()->GetMagnitude();
-			});
+		const auto& totalMagDrain = TotalUpkeep(*state);
+		Flight.Push({ .value = av, .value2 = totalMagDrain, .count = static_cast<uint16_t>(state->Spells.size()), .kind = FLIGHT::Kind::kMindCrush });
+		DumpFlightRecorder("Mind Crush");
 
 		const auto& mindCrush = MAINT::FORMS::GetSingleton().SpelMindCrush;
 		theActor->GetMagicCaster(RE::MagicSystem::CastingSource::kLeftHand)->CastSpellImmediate(mindCrush, false, theActor, 1.0, true, totalMagDrain, nullptr);
 	}
 
-	void ForceMaintainedSpellUpdate(RE::Actor* const& theActor)
+	void RecomputeUpkeepCosts(RE::Actor* const& theActor)
 	{
-		if (MAINT::CACHE::SpellToMaintainedSpell.empty())
-			return;
-		constexpr uint32_t _AVG_WINDOW{ 100 };
-		static double _runTime{ 0.0 };
-		static uint32_t _runCount{ 0 };
-		auto start = std::chrono::high_resolution_clock::now();
-
-		std::map<RE::SpellItem*, std::unordered_multiset<RE::ActiveEffect*>> SpellToActiveEffects;
-		static auto const& mmDebufEffect = MAINT::FORMS::GetSingleton().SpelMagickaDebuffTemplate->effects.front();
+		MAINT_TIMELINE_SCOPE("RecomputeUpkeepCosts");
+		logger::info("RecomputeUpkeepCosts()");
+		const auto& state = MAINT::CACHE::Store.Read();
+		const auto& spells = state->Spells;
+
+		// One batch per formula, spells that share a formula are evaluated in a single pass
+		std::vector<std::size_t> batch;
+		std::vector<FORMULA::Inputs> inputs;
+		std::vector<float> costs;
+		std::vector<std::pair<SlotHandle, float>> repriced;
+		for (std::size_t program = 0; program < Costs.Programs.size(); ++program) {
+			batch.clear();
+			inputs.clear();
+			for (std::size_t i = 0; i < spells.size(); ++i) {
+				if (Costs.IndexFor(spells.Bases()[i]) != program)
+					continue;
+				// Restored from a mapping written before durations were stored, keep the saved cost rather than
+				// pricing the spell at its base duration
+				if (spells.Durations()[i] <= 0.0f)
+					continue;
+				batch.push_back(i);
+				inputs.push_back(UpkeepInputsOf(spells.Bases()[i], theActor, spells.Durations()[i], spells.Skills()[i], spells.size()));
+			}
+			costs.resize(inputs.size());
+			Costs.Programs[program].EvaluateBatch(inputs, costs);
+
+			for (std::size_t b = 0; b < batch.size(); ++b) {
+				const auto& i = batch[b];
+				const auto& baseSpell = spells.Bases()[i];
+				const auto& debuffSpell = spells.Debuffs()[i];
+				const auto& magCost = costs[b];
+				const auto& previous = spells.Costs()[i];
+				if (magCost == previous)
+					continue;
 
-		const auto& effList = theActor->AsMagicTarget()->GetActiveEffectList();
-		for (const auto& e : *effList) {
-			if (auto const& asSpl = e->spell->As<RE::SpellItem>(); asSpl != nullptr && e->effect->baseEffect != mmDebufEffect->baseEffect) {
-				auto const& hasKywd = asSpl->HasKeyword(MAINT::FORMS::GetSingleton().KywdMaintainedSpell);
-				auto const& isBaseSpell = MAINT::CACHE::SpellToMaintainedSpell.containsKey(asSpl);
-				if (isBaseSpell) {
-					auto const& [mSpl, _] = MAINT::CACHE::SpellToMaintainedSpell.getValue(asSpl);
-					SpellToActiveEffects[mSpl].insert(e);
-				} else if (hasKywd) {
-					e->elapsedSeconds = 0.0f;
-					SpellToActiveEffects[asSpl].insert(e);
-				}
+				logger::info("\tRepricing {} from {} to {} Magicka", baseSpell->GetName(), previous, magCost);
+				Flight.Push({ .subject = baseSpell->GetFormID(), .value = previous, .value2 = magCost, .kind = FLIGHT::Kind::kReprice });
+				repriced.emplace_back(spells.HandleAt(i), magCost);
+				if (!debuffSpell)
+					continue;
+				debuffSpell->effects.front()->effectItem.magnitude = magCost;
+				// Constant effects only pick up a new magnitude when they are reapplied
+				theActor->RemoveSpell(debuffSpell);
+				theActor->AddSpell(debuffSpell);
 			}
 		}
+		if (repriced.empty())
+			return;
 
-		std::vector<std::pair<RE::SpellItem*, MAINT::CACHE::MaintainedSpell>> toRemove;
-		for (const auto& [baseSpell, maintainedSpellPair] : MAINT::CACHE::SpellToMaintainedSpell.GetForwardMap()) {
-			const auto& [maintSpell, debuffSpell] = maintainedSpellPair;
-
-			auto const& mSplInList = SpellToActiveEffects.find(maintSpell);
+		MAINT::CACHE::Store.Update([&](auto& next) {
+			for (auto const& [handle, cost] : repriced) {
+				if (const auto& i = next.Spells.Find(handle); i != CACHE::SpellTable::NPOS)
+					next.Spells.Costs()[i] = cost;
+			}
+		});
+		if (state->AggregateDebuff)
+			SyncAggregateDebuff(theActor);
+	}
 
-			if (mSplInList == SpellToActiveEffects.end()) {
-				logger::debug("{} not found on Actor", maintSpell->GetName());
-				toRemove.emplace_back(std::make_pair(baseSpell, std::make_pair(maintSpell, debuffSpell)));
+	static uint16_t CountExclusiveEffects(RE::SpellItem* const& theSpell)
+	{
+		uint16_t count = 0;
+		for (uint32_t i = 0; i < theSpell->effects.size(); ++i) {
+			auto const& assoc = theSpell->effects[i]->baseEffect->data.associatedForm;
+			if (assoc == nullptr)
 				continue;
-			}
+			bool seen = false;
+			for (uint32_t j = 0; j < i && !seen; ++j)
+				seen = theSpell->effects[j]->baseEffect->data.associatedForm == assoc;
+			if (!seen)
+				++count;
+		}
+		return count;
+	}
 
-			auto const& mSpl = mSplInList->first;
-			auto const& effSet = mSplInList->second;
-			if (mSpl->effects.size() < effSet.size()) {
+	static void LogValidationFailure(RE::SpellItem* const& mSpl, MAINT::VALIDATION::Verdict const& verdict, std::vector<RE::ActiveEffect*> const& effSet)
+	{
+		using Verdict = MAINT::VALIDATION::Verdict;
+		switch (verdict) {
+		case Verdict::kNotFound:
+			logger::debug("{} not found on Actor", mSpl->GetName());
+			break;
+		case Verdict::kTooManyEffects:
+			{
 				logger::debug("{} EFF count mismatch: Spell has LESS", mSpl->GetName());
 				logger::debug("\t{} has:", mSpl->GetName());
 				short n = 1;
@@ -445,20 +948,11 @@ namespace MAINT
 				for (auto const& te : effSet) {
 					logger::debug("\t{}\t{}, Src: {}", n++, te->effect->baseEffect->GetName(), te->spell ? te->spell->GetName() : "NULL/UNK");
 				}
-				toRemove.emplace_back(std::make_pair(baseSpell, std::make_pair(maintSpell, debuffSpell)));
-				continue;
-			} else if (mSpl->effects.size() > effSet.size()) {
-				auto constexpr getUniques = [&](RE::BSTArray<RE::Effect*> arr) {
-					std::set<RE::TESForm*> uniqueItemsSet;
-					std::vector<RE::Effect*> uniqueItems;
-
-					for (const auto& item : arr) {
-						if (item->baseEffect->data.associatedForm != nullptr && uniqueItemsSet.insert(item->baseEffect->data.associatedForm).second) {  // .second is true if insertion took place
-							uniqueItems.push_back(item);
-						}
-					}
-					return uniqueItems;
-				};
+				break;
+			}
+		case Verdict::kSourceMismatch:
+		case Verdict::kMissingExclusives:
+			{
 				logger::debug("{} EFF count mismatch: Spell has MORE", mSpl->GetName());
 				logger::debug("\t{} has:", mSpl->GetName());
 
@@ -467,11 +961,12 @@ namespace MAINT
 					logger::debug("\t{}\t{} (0x{:08X})", n++, te->baseEffect->GetName(), te->baseEffect->GetFormID());
 				}
 
-				auto const& uniqueList = getUniques(mSpl->effects);
-				if (!uniqueList.empty()) {
-					logger::debug("\tThe following have exclusivity:");
-					n = 1;
-					for (auto const& te : uniqueList) {
+				std::set<RE::TESForm*> uniqueItemsSet;
+				n = 1;
+				for (auto const& te : mSpl->effects) {
+					if (te->baseEffect->data.associatedForm != nullptr && uniqueItemsSet.insert(te->baseEffect->data.associatedForm).second) {
+						if (n == 1)
+							logger::debug("\tThe following have exclusivity:");
 						logger::debug("\t{}\t{} (0x{:08X}) # Assoc: {}", n++, te->baseEffect->GetName(), te->baseEffect->GetFormID(), te->baseEffect->data.associatedForm->GetName());
 					}
 				}
@@ -481,61 +976,160 @@ namespace MAINT
 					logger::debug("\t{}\t{} (0x{}), Src: {}", n++, te->effect->baseEffect->GetName(), te->effect->baseEffect->GetFormID(), te->spell ? te->spell->GetName() : "NULL/UNK");
 				}
 
-				auto const& hasDifferentSource = std::find_if(effSet.begin(), effSet.end(), [&](RE::ActiveEffect* e) {
-					return e->spell->As<RE::SpellItem>() != mSpl;
-				});
-				if (hasDifferentSource != effSet.end()) {
+				if (verdict == Verdict::kSourceMismatch) {
+					auto const& hasDifferentSource = std::find_if(effSet.begin(), effSet.end(), [&](RE::ActiveEffect* e) {
+						return e->spell->As<RE::SpellItem>() != mSpl;
+					});
 					logger::debug("\t{} source mismatch! Found at least one: {} (0x{:08X})", mSpl->GetName(), (*hasDifferentSource)->spell->GetName(), (*hasDifferentSource)->spell->GetFormID());
-					toRemove.emplace_back(std::make_pair(baseSpell, std::make_pair(maintSpell, debuffSpell)));
-					continue;
 				} else {
 					logger::debug("\tAll active sources match");
-					if (uniqueList.size() > effSet.size()) {
-						logger::debug("\tBut exclusives are missing");
-						toRemove.emplace_back(std::make_pair(baseSpell, std::make_pair(maintSpell, debuffSpell)));
-						continue;
-					}
-				}
-			} else {
-				constexpr uint32_t HUGE_DUR = 60 * 60 * 24 * 356;
-				auto const& hasWrongDuration = std::find_if(effSet.begin(), effSet.end(), [&](RE::ActiveEffect* e) {
-					return e->duration > 0.0 && static_cast<uint32_t>(e->duration - e->elapsedSeconds) < HUGE_DUR;
-				});
-				if (hasWrongDuration != effSet.end()) {
-					logger::debug("EFF duration does not match");
-					toRemove.emplace_back(std::make_pair(baseSpell, std::make_pair(maintSpell, debuffSpell)));
-					continue;
+					logger::debug("\tBut exclusives are missing");
 				}
+				break;
 			}
+		case Verdict::kWrongDuration:
+			logger::debug("EFF duration does not match");
+			break;
+		case Verdict::kNoActiveEffects:
+			logger::debug("{} active count is zero", mSpl->GetName());
+			break;
+		default:
+			break;
+		}
+	}
 
-			auto const& allMyEffects = SpellToActiveEffects.at(maintSpell);
-			auto const& hasActives = std::find_if(allMyEffects.begin(), allMyEffects.end(), [](RE::ActiveEffect* e) {
-				return !e->flags.any(RE::ActiveEffect::Flag::kInactive, RE::ActiveEffect::Flag::kDispelled);
-			});
-			if (hasActives == allMyEffects.end()) {
-				logger::debug("{} active count is zero", maintSpell->GetName());
-				toRemove.emplace_back(std::make_pair(baseSpell, std::make_pair(maintSpell, debuffSpell)));
+	std::size_t ForceMaintainedSpellUpdate(RE::Actor* const& theActor)
+	{
+		MAINT_TIMELINE_SCOPE("ForceMaintainedSpellUpdate");
+		using namespace MAINT::VALIDATION;
+
+		const auto& state = MAINT::CACHE::Store.Read();
+		const auto& spells = state->Spells;
+		if (spells.empty())
+			return 0;
+		constexpr uint32_t _AVG_WINDOW{ 100 };
+		static double _runTime{ 0.0 };
+		static uint32_t _runCount{ 0 };
+		auto start = std::chrono::high_resolution_clock::now();
+
+		static auto const& mmDebufEffect = MAINT::FORMS::GetSingleton().SpelMagickaDebuffTemplate->effects.front();
+		static auto const& maintainedKeyword = MAINT::FORMS::GetSingleton().KywdMaintainedSpell;
+
+		// Scratch buffers are kept across sweeps, this only runs on the game thread
+		static std::vector<RE::ActiveEffect*> activeEffects;
+		static std::vector<ActiveEffectFact> effectFacts;
+		static std::vector<MaintainedFact> maintainedFacts;
+		static std::vector<std::pair<FormID, Verdict>> verdicts;
+		static std::unordered_map<FormID, FormID> baseToMaintained;
+		static Grouping groups;
+		activeEffects.clear();
+		effectFacts.clear();
+		maintainedFacts.clear();
+		verdicts.clear();
+		baseToMaintained.clear();
+
+		for (std::size_t i = 0; i < spells.size(); ++i) {
+			const auto& maintSpell = spells.Maintained()[i];
+			const auto& debuffSpell = spells.Debuffs()[i];
+			baseToMaintained.emplace(spells.Bases()[i]->GetFormID(), maintSpell->GetFormID());
+			maintainedFacts.push_back({ spells.Bases()[i]->GetFormID(), maintSpell->GetFormID(), debuffSpell ? debuffSpell->GetFormID() : 0x0,
+				static_cast<uint16_t>(maintSpell->effects.size()), CountExclusiveEffects(maintSpell) });
+		}
+
+		const auto& effList = theActor->AsMagicTarget()->GetActiveEffectList();
+		for (const auto& e : *effList) {
+			ActiveEffectFact fact{ 0x0, e->duration, e->elapsedSeconds, ActiveEffectFact::kNone };
+			// Effects of a discarded spell can linger for a frame, its FormID may already belong to a new spell
+			if (auto const& asSpl = e->spell->As<RE::SpellItem>(); asSpl != nullptr && !asSpl->IsDeleted()) {
+				fact.spell = asSpl->GetFormID();
+				fact.flags |= ActiveEffectFact::kFromSpell;
+				if (e->effect->baseEffect == mmDebufEffect->baseEffect) {
+					fact.flags |= ActiveEffectFact::kUpkeepDebuff;
+				} else if (asSpl->HasKeyword(maintainedKeyword)) {
+					fact.flags |= ActiveEffectFact::kMaintainedKeyword;
+					if (!baseToMaintained.contains(fact.spell)) {
+						e->elapsedSeconds = 0.0f;
+						fact.elapsed = 0.0f;
+					}
+				}
 			}
+			if (e->flags.any(RE::ActiveEffect::Flag::kInactive, RE::ActiveEffect::Flag::kDispelled))
+				fact.flags |= ActiveEffectFact::kInactive;
+			activeEffects.push_back(e);
+			effectFacts.push_back(fact);
+		}
+		GroupEffects(effectFacts, baseToMaintained, groups);
+
+		std::vector<std::pair<SlotHandle, MAINT::CACHE::SpellTable::Row>> toRemove;
+		std::string_view anomaly;
+		for (std::size_t row = 0; row < spells.size(); ++row) {
+			const auto& maintSpell = spells.Maintained()[row];
+			auto const& fact = maintainedFacts[row];
+			auto const& groupIt = groups.find(fact.maintained);
+			auto const& group = groupIt != groups.end() ? std::span<const uint32_t>(groupIt->second) : std::span<const uint32_t>();
+			auto const& verdict = Evaluate(fact, effectFacts, group);
+			verdicts.emplace_back(maintSpell->GetFormID(), verdict);
+			Flight.Push({ .subject = fact.base, .other = fact.maintained, .count = fact.effectCount, .count2 = static_cast<uint16_t>(group.size()),
+				.extra = fact.exclusiveCount, .kind = FLIGHT::Kind::kVerdict, .detail = static_cast<uint8_t>(verdict) });
+			if (verdict == Verdict::kKeep)
+				continue;
+			// Dispelling a maintained spell by hand is what kNotFound usually means, anything else is worth a dump
+			if (verdict != Verdict::kNotFound && anomaly.empty())
+				anomaly = ToString(verdict);
+
+			std::vector<RE::ActiveEffect*> effSet;
+			for (auto const& i : group) {
+				auto const& effect = effectFacts[i];
+				Flight.Push({ .subject = effect.spell, .other = fact.maintained, .value = effect.duration, .value2 = effect.elapsed, .kind = FLIGHT::Kind::kEffect,
+					.detail = static_cast<uint8_t>(effect.flags) });
+				effSet.push_back(activeEffects[i]);
+			}
+			LogValidationFailure(maintSpell, verdict, effSet);
+			Flight.Push({ .subject = fact.base, .other = fact.maintained, .kind = FLIGHT::Kind::kRemoval, .detail = static_cast<uint8_t>(verdict) });
+			toRemove.emplace_back(spells.HandleAt(row), spells.RowAt(row));
 		}
 
+		MAINT::EventRecorder::GetSingleton().Record([&](auto& trace, auto now) {
+			trace.Maintained(now, maintainedFacts);
+			trace.Effects(now, effectFacts);
+			trace.Verdicts(now, verdicts);
+		});
+
 		if (!toRemove.empty()) {
-			for (const auto& [baseSpell, maintSpellPair] : toRemove) {
-				const auto& [maintSpell, debuffSpell] = maintSpellPair;
+			for (const auto& [_, removed] : toRemove) {
+				const auto& maintSpell = removed.maintained;
+				const auto& debuffSpell = removed.debuff;
 				logger::info("Dispelling missing/invalid {} (0x{:08X})", maintSpell->GetName(), maintSpell->GetFormID());
 
 				theActor->RemoveSpell(maintSpell);
-				theActor->RemoveSpell(debuffSpell);
-				RE::DebugNotification(std::format("{} is no longer being maintained.", baseSpell->GetName()).c_str());
+				if (debuffSpell)
+					theActor->RemoveSpell(debuffSpell);
+				RE::DebugNotification(std::format("{} is no longer being maintained.", removed.base->GetName()).c_str());
 
-				MAINT::CACHE::SpellToMaintainedSpell.eraseKey(baseSpell);
+				DiscardSpell(maintSpell);
+				if (debuffSpell)
+					DiscardSpell(debuffSpell);
 			}
+			MAINT::CACHE::Store.Update([&](auto& next) {
+				for (const auto& [handle, removed] : toRemove) {
+					if (!next.Spells.Erase(handle))
+						logger::warn("\t{} was already gone from the store", removed.base->GetName());
+				}
+			});
+			if (state->AggregateDebuff)
+				SyncAggregateDebuff(theActor);
+			const auto& remaining = MAINT::CACHE::Store.Read();
 			MAINT::FORMS::GetSingleton().FlstMaintainedSpellToggle->ClearData();
-			for (const auto& [spl, _] : MAINT::CACHE::SpellToMaintainedSpell.GetForwardMap())
+			for (const auto& spl : remaining->Spells.Bases())
 				MAINT::FORMS::GetSingleton().FlstMaintainedSpellToggle->AddForm(spl);
 		}
 
 		auto end = std::chrono::high_resolution_clock::now();
 		std::chrono::duration<double> duration = end - start;
+		Flight.Push({ .other = static_cast<uint32_t>(effectFacts.size()), .value = static_cast<float>(duration.count() * 1000.0),
+			.count = static_cast<uint16_t>(maintainedFacts.size()), .count2 = static_cast<uint16_t>(toRemove.size()), .kind = FLIGHT::Kind::kSweep });
+		if (!anomaly.empty())
+			DumpFlightRecorder(std::format("a maintained spell was removed: {}", anomaly));
 		_runTime += duration.count();
 		_runCount++;
 		if (_runCount == _AVG_WINDOW) {
@@ -544,6 +1138,22 @@ namespace MAINT
 			_runTime = 0.0;
 			_runCount = 0;
 		}
+		return toRemove.size();
+	}
+
+	void ProcessPendingCasts()
+	{
+		auto& queue = MAINT::CastQueue::GetSingleton();
+		bool anyMaintained = false;
+		queue.Drain([&](RE::SpellItem* const& theSpell) {
+			MAINT_ALLOC_REGION(kCast);
+			const auto& thePlayer = RE::PlayerCharacter::GetSingleton();
+			MAINT::MaintainSpell(theSpell, thePlayer);
+			queue.Maintained.fetch_add(1, std::memory_order_relaxed);
+			anyMaintained = true;
+		});
+		if (anyMaintained)
+			MAINT::UpdatePCHook::ResetEffCheckTimer();
 	}
 }
 
@@ -552,20 +1162,27 @@ class SpellCastEventHandler : public RE::BSTEventSink<RE::TESSpellCastEvent>
 public:
 	virtual RE::BSEventNotifyControl ProcessEvent(const RE::TESSpellCastEvent* a_event, RE::BSTEventSource<RE::TESSpellCastEvent>*)
 	{
-		if (a_event == nullptr || a_event->object == nullptr)
+		if (a_event == nullptr)
 			return RE::BSEventNotifyControl::kContinue;
 
-		const auto& theCaster = a_event->object->As<RE::Actor>();
-		if (theCaster != RE::PlayerCharacter::GetSingleton())
-			return RE::BSEventNotifyControl::kContinue;
+		auto& queue = MAINT::CastQueue::GetSingleton();
+		queue.Seen.fetch_add(1, std::memory_order_relaxed);
 
+		// Most cast events come from NPCs, a plain pointer compare rejects them before any cast or lookup. The
+		// player only exists once the game data is loaded, so it can't be cached at plugin load.
+		if (a_event->object.get() != RE::PlayerCharacter::GetSingleton()) {
+			queue.Filtered.fetch_add(1, std::memory_order_relaxed);
+			return RE::BSEventNotifyControl::kContinue;
+		}
 		if (static_cast<short>(MAINT::FORMS::GetSingleton().GlobMaintainModeEnabled->value) == 0)
 			return RE::BSEventNotifyControl::kContinue;
+		MAINT::UpdatePCHook::RequestFastValidation();
 
-		if (const auto& theSpell = RE::TESForm::LookupByID<RE::SpellItem>(a_event->spell)) {
-			MAINT::MaintainSpell(theSpell, theCaster);
-			MAINT::UpdatePCHook::ResetEffCheckTimer();
-		}
+		MAINT_ALLOC_REGION(kCast);
+		MAINT::EventRecorder::GetSingleton().Record([&](auto& trace, auto now) { trace.Cast(now, a_event->spell); });
+		MAINT::Flight.Push({ .subject = a_event->spell, .kind = MAINT::FLIGHT::Kind::kCast });
+		if (const auto& theSpell = queue.Resolve(a_event->spell))
+			queue.Push(theSpell);
 
 		return RE::BSEventNotifyControl::kContinue;
 	}
@@ -582,72 +1199,261 @@ public:
 	}
 };
 
-static void ReadConfiguration()
+// Combat and equipment changes are when maintained effects tend to get dispelled, so validation speeds up.
+class ActivityEventHandler : public RE::BSTEventSink<RE::TESCombatEvent>, public RE::BSTEventSink<RE::TESEquipEvent>
+{
+public:
+	virtual RE::BSEventNotifyControl ProcessEvent(const RE::TESCombatEvent* a_event, RE::BSTEventSource<RE::TESCombatEvent>*)
+	{
+		if (a_event == nullptr || a_event->newState.get() != RE::ACTOR_COMBAT_STATE::kCombat)
+			return RE::BSEventNotifyControl::kContinue;
+		const auto& player = RE::PlayerCharacter::GetSingleton();
+		if (a_event->actor.get() == player || a_event->targetActor.get() == player)
+			MAINT::UpdatePCHook::RequestFastValidation();
+		return RE::BSEventNotifyControl::kContinue;
+	}
+
+	virtual RE::BSEventNotifyControl ProcessEvent(const RE::TESEquipEvent* a_event, RE::BSTEventSource<RE::TESEquipEvent>*)
+	{
+		if (a_event != nullptr && a_event->actor.get() == RE::PlayerCharacter::GetSingleton())
+			MAINT::UpdatePCHook::RequestFastValidation();
+		return RE::BSEventNotifyControl::kContinue;
+	}
+
+	static ActivityEventHandler& GetSingleton()
+	{
+		static ActivityEventHandler singleton;
+		return singleton;
+	}
+	static void Install()
+	{
+		auto& eventProcessor = ActivityEventHandler::GetSingleton();
+		RE::ScriptEventSourceHolder::GetSingleton()->AddEventSink<RE::TESCombatEvent>(&eventProcessor);
+		RE::ScriptEventSourceHolder::GetSingleton()->AddEventSink<RE::TESEquipEvent>(&eventProcessor);
+	}
+};
+
+class MenuEventHandler : public RE::BSTEventSink<RE::MenuOpenCloseEvent>
+{
+public:
+	virtual RE::BSEventNotifyControl ProcessEvent(const RE::MenuOpenCloseEvent* a_event, RE::BSTEventSource<RE::MenuOpenCloseEvent>*)
+	{
+		if (a_event == nullptr)
+			return RE::BSEventNotifyControl::kContinue;
+
+		MAINT::UpdatePCHook::GetScheduler().SetPaused(MAINT::Scheduler::kMenu, RE::UI::GetSingleton()->GameIsPaused());
+		// Whatever became of a load, the game runs again once its loading screen is gone
+		if (!a_event->opening && a_event->menuName == RE::LoadingMenu::MENU_NAME)
+			MAINT::UpdatePCHook::GetScheduler().SetPaused(MAINT::Scheduler::kLoading, false);
+		return RE::BSEventNotifyControl::kContinue;
+	}
+
+	static MenuEventHandler& GetSingleton()
+	{
+		static MenuEventHandler singleton;
+		return singleton;
+	}
+	static void Install()
+	{
+		auto& eventProcessor = MenuEventHandler::GetSingleton();
+		RE::UI::GetSingleton()->AddEventSink<RE::MenuOpenCloseEvent>(&eventProcessor);
+	}
+};
+
+// Maintains every active buff when MaintainAllHotkey goes down outside of menus.
+class HotkeyEventHandler : public RE::BSTEventSink<RE::InputEvent*>
+{
+public:
+	virtual RE::BSEventNotifyControl ProcessEvent(RE::InputEvent* const* a_event, RE::BSTEventSource<RE::InputEvent*>*)
+	{
+		const auto& hotkey = static_cast<std::uint32_t>(MAINT::CONFIG::Current()->MaintainAllHotkey);
+		if (a_event == nullptr || hotkey == 0)
+			return RE::BSEventNotifyControl::kContinue;
+
+		for (auto event = *a_event; event != nullptr; event = event->next) {
+			const auto& button = event->AsButtonEvent();
+			if (button == nullptr || button->GetDevice() != RE::INPUT_DEVICE::kKeyboard || button->GetIDCode() != hotkey || !button->IsDown())
+				continue;
+			if (!RE::UI::GetSingleton()->GameIsPaused())
+				MAINT::RequestMaintainActiveBuffs();
+		}
+		return RE::BSEventNotifyControl::kContinue;
+	}
+
+	static HotkeyEventHandler& GetSingleton()
+	{
+		static HotkeyEventHandler singleton;
+		return singleton;
+	}
+	static void Install()
+	{
+		auto& eventProcessor = HotkeyEventHandler::GetSingleton();
+		RE::BSInputDeviceManager::GetSingleton()->AddEventSink<RE::InputEvent*>(&eventProcessor);
+	}
+};
+
+// MaintainedMagicNG.MaintainActiveBuffs() for scripts. Papyrus has threads of its own, so it only queues the batch.
+static void PapyrusMaintainActiveBuffs(RE::StaticFunctionTag*)
+{
+	MAINT::RequestMaintainActiveBuffs();
+}
+
+static bool RegisterPapyrusFunctions(RE::BSScript::IVirtualMachine* a_vm)
+{
+	a_vm->RegisterFunction("MaintainActiveBuffs", "MaintainedMagicNG", PapyrusMaintainActiveBuffs);
+	return true;
+}
+
+struct ParsedConfiguration
+{
+	MAINT::CONFIG::Settings settings;
+	bool missingDefaults = false;
+};
+
+// Only parses, safe on a worker. Everything with side effects outside the ini is left to ApplyConfiguration.
+static ParsedConfiguration ReadConfiguration()
 {
 	logger::info("Maintained Map @ {}", MAINT::CONFIG::MAP_FILE);
 	logger::info("Maintained Config @ {}", MAINT::CONFIG::CONFIG_FILE);
 
-	static auto const& ini = MAINT::CONFIG::ConfigBase::GetSingleton(MAINT::CONFIG::CONFIG_FILE);
+	static auto const& ini = MAINT::CONFIG::ConfigBase::GetSingleton<MAINT::CONFIG::CONFIG_FILE>();
+	ParsedConfiguration parsed;
+	parsed.settings = MAINT::CONFIG::SCHEMA::Load(ini, parsed.missingDefaults);
+	parsed.settings.CostFormulaOverrides = ini->GetAllKeyValuePairs("COST_FORMULAS");
+	return parsed;
+}
 
-	const std::map<std::string, spdlog::level::level_enum> logMap = {
-		{ "off", spdlog::level::level_enum::off },
-		{ "info", spdlog::level::level_enum::info },
-		{ "debug", spdlog::level::level_enum::debug },
-	};
-	if (!ini->HasKey("CONFIG", "LogLevel")) {
-		ini->SetValue("CONFIG", "LogLevel", "off", "# Options: off, info, debug");
+// On the game thread: writes back missing defaults, sets the log level and publishes the settings.
+static void ApplyConfiguration(ParsedConfiguration const& parsed)
+{
+	if (parsed.missingDefaults) {
+		logger::info("Added missing defaults to config");
+		MAINT::CONFIG::ConfigBase::GetSingleton<MAINT::CONFIG::CONFIG_FILE>()->Save();
 	}
+	spdlog::set_level(parsed.settings.LogLevel);
+	MAINT::CONFIG::SettingsStore::Publish(parsed.settings);
+}
 
-	auto const confLogLevel = ini->GetValue("CONFIG", "LogLevel");
-	logger::info("Set Log Level to {}", confLogLevel);
-	if (auto const& it = logMap.find(confLogLevel); it != logMap.end())
-		spdlog::set_level(it->second);
-	else
-		spdlog::set_level(spdlog::level::level_enum::off);
+// Unless configured, one worker per core the game's main thread leaves over, capped at 4.
+static std::size_t WorkerThreadCount(MAINT::CONFIG::Settings const& settings)
+{
+	if (settings.WorkerThreads > 0)
+		return static_cast<std::size_t>(settings.WorkerThreads);
+	const auto& cores = static_cast<std::size_t>(std::thread::hardware_concurrency());
+	return std::clamp<std::size_t>(cores > 1 ? cores - 1 : 1, 1, 4);
+}
 
-	if (!ini->HasKey("CONFIG", "SilencePersistentSpellFX")) {
-		ini->SetBoolValue("CONFIG", "SilencePersistentSpellFX", false, "# If true, will disable persistent spell visuals on maintained spells. This includes flesh spell FX, the aura of Cloak spells, pretty much everything else.");
-	}
-	MAINT::CONFIG::DoSilenceFX = ini->GetBoolValue("CONFIG", "SilencePersistentSpellFX");
-	logger::info("FX Will {} silenced", MAINT::CONFIG::DoSilenceFX ? "be" : "not be");
+namespace MAINT::CONFIG
+{
+	static std::filesystem::file_time_type LastConfigWrite;
+	static std::atomic<bool> ReloadInFlight{ false };
+	static std::atomic<bool> ReloadPublished{ false };
 
-	if (!ini->HasKey("CONFIG", "CostNeutralDuration")) {
-		ini->SetLongValue("CONFIG", "CostNeutralDuration", 60, "# At this BASE spell duration, maintenance cost will be equal to its casting cost. Shorter spells will be more expensive, longer will be cheaper.\n# Reduce to make maintenance cheaper across the board.\n# Set to 0 to disable all cost scaling and only use the spell's casting cost.");
+	static std::filesystem::file_time_type GetConfigWriteTime()
+	{
+		std::error_code ec;
+		const auto& time = std::filesystem::last_write_time(CONFIG_FILE, ec);
+		return ec ? (std::filesystem::file_time_type::min)() : time;
 	}
-	MAINT::CONFIG::CostBaseDuration = ini->GetLongValue("CONFIG", "CostNeutralDuration");
-	logger::info("CostNeutralDuration is {}", MAINT::CONFIG::CostBaseDuration);
 
-	if (!ini->HasKey("CONFIG", "CostReductionExponent")) {
-		ini->SetDoubleValue("CONFIG", "CostReductionExponent", 0.0, "# Determines the impact of long durations on maintenance cost.\n# If this is set to 2.0 and a spell would last twice as long as CostNeutralDuration, its upkeep cost would be 1/4th compared to leaving this at 0.0\n# 1.0 would halve the cost. -1.0 would double it instead.\n# 0.0 = Disabled");
+	void PollForChanges()
+	{
+		if (ReloadInFlight.load(std::memory_order_acquire))
+			return;
+		const auto& writeTime = GetConfigWriteTime();
+		if (writeTime == LastConfigWrite)
+			return;
+
+		LastConfigWrite = writeTime;
+		ReloadInFlight.store(true, std::memory_order_release);
+		// Read and parsed on a worker, published on the game thread between two frames
+		JOBS::Pool::GetSingleton().Submit([ini = ConfigBase::GetSingleton<CONFIG_FILE>()]() {
+			logger::info("Config changed, reloading");
+			ini->Reload();
+			return ReadConfiguration();
+		}).Then([](ParsedConfiguration const& parsed) {
+			ApplyConfiguration(parsed);
+			const auto& settings = Current();
+			EventRecorder::GetSingleton().Open(settings->EventTraceFile);
+			Timeline::GetSingleton().Open(settings->TimelineFile, static_cast<std::size_t>(settings->TimelineBufferEvents));
+			// Adding missing defaults touches the file again, don't treat that as another edit
+			LastConfigWrite = GetConfigWriteTime();
+			ReloadPublished.store(true, std::memory_order_release);
+			ReloadInFlight.store(false, std::memory_order_release);
+		}, JOBS::Affinity::kMain);
 	}
-	MAINT::CONFIG::CostReductionExponent = static_cast<float>(ini->GetDoubleValue("CONFIG", "CostReductionExponent"));
-	logger::info("CostReductionExponent is {}", MAINT::CONFIG::CostReductionExponent);
 
-	ini->Save();
+	bool ConsumeReload()
+	{
+		return ReloadPublished.exchange(false, std::memory_order_acq_rel);
+	}
 }
 
 void OnInit(SKSE::MessagingInterface::Message* const a_msg)
 {
+	MAINT::EventRecorder::GetSingleton().Record([&](auto& trace, auto now) {
+		const auto& name = a_msg->dataLen > 0 && a_msg->data ? std::string_view(static_cast<char*>(a_msg->data), a_msg->dataLen) : std::string_view();
+		trace.Message(now, a_msg->type, a_msg->type == SKSE::MessagingInterface::kPreLoadGame || a_msg->type == SKSE::MessagingInterface::kSaveGame ? name : std::string_view());
+	});
+	MAINT::EventRecorder::GetSingleton().Flush();
+
 	switch (a_msg->type) {
 	case SKSE::MessagingInterface::kDataLoaded:
-		ReadConfiguration();
+		MenuEventHandler::Install();
+		HotkeyEventHandler::Install();
+		ApplyConfiguration(ReadConfiguration());
+		// Answered on the endpoint's thread, the dump itself has to look up names on the main thread
+		MAINT::StatsEndpoint.AddCommand("dump", []() {
+			MAINT::JOBS::Pool::GetSingleton().Submit([]() { MAINT::DumpFlightRecorder("requested over the telemetry endpoint", true); }, MAINT::JOBS::Affinity::kMain);
+			return std::string("{\"dump\":\"queued\"}\n");
+		});
+		{
+			const auto& settings = MAINT::CONFIG::Current();
+			MAINT::JOBS::Pool::GetSingleton().Start(WorkerThreadCount(*settings));
+			MAINT::EventRecorder::GetSingleton().Open(settings->EventTraceFile);
+			MAINT::Timeline::GetSingleton().Open(settings->TimelineFile, static_cast<std::size_t>(settings->TimelineBufferEvents));
+			MAINT::UpdatePCHook::ApplySettings(*settings);
+			MAINT::CompileRules(*settings);
+			MAINT::CompileCostFormulas(*settings);
+		}
+		MAINT::CONFIG::LastConfigWrite = MAINT::CONFIG::GetConfigWriteTime();
+		// Parsed while the player sits in the main menu, the load handler only binds forms
+		MAINT::MappingPreloader::GetSingleton().Start(MAINT::CONFIG::ConfigBase::GetSingleton<MAINT::CONFIG::MAP_FILE>());
 		break;
 	case SKSE::MessagingInterface::kPreLoadGame:
 	case SKSE::MessagingInterface::kNewGame:
+		MAINT::Flight.Push({ .kind = MAINT::FLIGHT::Kind::kMessage,
+			.detail = static_cast<uint8_t>(a_msg->type == SKSE::MessagingInterface::kPreLoadGame ? MAINT::FLIGHT::Message::kPreLoad : MAINT::FLIGHT::Message::kNewGame) });
+		// Validation must not run against a half loaded player. kPostLoadGame lifts the pause again whether the
+		// load succeeded or not, a new game or the loading menu closing lift it as well.
+		MAINT::UpdatePCHook::GetScheduler().SetPaused(MAINT::Scheduler::kLoading, a_msg->type == SKSE::MessagingInterface::kPreLoadGame);
 		if (a_msg->dataLen > 0) {
+			MAINT_ALLOC_REGION(kLoad);
 			char* charData = static_cast<char*>(a_msg->data);
 			std::string saveFile(charData, a_msg->dataLen);
 			logger::info("Load : {}", saveFile);
+			const auto& start = std::chrono::steady_clock::now();
+			const auto& mapping = MAINT::MappingPreloader::GetSingleton().Take(MAINT::CONFIG::ConfigBase::GetSingleton<MAINT::CONFIG::MAP_FILE>(), saveFile);
 			MAINT::Purge();
-			MAINT::FORMS::GetSingleton().LoadOffset(MAINT::CONFIG::ConfigBase::GetSingleton(MAINT::CONFIG::MAP_FILE), saveFile);
-			MAINT::LoadSavegameMapping(saveFile);
+			MAINT::FORMS::GetSingleton().LoadAllocation(mapping);
+			MAINT::LoadSavegameMapping(saveFile, mapping);
+			logger::info("Load handler took {:.2f}ms", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
 		}
 		break;
 	case SKSE::MessagingInterface::kPostLoadGame:
-		MAINT::BuildActiveSpellsCache();
+		{
+			MAINT_ALLOC_REGION(kLoad);
+			MAINT::Flight.Push({ .kind = MAINT::FLIGHT::Kind::kMessage, .detail = static_cast<uint8_t>(MAINT::FLIGHT::Message::kPostLoad) });
+			if (a_msg->data && !*static_cast<bool*>(a_msg->data))
+				logger::warn("Savegame failed to load");
+			MAINT::BuildActiveSpellsCache();
+			MAINT::UpdatePCHook::GetScheduler().SetPaused(MAINT::Scheduler::kLoading, false);
+		}
 		break;
 	case SKSE::MessagingInterface::kSaveGame:
+		MAINT::Flight.Push({ .kind = MAINT::FLIGHT::Kind::kMessage, .detail = static_cast<uint8_t>(MAINT::FLIGHT::Message::kSave) });
 		if (a_msg->dataLen > 0) {
+			MAINT_ALLOC_REGION(kSave);
 			char* charData = static_cast<char*>(a_msg->data);
 			std::string saveFile(charData, a_msg->dataLen);
 			std::string saveFileWithExt = std::format("{}.ess", saveFile);
@@ -663,6 +1469,9 @@ void OnInit(SKSE::MessagingInterface::Message* const a_msg)
 bool Load()
 {
 	SpellCastEventHandler::Install();
+	ActivityEventHandler::Install();
 	MAINT::UpdatePCHook::Install();
+	if (!SKSE::GetPapyrusInterface()->Register(RegisterPapyrusFunctions))
+		logger::warn("Could not register Papyrus functions");
 	return true;
 }
\ No newline at end of file
@@ -1,13 +1,35 @@
 #pragma once
 
-#include "Bimap.h"
-#include <SimpleIni.h>
+#include "AllocTracker.h"
+#include "Config.h"
+#include "EventRecorder.h"
+#include "FlightRecorder.h"
+#include "FormIDAllocator.h"
+#include "Formula.h"
+#include "Jobs.h"
+#include "Rules.h"
+#include "SavegameMapping.h"
+#include "Scheduler.h"
+#include "SlotTable.h"
+#include "SnapshotCell.h"
+#include "SpellClone.h"
+#include "Telemetry.h"
+#include "Timeline.h"
+#include "Validation.h"
 
 namespace MAINT
 {
-	void ForceMaintainedSpellUpdate(RE::Actor* const&);
+	std::size_t ForceMaintainedSpellUpdate(RE::Actor* const&);
 	void AwardPlayerExperience(RE::PlayerCharacter* const& player);
 	void CheckUpkeepValidity(RE::Actor* const&);
+	void RecomputeUpkeepCosts(RE::Actor* const&);
+	void ProcessPendingCasts();
+	void CompileRules(CONFIG::Settings const& settings);
+	void CompileCostFormulas(CONFIG::Settings const& settings);
+	void ApplyUpkeepMode(RE::Actor* const& theActor);
+	void DumpFlightRecorder(std::string_view reason, bool force = false);
+	std::size_t MaintainActiveBuffs(RE::Actor* const& theCaster);
+	void RequestMaintainActiveBuffs();
 
 	const auto lexical_cast_hex_to_formid(const std::string& hex_string)
 	{
@@ -23,211 +45,90 @@ namespace MAINT
 		return static_cast<RE::FormID>(result);
 	}
 
-	template <typename Data>
-	class ConcurrentQueue
-	{
-	private:
-		std::queue<Data> theQueue;
-		mutable std::mutex theMutex;
+	static_assert(RULES::IndexOf(RULES::ARCHETYPES, "VampireLord") == static_cast<std::uint8_t>(RE::EffectSetting::Archetype::kVampireLord));
+	static_assert(RULES::IndexOf(RULES::DELIVERIES, "TargetLocation") == static_cast<std::uint8_t>(RE::MagicSystem::Delivery::kTargetLocation));
+	static_assert(RULES::IndexOf(RULES::CASTING_TYPES, "Scroll") == static_cast<std::uint8_t>(RE::MagicSystem::CastingType::kScroll));
 
-	public:
-		void push(const Data& data)
-		{
-			std::lock_guard<std::mutex> guard(theMutex);
-			theQueue.push(data);
-		}
-
-		bool empty() const
-		{
-			std::lock_guard<std::mutex> guard(theMutex);
-			return theQueue.empty();
-		}
+	// Compiled from the [RULES] config at kDataLoaded and on every reload. Only used on the main thread.
+	inline RULES::RuleSet<RE::BGSKeyword*> Rules;
 
-		Data& front()
-		{
-			std::lock_guard<std::mutex> guard(theMutex);
-			return theQueue.front();
-		}
+	// Compiled upkeep cost formulas. The archetype of a spell's first effect picks its formula, then its school,
+	// then the default in slot 0. Only used on the main thread.
+	struct CostModel
+	{
+		std::vector<FORMULA::Program> Programs;
+		std::array<std::uint8_t, RULES::ARCHETYPES.size()> ByArchetype{};
+		std::array<std::uint8_t, 5> BySchool{};
 
-		Data const& front() const
-		{
-			std::lock_guard<std::mutex> guard(theMutex);
-			return theQueue.front();
-		}
+		std::size_t IndexFor(RE::SpellItem* const& baseSpell) const;
 
-		void pop()
+		bool Uses(FORMULA::Variable variable) const
 		{
-			std::lock_guard<std::mutex> guard(theMutex);
-			theQueue.pop();
+			return std::any_of(Programs.begin(), Programs.end(), [&](auto const& program) { return program.Uses(variable); });
 		}
 	};
+	inline CostModel Costs;
 
-	namespace CONFIG
-	{
-		std::string const& MAP_FILE		= "Data/SKSE/Plugins/MaintainedMagicNG.ini";
-		std::string const& CONFIG_FILE	= "Data/SKSE/Plugins/MaintainedMagicNG.Config.ini";
-		inline bool DoSilenceFX;
-		inline long CostBaseDuration;
-		inline float CostReductionExponent; 
-		class ConfigBase
-		{
-		private:
-			static inline std::map<std::string, ConfigBase*> MultiConfigMap;
+	// Opened and published to on the main thread only, see UpdatePCHook.
+	inline TELEMETRY::Endpoint StatsEndpoint;
 
-			CSimpleIniA Ini;
-			std::string IniPath;
-			ConfigBase(std::string const& iniPath) :
-				IniPath(iniPath)
-			{
-				Ini.SetUnicode();
-				Ini.LoadFile(iniPath.c_str());
-			}
-
-		public:
-			static ConfigBase* GetSingleton(std::string const& iniPath)
-			{
-				if (!MultiConfigMap.contains(iniPath)) {
-					logger::info("Load INI: {}", iniPath);
-					ConfigBase* instance = new ConfigBase(iniPath);
-					MultiConfigMap[iniPath] = instance;
-				}
-				auto const& ret = MultiConfigMap.at(iniPath);
-				return ret;
-			}
-
-			bool HasKey(const std::string& section, const std::string& key)
-			{
-				return Ini.KeyExists(section.c_str(), key.c_str());
-			}
-
-			bool HasSection(const std::string& section)
-			{
-				return Ini.SectionExists(section.c_str());
-			}
-
-			const std::vector<std::pair<std::string, std::string>> GetAllKeyValuePairs(const std::string& section) const
-			{
-				std::vector<std::pair<std::string, std::string>> ret;
-				CSimpleIniA::TNamesDepend keys;
-				Ini.GetAllKeys(section.c_str(), keys);
-				for (auto& key : keys) {
-					auto val = Ini.GetValue(section.c_str(), key.pItem);
-					ret.push_back({ key.pItem, val });
-				}
-
-				return ret;
-			}
-
-			void DeleteSection(const std::string& section)
-			{
-				Ini.Delete(section.c_str(), nullptr, true);
-			}
-
-			void DeleteKey(const std::string& section, const std::string& key)
-			{
-				Ini.Delete(section.c_str(), key.c_str());
-			}
-
-			std::string GetValue(const std::string& section, const std::string& key)
-			{
-				return Ini.GetValue(section.c_str(), key.c_str());
-			}
-
-			long GetLongValue(const std::string& section, const std::string& key)
-			{
-				return Ini.GetLongValue(section.c_str(), key.c_str());
-			}
-
-			bool GetBoolValue(const std::string& section, const std::string& key)
-			{
-				return Ini.GetBoolValue(section.c_str(), key.c_str());
-			}
-
-			double GetDoubleValue(const std::string& section, const std::string& key)
-			{
-				return Ini.GetDoubleValue(section.c_str(), key.c_str());
-			}
-
-			void SetValue(const std::string& section, const std::string& key, const std::string& value, const std::string& comment = std::string())
-			{
-				Ini.SetValue(section.c_str(), key.c_str(), value.c_str(), comment.length() > 0 ? comment.c_str() : (const char*)0);
-			}
-
-			void SetBoolValue(const std::string& section, const std::string& key, const bool value, const std::string& comment = std::string())
-			{
-				Ini.SetBoolValue(section.c_str(), key.c_str(), value, comment.length() > 0 ? comment.c_str() : (const char*)0);
-			}
-
-			void SetLongValue(const std::string& section, const std::string& key, const long value, const std::string& comment = std::string())
-			{
-				Ini.SetLongValue(section.c_str(), key.c_str(), value, comment.length() > 0 ? comment.c_str() : (const char*)0);
-			}
-
-			void SetDoubleValue(const std::string& section, const std::string& key, const double value, const std::string& comment = std::string())
-			{
-				Ini.SetDoubleValue(section.c_str(), key.c_str(), value, comment.length() > 0 ? comment.c_str() : (const char*)0);
-			}
-
-			void Save()
-			{
-				Ini.SaveFile(IniPath.c_str());
-			}
-
-			ConfigBase(ConfigBase const&) = delete;
-			void operator=(ConfigBase const&) = delete;
-		};
-	}
+	// Written to from any thread, dumped by DumpFlightRecorder.
+	inline FLIGHT::Recorder<4096> Flight;
 
 	namespace CACHE
 	{
 		typedef RE::SpellItem InfiniteSpell;
 		typedef RE::SpellItem DebuffSpell;
-		typedef std::pair<InfiniteSpell*, DebuffSpell*> MaintainedSpell;
+		typedef SlotTable<RE::SpellItem, RE::ActorValue> SpellTable;
 
-		inline BiMap<RE::SpellItem*, MaintainedSpell> SpellToMaintainedSpell;
+		struct MaintainedState
+		{
+			// One row per maintained spell: its base, maintained and debuff spells, the upkeep cost whichever
+			// debuff carries it, the effect duration it was cast with (used when repricing) and its skill.
+			SpellTable Spells;
+			// With AggregateUpkeepDebuff the maintained spells have no debuff of their own, this one carries
+			// the sum of their upkeep instead.
+			DebuffSpell* AggregateDebuff = nullptr;
+		};
+
+		// Readers get an immutable snapshot without locking, writers publish a modified copy.
+		inline SnapshotCell<MaintainedState> Store;
+
+		// Restored from the savegame mapping at kPreLoadGame, claimed or dropped by BuildActiveSpellsCache.
+		struct PendingMapping
+		{
+			RE::SpellItem* base;
+			InfiniteSpell* maintained;
+			DebuffSpell* debuff;  // null for spells saved with the aggregate debuff
+			float cost;           // 0 if the mapping predates stored costs
+			float duration;       // 0 if the mapping predates stored durations
+		};
+		inline std::vector<PendingMapping> PendingMappings;
+		inline DebuffSpell* PendingAggregate = nullptr;
 	}
 
 	class FORMS
 	{
 	public:
-		static constexpr RE::FormID FORMID_OFFSET_BASE = 0xFF03F000;
-		RE::FormID CurrentOffset;
-
-		void SetOffset(RE::FormID offset)
-		{
-			CurrentOffset = offset;
-		}
-		void LoadOffset(const CONFIG::ConfigBase* config, const std::string& saveFile)
+		// Rebuilds the FormID occupancy for a savegame: IDs persisted in its ALLOC section, plus every ID its
+		// mapping refers to, for mappings written before the allocator existed.
+		void LoadAllocation(const PreparedMapping& mapping)
 		{
-			constexpr auto getLargestFormIDFromPair = [](const std::string& part) -> RE::FormID {
-				std::size_t tildePos = part.find("~");
-
-				if (tildePos == std::string::npos)
-					return 0x0;
-				try {
-					auto leftID = lexical_cast_hex_to_formid(part.substr(0, tildePos));
-					auto rightID = lexical_cast_hex_to_formid(part.substr(tildePos + 1));
-					return leftID > rightID ? leftID : rightID;
-				} catch (...) {
-					return 0x0;
-				}
-			};
-
-			RE::FormID off = 0x0;
-			for (const auto& [k, v] : config->GetAllKeyValuePairs(std::format("MAP:{}", saveFile))) {
-				auto cur = getLargestFormIDFromPair(v);
-				if (cur > off)
-					off = cur;
+			auto& allocator = FormIDAllocator::GetSingleton();
+			allocator.Reset();
+			allocator.Deserialize(mapping.allocation);
+			for (auto const& spell : mapping.spells) {
+				allocator.Claim(spell.maintained);
+				allocator.Claim(spell.debuff);
 			}
-			off &= ~FORMID_OFFSET_BASE;
-			CurrentOffset = off;
-			logger::info("Local OFFSET: 0x{:08X}", CurrentOffset);
-			logger::info("Global OFFSET: 0x{:08X}", FORMID_OFFSET_BASE);
+			allocator.Claim(mapping.aggregate);
+			if (const auto& collisions = allocator.ScanForCollisions(); collisions > 0)
+				logger::warn("{} FormIDs in 0x{:08X} are claimed by other forms", collisions, FormIDAllocator::FORMID_BASE);
+			logger::info("FormIDs in use: {}", allocator.Count());
 		}
 		RE::FormID NextFormID() const
 		{
-			static RE::FormID current = 0;
-			return FORMID_OFFSET_BASE + (++current) + CurrentOffset;
+			return FormIDAllocator::GetSingleton().Allocate();
 		}
 		static FORMS& GetSingleton()
 		{
@@ -254,6 +155,167 @@ namespace MAINT
 		FORMS& operator=(const FORMS&) = delete;
 	};
 
+	class FXSuppressionRegistry
+	{
+	public:
+		using Flag = RE::EffectSetting::EffectSettingData::Flag;
+
+		static FXSuppressionRegistry& GetSingleton()
+		{
+			static FXSuppressionRegistry instance;
+			return instance;
+		}
+
+		// Clears kFXPersist on every given base effect. The original flag state is captured on the first
+		// suppression of an effect, later ones only bump its refcount. Each suppression is released once by
+		// ReleasePending. Returns how many of the effects have their FX suppressed.
+		std::size_t Suppress(const std::vector<RE::EffectSetting*>& effects)
+		{
+			std::size_t count = 0;
+			std::lock_guard<std::mutex> guard(theMutex);
+			for (auto const& setting : effects) {
+				auto const& [it, inserted] = Suppressed.try_emplace(setting, Entry{ setting->data.flags.any(Flag::kFXPersist), 0 });
+				if (inserted)
+					setting->data.flags.reset(Flag::kFXPersist);
+				++it->second.refCount;
+				Pending.push_back(setting);
+				if (it->second.hadFXPersist)
+					++count;
+			}
+			if (!effects.empty())
+				HasPending.store(true, std::memory_order_release);
+			return count;
+		}
+
+		// Releases every suppression made since the last call. An effect gets its original flag back once the
+		// last suppression holding it is released.
+		void ReleasePending()
+		{
+			if (!HasPending.exchange(false, std::memory_order_acq_rel))
+				return;
+			std::lock_guard<std::mutex> guard(theMutex);
+			std::size_t restored = 0;
+			for (auto const& setting : Pending) {
+				const auto& it = Suppressed.find(setting);
+				if (it == Suppressed.end() || --it->second.refCount > 0)
+					continue;
+				if (it->second.hadFXPersist) {
+					setting->data.flags.set(Flag::kFXPersist);
+					++restored;
+				}
+				Suppressed.erase(it);
+			}
+			logger::debug("Released {} FX suppressions, restored {} effects", Pending.size(), restored);
+			Pending.clear();
+		}
+
+	private:
+		struct Entry
+		{
+			bool hadFXPersist;
+			uint32_t refCount;
+		};
+
+		FXSuppressionRegistry() {}
+		FXSuppressionRegistry(const FXSuppressionRegistry&) = delete;
+		FXSuppressionRegistry& operator=(const FXSuppressionRegistry&) = delete;
+
+		std::unordered_map<RE::EffectSetting*, Entry> Suppressed;
+		std::vector<RE::EffectSetting*> Pending;
+		std::atomic<bool> HasPending{ false };
+		mutable std::mutex theMutex;
+	};
+
+	// Player casts picked up by the event sink are queued here and maintained once per frame from UpdatePCHook,
+	// so dual casts and cast-repeat of the same spell within one frame result in a single MaintainSpell.
+	class CastQueue
+	{
+	public:
+		static CastQueue& GetSingleton()
+		{
+			static CastQueue instance;
+			return instance;
+		}
+
+		// FormID lookups of cast spells are cached until the next load.
+		RE::SpellItem* Resolve(RE::FormID const& formID)
+		{
+			std::lock_guard<std::mutex> guard(theMutex);
+			if (auto const& it = SpellCache.find(formID); it != SpellCache.end())
+				return it->second;
+			return SpellCache.emplace(formID, RE::TESForm::LookupByID<RE::SpellItem>(formID)).first->second;
+		}
+
+		// Returns false if the spell is already waiting to be maintained this frame.
+		bool Push(RE::SpellItem* const& spell)
+		{
+			std::lock_guard<std::mutex> guard(theMutex);
+			if (std::find(Pending.begin(), Pending.end(), spell) != Pending.end()) {
+				Coalesced.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			Pending.push_back(spell);
+			HasPending.store(true, std::memory_order_release);
+			return true;
+		}
+
+		template <class Func>
+		void Drain(Func&& func)
+		{
+			if (!HasPending.load(std::memory_order_acquire))
+				return;
+			{
+				std::lock_guard<std::mutex> guard(theMutex);
+				std::swap(Pending, Draining);
+				HasPending.store(false, std::memory_order_relaxed);
+			}
+			for (auto const& spell : Draining)
+				func(spell);
+			Draining.clear();
+		}
+
+		std::size_t PendingCount() const
+		{
+			std::lock_guard<std::mutex> guard(theMutex);
+			return Pending.size();
+		}
+
+		void Clear()
+		{
+			std::lock_guard<std::mutex> guard(theMutex);
+			Pending.clear();
+			SpellCache.clear();
+			HasPending.store(false, std::memory_order_relaxed);
+		}
+
+		void LogStatistics()
+		{
+			const auto& seen = Seen.load(std::memory_order_relaxed);
+			if (seen == LastLoggedSeen)
+				return;
+			LastLoggedSeen = seen;
+			logger::debug("Cast events: {} seen, {} not from the player, {} coalesced, {} maintained",
+				seen, Filtered.load(std::memory_order_relaxed), Coalesced.load(std::memory_order_relaxed), Maintained.load(std::memory_order_relaxed));
+		}
+
+		std::atomic<uint64_t> Seen{ 0 };
+		std::atomic<uint64_t> Filtered{ 0 };
+		std::atomic<uint64_t> Coalesced{ 0 };
+		std::atomic<uint64_t> Maintained{ 0 };
+
+	private:
+		CastQueue() {}
+		CastQueue(const CastQueue&) = delete;
+		CastQueue& operator=(const CastQueue&) = delete;
+
+		std::unordered_map<RE::FormID, RE::SpellItem*> SpellCache;
+		std::vector<RE::SpellItem*> Pending;
+		std::vector<RE::SpellItem*> Draining;
+		std::atomic<bool> HasPending{ false };
+		uint64_t LastLoggedSeen = 0;
+		mutable std::mutex theMutex;
+	};
+
 	class UpdatePCHook
 	{
 	public:
@@ -261,49 +323,172 @@ namespace MAINT
 		{
 			REL::Relocation<std::uintptr_t> pcVTable{ RE::VTABLE_PlayerCharacter[0] };
 			UpdatePC = pcVTable.write_vfunc(0xAD, UpdatePCMod);
+			RegisterTasks();
 		}
 
 		static void ResetEffCheckTimer()
 		{
-			TimerActiveEffCheck = 0.0f;
+			RequestFastValidation();
+			TaskScheduler.Restart(ValidationTask);
+		}
+
+		// Safe to call from any thread, the validation interval drops back to its minimum on the next frame.
+		static void RequestFastValidation()
+		{
+			FastValidationRequested.store(true, std::memory_order_relaxed);
+		}
+
+		static float GetValidationInterval()
+		{
+			return EffectiveValidationInterval.load(std::memory_order_relaxed);
 		}
 
-		static void PushFXRestore(RE::Effect* const& eff)
+		static void ApplySettings(CONFIG::Settings const& settings)
 		{
-			EffectRestorationQueue.push(eff);
-			ResetEffCheckTimer();
+			TaskScheduler.SetJitter(settings.TaskJitter);
+			SetValidationInterval(settings.ValidationInterval);
+			TaskScheduler.SetInterval(ExperienceTask, settings.ExperienceInterval);
+			if (settings.TelemetryEndpoint != StatsEndpoint.GetPath()) {
+				std::string error;
+				if (!StatsEndpoint.Open(settings.TelemetryEndpoint, error))
+					logger::error("Failed to open telemetry endpoint {}: {}", settings.TelemetryEndpoint, error);
+				else if (StatsEndpoint.IsOpen())
+					logger::info("Serving statistics at {}", settings.TelemetryEndpoint);
+			}
+		}
+
+		static Scheduler& GetScheduler()
+		{
+			return TaskScheduler;
 		}
 
 	private:
-		UpdatePCHook()
+		UpdatePCHook() {}
+
+		static void RegisterTasks()
 		{
-			TimerActiveEffCheck = TimerExperienceAward = 0.0f;
+			auto const& settings = CONFIG::Current();
+			TaskScheduler.SetJitter(settings->TaskJitter);
+			ValidationTask = TaskScheduler.Schedule("Validation", settings->ValidationInterval, []() {
+				MAINT_ALLOC_REGION(kValidation);
+				const auto& start = std::chrono::steady_clock::now();
+				auto const& pc = RE::PlayerCharacter::GetSingleton();
+				{
+					MAINT_ALLOC_REGION(kReload);
+					MAINT::CONFIG::PollForChanges();
+					if (MAINT::CONFIG::ConsumeReload()) {
+						const auto& settings = MAINT::CONFIG::Current();
+						ApplySettings(*settings);
+						MAINT::CompileRules(*settings);
+						MAINT::CompileCostFormulas(*settings);
+						MAINT::ApplyUpkeepMode(pc);
+						MAINT::RecomputeUpkeepCosts(pc);
+					}
+				}
+				const auto& removed = MAINT::ForceMaintainedSpellUpdate(pc);
+				if (removed > 0 && Costs.Uses(FORMULA::kCount))
+					MAINT::RecomputeUpkeepCosts(pc);
+				MAINT::CheckUpkeepValidity(pc);
+				FXSuppressionRegistry::GetSingleton().ReleasePending();
+
+				// Back off while consecutive sweeps see the same state, stay fast while spells come and go
+				static uint64_t lastGeneration = 0;
+				const auto& generation = MAINT::CACHE::Store.Read().Generation();
+				const auto& changed = removed > 0 || generation != lastGeneration;
+				lastGeneration = generation;
+				auto const& current = CONFIG::Current();
+				const auto backedOff = (std::min)(GetValidationInterval() * 2.0f, (std::max)(current->ValidationInterval, current->ValidationIntervalMax));
+				SetValidationInterval(changed ? current->ValidationInterval : backedOff);
+
+				const auto& now = std::chrono::steady_clock::now();
+				if (removed > 0)
+					RecentRemovals.emplace_back(now, removed);
+				LastValidationMs = std::chrono::duration<float, std::milli>(now - start).count();
+				MaxValidationMs = (std::max)(MaxValidationMs, LastValidationMs);
+			});
+			EffectiveValidationInterval.store(settings->ValidationInterval, std::memory_order_relaxed);
+			ExperienceTask = TaskScheduler.Schedule("Experience", settings->ExperienceInterval, []() {
+				MAINT::AwardPlayerExperience(RE::PlayerCharacter::GetSingleton());
+			});
+			TaskScheduler.Schedule("CastStatistics", 60.0f, []() {
+				CastQueue::GetSingleton().LogStatistics();
+			});
+			TaskScheduler.Schedule("Telemetry", 1.0f, []() {
+				if (StatsEndpoint.IsOpen())
+					PublishTelemetry();
+			});
+			TaskScheduler.Schedule("TimelineFlush", 1.0f, []() {
+				Timeline::GetSingleton().Flush();
+			});
+#ifdef MAINT_ALLOC_TRACKING
+			TaskScheduler.Schedule("AllocationReport", 60.0f, []() {
+				ALLOC::Report();
+			});
+#endif
 		}
 
 		static void UpdatePCMod(RE::PlayerCharacter* pc, float delta)
 		{
+			MAINT_TIMELINE_SCOPE("UpdatePCMod");
 			UpdatePC(pc, delta);
-			TimerActiveEffCheck += delta;
-			TimerExperienceAward += delta;
-			if (TimerActiveEffCheck >= 2.50f) {
-				MAINT::ForceMaintainedSpellUpdate(pc);
-				MAINT::CheckUpkeepValidity(pc);
-				while (!EffectRestorationQueue.empty()) {
-					EffectRestorationQueue.front()->baseEffect->data.flags.set(RE::EffectSetting::EffectSettingData::Flag::kFXPersist);
-					EffectRestorationQueue.pop();
-				}
-				TimerActiveEffCheck = 0.0f;
-			}
-			if (TimerExperienceAward >= 300) {
-				MAINT::AwardPlayerExperience(pc);
-				TimerExperienceAward = 0.0f;
-			}
+			EventRecorder::GetSingleton().Record([&](auto& trace, auto now) { trace.Tick(now, delta); });
+			if (FastValidationRequested.load(std::memory_order_relaxed) && FastValidationRequested.exchange(false, std::memory_order_relaxed))
+				SetValidationInterval(CONFIG::Current()->ValidationInterval);
+			MAINT::ProcessPendingCasts();
+			JOBS::Pool::GetSingleton().DrainMain();
+			TaskScheduler.Advance(delta);
+		}
+
+		static void SetValidationInterval(float interval)
+		{
+			if (interval == GetValidationInterval())
+				return;
+			logger::debug("Validation interval is now {}s", interval);
+			EffectiveValidationInterval.store(interval, std::memory_order_relaxed);
+			TaskScheduler.SetInterval(ValidationTask, interval);
+		}
+
+		// Taken on the game thread, the endpoint's thread only ever sees the published copy
+		static void PublishTelemetry()
+		{
+			const auto& now = std::chrono::steady_clock::now();
+			while (!RecentRemovals.empty() && now - RecentRemovals.front().first > std::chrono::minutes(1))
+				RecentRemovals.pop_front();
+
+			TELEMETRY::Snapshot snapshot;
+			const auto& state = CACHE::Store.Read();
+			for (const auto& cost : state->Spells.Costs())
+				snapshot.totalDrain += cost;
+			snapshot.maintained = static_cast<std::uint32_t>(state->Spells.size());
+			snapshot.validationInterval = GetValidationInterval();
+			snapshot.lastValidationMs = LastValidationMs;
+			snapshot.maxValidationMs = MaxValidationMs;
+			for (auto const& [_, count] : RecentRemovals)
+				snapshot.removalsLastMinute += static_cast<std::uint32_t>(count);
+
+			auto& casts = CastQueue::GetSingleton();
+			snapshot.pendingCasts = static_cast<std::uint32_t>(casts.PendingCount());
+			snapshot.castsSeen = casts.Seen.load(std::memory_order_relaxed);
+			snapshot.castsFiltered = casts.Filtered.load(std::memory_order_relaxed);
+			snapshot.castsCoalesced = casts.Coalesced.load(std::memory_order_relaxed);
+			snapshot.castsMaintained = casts.Maintained.load(std::memory_order_relaxed);
+			const auto& mapping = MappingJournal::GetSingleton().GetCounters();
+			snapshot.mappingSaves = mapping.saves;
+			snapshot.mappingSkipped = mapping.skipped;
+			snapshot.mappingAliased = mapping.aliased;
+			snapshot.mappingFileWrites = mapping.fileWrites;
+			StatsEndpoint.Publish(snapshot);
 		}
 
 		static inline REL::Relocation<decltype(UpdatePCMod)> UpdatePC;
 
-		static inline std::atomic<float> TimerActiveEffCheck;
-		static inline std::atomic<float> TimerExperienceAward;
-		static inline ConcurrentQueue<RE::Effect*> EffectRestorationQueue;
+		static inline Scheduler TaskScheduler;
+		static inline Scheduler::TaskID ValidationTask = Scheduler::INVALID_TASK;
+		static inline Scheduler::TaskID ExperienceTask = Scheduler::INVALID_TASK;
+		static inline std::atomic<float> EffectiveValidationInterval{ 0.0f };
+		static inline std::atomic<bool> FastValidationRequested{ false };
+		static inline float LastValidationMs = 0.0f;
+		static inline float MaxValidationMs = 0.0f;
+		static inline std::deque<std::pair<std::chrono::steady_clock::time_point, std::size_t>> RecentRemovals;
 	};
 }
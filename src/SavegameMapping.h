@@ -0,0 +1,416 @@
+#pragma once
+
+// Parsed form of the per-save sections in the map file. Everything here is plain data, so the sections can
+// be read and parsed on a worker thread while the game sits in the main menu, and a load only has to bind
+// the prepared entries to forms.
+//
+// A save whose content matches the one written last doesn't rewrite anything: the same save is skipped, another
+// one only gets "Alias = <save>" in its ALLOC section. Aliased sections are copied out before their target changes.
+
+#include "Config.h"
+#include "Jobs.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+namespace MAINT
+{
+	// One line of a MAP:<save> section, "Plugin.esp~0x00012FCD = 0xFF03F000~0xFF03F001~42~120". The debuff is 0x0
+	// for spells saved with the aggregate debuff, the upkeep cost and effect duration are missing in mappings written
+	// before they were stored.
+	struct MappedSpell
+	{
+		std::string plugin;
+		RE::FormID localFormID;
+		RE::FormID maintained;
+		RE::FormID debuff;
+		float cost = 0.0f;
+		float duration = 0.0f;
+	};
+
+	struct PreparedMapping
+	{
+		std::vector<MappedSpell> spells;
+		// "Used" and "Aggregate" of the ALLOC:<save> section
+		std::string allocation;
+		RE::FormID aggregate = 0x0;
+	};
+
+	// "0x0001ABCD" to a FormID, 0x0 if malformed.
+	inline RE::FormID ParseHexFormID(std::string_view hex)
+	{
+		if (!hex.starts_with("0x"))
+			return 0x0;
+		hex.remove_prefix(2);
+		RE::FormID ret = 0x0;
+		auto const& [ptr, ec] = std::from_chars(hex.data(), hex.data() + hex.size(), ret, 16);
+		return ec == std::errc() && ptr == hex.data() + hex.size() ? ret : 0x0;
+	}
+
+	// Aliases always point at a save with sections of its own, the limit only guards against hand edited files.
+	inline constexpr int MAX_ALIAS_DEPTH = 4;
+
+	inline PreparedMapping ParseMapping(const CONFIG::ConfigBase* ini, std::string const& identifier, int depth = 0)
+	{
+		PreparedMapping ret;
+		for (const auto& [k, v] : ini->GetAllKeyValuePairs(std::format("ALLOC:{}", identifier))) {
+			if (k == "Alias" && depth < MAX_ALIAS_DEPTH)
+				return ParseMapping(ini, v, depth + 1);
+			if (k == "Used")
+				ret.allocation = v;
+			else if (k == "Aggregate")
+				ret.aggregate = ParseHexFormID(v);
+		}
+		for (const auto& [k, v] : ini->GetAllKeyValuePairs(std::format("MAP:{}", identifier))) {
+			const auto& tildePos = k.find('~');
+			if (tildePos == std::string::npos)
+				continue;
+			const auto& valueTilde = v.find('~');
+			MappedSpell spell{ k.substr(0, tildePos), ParseHexFormID(std::string_view(k).substr(tildePos + 1)), 0x0, 0x0 };
+			if (valueTilde != std::string::npos) {
+				const auto& costTilde = v.find('~', valueTilde + 1);
+				const auto& value = std::string_view(v);
+				spell.maintained = ParseHexFormID(value.substr(0, valueTilde));
+				spell.debuff = ParseHexFormID(value.substr(valueTilde + 1, costTilde == std::string::npos ? std::string::npos : costTilde - valueTilde - 1));
+				if (costTilde != std::string::npos) {
+					const auto& durationTilde = v.find('~', costTilde + 1);
+					const auto& cost = value.substr(costTilde + 1, durationTilde == std::string::npos ? std::string::npos : durationTilde - costTilde - 1);
+					std::from_chars(cost.data(), cost.data() + cost.size(), spell.cost);
+					if (durationTilde != std::string::npos) {
+						const auto& duration = value.substr(durationTilde + 1);
+						std::from_chars(duration.data(), duration.data() + duration.size(), spell.duration);
+					}
+				}
+			}
+			if (spell.localFormID != 0x0)
+				ret.spells.push_back(std::move(spell));
+		}
+		return ret;
+	}
+
+	// What a save writes, one line per maintained spell with its name as comment.
+	struct MappingSection
+	{
+		struct Line
+		{
+			std::string key;
+			std::string value;
+			std::string comment;
+		};
+		std::vector<Line> lines;
+		std::string allocation;
+		RE::FormID aggregate = 0x0;
+
+		// FNV-1a over the lines in key order and the ALLOC values, comments don't count.
+		std::uint64_t Hash()
+		{
+			std::sort(lines.begin(), lines.end(), [](Line const& a, Line const& b) { return a.key < b.key; });
+			std::uint64_t hash = 14695981039346656037ull;
+			const auto& feed = [&](std::string_view bytes) {
+				for (const auto& c : bytes)
+					hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+				hash = (hash ^ 0xFF) * 1099511628211ull;
+			};
+			for (const auto& line : lines) {
+				feed(line.key);
+				feed(line.value);
+			}
+			feed(allocation);
+			feed(std::string_view(reinterpret_cast<const char*>(&aggregate), sizeof(aggregate)));
+			return hash;
+		}
+	};
+
+	// Remembers what the last save wrote, so the map file is only touched where a save differs from it.
+	class MappingJournal
+	{
+	public:
+		enum class Outcome
+		{
+			kSkipped,  // same save, same content
+			kAliased,  // other save, same content
+			kWritten
+		};
+
+		struct Counters
+		{
+			std::uint64_t saves = 0;
+			std::uint64_t skipped = 0;
+			std::uint64_t aliased = 0;
+			std::uint64_t fileWrites = 0;
+			std::uint64_t keysWritten = 0;
+			std::uint64_t keysKept = 0;
+			std::uint64_t keysDeleted = 0;
+		};
+
+		static MappingJournal& GetSingleton()
+		{
+			static MappingJournal instance;
+			return instance;
+		}
+
+		// generation identifies the state the section is built from, build() is only called if it changed since
+		// the last save of the same identifier.
+		template <class Build>
+		Outcome Write(CONFIG::ConfigBase* ini, std::string const& identifier, std::uint64_t generation, Build&& build)
+		{
+			++Stats.saves;
+			if (identifier == LastIdentifier && generation == LastGeneration) {
+				++Stats.skipped;
+				return Outcome::kSkipped;
+			}
+
+			MappingSection section = build();
+			const auto& hash = section.Hash();
+			const auto& sameContent = hash == LastHash && !LastTarget.empty() && ini->HasSection(AllocSection(LastTarget));
+			LastGeneration = generation;
+			if (sameContent && (identifier == LastIdentifier || identifier == LastTarget)) {
+				LastIdentifier = identifier;
+				++Stats.skipped;
+				return Outcome::kSkipped;
+			}
+
+			bool dirty = MaterializeAliasesOf(ini, identifier);
+			auto outcome = Outcome::kWritten;
+			if (sameContent) {
+				dirty |= MakeAlias(ini, identifier, LastTarget);
+				outcome = Outcome::kAliased;
+				++Stats.aliased;
+			} else {
+				dirty |= WriteSection(ini, identifier, section);
+				LastTarget = identifier;
+			}
+			LastIdentifier = identifier;
+			LastHash = hash;
+			if (dirty) {
+				ini->Save();
+				++Stats.fileWrites;
+			}
+			return outcome;
+		}
+
+		std::string const& GetLastTarget() const
+		{
+			return LastTarget;
+		}
+
+		Counters const& GetCounters() const
+		{
+			return Stats;
+		}
+
+	private:
+		MappingJournal() {}
+		MappingJournal(const MappingJournal&) = delete;
+		MappingJournal& operator=(const MappingJournal&) = delete;
+
+		static std::string AllocSection(std::string const& identifier)
+		{
+			return std::format("ALLOC:{}", identifier);
+		}
+
+		static std::string MapSection(std::string const& identifier)
+		{
+			return std::format("MAP:{}", identifier);
+		}
+
+		static void SetIfDifferent(CONFIG::ConfigBase* ini, std::string const& section, std::string const& key, std::string const& value, bool& dirty)
+		{
+			if (ini->HasKey(section, key) && ini->GetValue(section, key) == value)
+				return;
+			ini->SetValue(section, key, value);
+			dirty = true;
+		}
+
+		static void DeleteIfPresent(CONFIG::ConfigBase* ini, std::string const& section, std::string const& key, bool& dirty)
+		{
+			if (!ini->HasKey(section, key))
+				return;
+			ini->DeleteKey(section, key);
+			dirty = true;
+		}
+
+		// Rewrites only the keys whose value differs from what the file already has.
+		bool WriteSection(CONFIG::ConfigBase* ini, std::string const& identifier, MappingSection const& section)
+		{
+			bool dirty = false;
+			const auto& allocSection = AllocSection(identifier);
+			DeleteIfPresent(ini, allocSection, "Alias", dirty);
+			SetIfDifferent(ini, allocSection, "Used", section.allocation, dirty);
+			if (section.aggregate != 0x0)
+				SetIfDifferent(ini, allocSection, "Aggregate", std::format("0x{:08X}", section.aggregate), dirty);
+			else
+				DeleteIfPresent(ini, allocSection, "Aggregate", dirty);
+
+			const auto& mapSection = MapSection(identifier);
+			if (section.lines.empty()) {
+				if (ini->HasSection(mapSection)) {
+					ini->DeleteSection(mapSection);
+					dirty = true;
+				}
+				return dirty;
+			}
+
+			std::unordered_map<std::string, std::string> existing;
+			for (auto& [k, v] : ini->GetAllKeyValuePairs(mapSection))
+				existing.emplace(std::move(k), std::move(v));
+			for (const auto& line : section.lines) {
+				const auto& it = existing.find(line.key);
+				if (it != existing.end() && it->second == line.value) {
+					existing.erase(it);
+					++Stats.keysKept;
+					continue;
+				}
+				if (it != existing.end())
+					existing.erase(it);
+				ini->SetValue(mapSection, line.key, line.value, line.comment);
+				++Stats.keysWritten;
+				dirty = true;
+			}
+			for (const auto& [k, _] : existing) {
+				ini->DeleteKey(mapSection, k);
+				++Stats.keysDeleted;
+				dirty = true;
+			}
+			return dirty;
+		}
+
+		bool MakeAlias(CONFIG::ConfigBase* ini, std::string const& identifier, std::string const& target)
+		{
+			bool dirty = false;
+			const auto& allocSection = AllocSection(identifier);
+			SetIfDifferent(ini, allocSection, "Alias", target, dirty);
+			DeleteIfPresent(ini, allocSection, "Used", dirty);
+			DeleteIfPresent(ini, allocSection, "Aggregate", dirty);
+			if (ini->HasSection(MapSection(identifier))) {
+				ini->DeleteSection(MapSection(identifier));
+				dirty = true;
+			}
+			return dirty;
+		}
+
+		// Copy on write: saves aliasing identifier get their own copy of its sections before they change.
+		bool MaterializeAliasesOf(CONFIG::ConfigBase* ini, std::string const& identifier)
+		{
+			std::vector<std::string> aliases;
+			for (const auto& section : ini->GetAllSections()) {
+				if (section.starts_with("ALLOC:") && ini->HasKey(section, "Alias") && ini->GetValue(section, "Alias") == identifier)
+					aliases.push_back(section.substr(6));
+			}
+			if (aliases.empty())
+				return false;
+
+			const auto& allocPairs = ini->GetAllKeyValuePairs(AllocSection(identifier));
+			const auto& mapPairs = ini->GetAllKeyValuePairs(MapSection(identifier));
+			for (const auto& alias : aliases) {
+				ini->DeleteKey(AllocSection(alias), "Alias");
+				for (const auto& [k, v] : allocPairs)
+					ini->SetValue(AllocSection(alias), k, v);
+				for (const auto& [k, v] : mapPairs)
+					ini->SetValue(MapSection(alias), k, v);
+			}
+			if (LastTarget == identifier)
+				LastTarget = aliases.front();
+			return true;
+		}
+
+		std::string LastIdentifier;
+		std::string LastTarget;  // the save holding the content written last, LastIdentifier itself unless aliased
+		std::uint64_t LastHash = 0;
+		std::uint64_t LastGeneration = 0;
+		Counters Stats;
+	};
+
+	// Parses all savegame sections of the map file in the background. Which save gets loaded is only known at
+	// kPreLoadGame, so the preload covers every save while the player sits in the main menu. Saves wait for it
+	// before writing the file, loads only read it and never wait.
+	class MappingPreloader
+	{
+	public:
+		static MappingPreloader& GetSingleton()
+		{
+			static MappingPreloader instance;
+			return instance;
+		}
+
+		void Start(const CONFIG::ConfigBase* ini)
+		{
+			Wait();
+			Worker = JOBS::Pool::GetSingleton().Submit([this, ini]() {
+				const auto& start = std::chrono::steady_clock::now();
+				// Aliased saves only have an ALLOC section
+				std::vector<std::string> identifiers;
+				for (auto const& section : ini->GetAllSections()) {
+					const auto& prefix = section.starts_with("MAP:") ? 4 : section.starts_with("ALLOC:") ? 6 : 0;
+					if (prefix > 0)
+						identifiers.push_back(section.substr(prefix));
+				}
+				std::sort(identifiers.begin(), identifiers.end());
+				identifiers.erase(std::unique(identifiers.begin(), identifiers.end()), identifiers.end());
+
+				// Reading the file is const, the saves are parsed side by side
+				std::vector<PreparedMapping> parsed(identifiers.size());
+				JOBS::Pool::GetSingleton().ParallelFor(identifiers.size(), [&](std::size_t i) { parsed[i] = ParseMapping(ini, identifiers[i]); });
+				std::unordered_map<std::string, PreparedMapping> prepared;
+				for (std::size_t i = 0; i < identifiers.size(); ++i)
+					prepared.emplace(std::move(identifiers[i]), std::move(parsed[i]));
+				const auto& elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				logger::info("Preloaded {} savegame mappings in {:.2f}ms", prepared.size(), elapsed);
+				std::lock_guard<std::mutex> guard(theMutex);
+				Prepared.merge(prepared);
+			});
+		}
+
+		void Wait()
+		{
+			if (!Worker.Valid())
+				return;
+			const auto& start = std::chrono::steady_clock::now();
+			Worker.Wait();
+			const auto& waited = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			if (waited >= 1.0)
+				logger::info("Waited {:.2f}ms for the mapping preload", waited);
+		}
+
+		// The prepared mapping of a save, parsed on the spot if the preload didn't cover it or is still running.
+		// Parsing the one section is cheaper than waiting for all of them, both sides only read the file.
+		PreparedMapping Take(const CONFIG::ConfigBase* ini, std::string const& identifier)
+		{
+			if (Worker.Valid() && !Worker.IsDone()) {
+				logger::info("Mapping preload still running");
+			} else {
+				std::lock_guard<std::mutex> guard(theMutex);
+				if (auto const& it = Prepared.find(identifier); it != Prepared.end()) {
+					logger::info("Mapping of {} was preloaded ({} spells)", identifier, it->second.spells.size());
+					return it->second;
+				}
+			}
+			const auto& start = std::chrono::steady_clock::now();
+			auto ret = ParseMapping(ini, identifier);
+			logger::info("Parsed mapping of {} in {:.2f}ms ({} spells)", identifier,
+				std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), ret.spells.size());
+			return ret;
+		}
+
+		// Keeps the prepared mapping in sync with what a save just wrote.
+		void Remember(std::string const& identifier, PreparedMapping mapping)
+		{
+			std::lock_guard<std::mutex> guard(theMutex);
+			Prepared.insert_or_assign(identifier, std::move(mapping));
+		}
+
+	private:
+		MappingPreloader() {}
+		MappingPreloader(const MappingPreloader&) = delete;
+		MappingPreloader& operator=(const MappingPreloader&) = delete;
+
+		JOBS::Job<void> Worker;
+		std::unordered_map<std::string, PreparedMapping> Prepared;
+		mutable std::mutex theMutex;
+	};
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+// Two level timer wheel for the periodic work driven from UpdatePCHook. Advance() is called every frame
+// and only bumps an accumulator until a full wheel tick has passed, tasks are bucketed by expiry so
+// a wheel tick only touches the tasks that are actually due.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace MAINT
+{
+	class Scheduler
+	{
+	public:
+		using TaskID = std::uint32_t;
+		using Callback = std::function<void()>;
+
+		static constexpr float TICK = 0.1f;
+		static constexpr TaskID INVALID_TASK = static_cast<TaskID>(-1);
+
+		enum PauseReason : std::uint8_t
+		{
+			kLoading = 1 << 0,
+			kMenu = 1 << 1
+		};
+
+		// Registration and configuration must happen on the thread that calls Advance().
+		TaskID Schedule(std::string_view name, float interval, Callback callback, bool periodic = true)
+		{
+			const auto& id = static_cast<TaskID>(Tasks.size());
+			auto& task = *Tasks.emplace_back(std::make_unique<Task>());
+			task.name = name;
+			task.callback = std::move(callback);
+			task.interval = interval;
+			task.periodic = periodic;
+			task.active = true;
+			Arm(id);
+			return id;
+		}
+
+		void SetInterval(TaskID id, float interval)
+		{
+			if (id >= Tasks.size() || Tasks[id]->interval == interval)
+				return;
+			Tasks[id]->interval = interval;
+			Arm(id);
+		}
+
+		float GetInterval(TaskID id) const
+		{
+			return id < Tasks.size() ? Tasks[id]->interval : 0.0f;
+		}
+
+		void Cancel(TaskID id)
+		{
+			if (id < Tasks.size())
+				Tasks[id]->active = false;
+		}
+
+		// Pushes the next run of a task one full interval out. Safe to call from any thread,
+		// the request is picked up on the next wheel tick.
+		void Restart(TaskID id)
+		{
+			if (id >= Tasks.size())
+				return;
+			Tasks[id]->restartRequested.store(true, std::memory_order_relaxed);
+			AnyRestartRequested.store(true, std::memory_order_release);
+		}
+
+		// Fraction of the interval each run is randomly shifted by, to avoid lining up with other periodic work.
+		void SetJitter(float jitter)
+		{
+			Jitter = jitter;
+		}
+
+		// Time stands still for all tasks while any pause reason is set.
+		void SetPaused(PauseReason reason, bool paused)
+		{
+			if (paused)
+				Paused.fetch_or(reason, std::memory_order_relaxed);
+			else
+				Paused.fetch_and(static_cast<std::uint8_t>(~reason), std::memory_order_relaxed);
+		}
+
+		bool IsPaused() const
+		{
+			return Paused.load(std::memory_order_relaxed) != 0;
+		}
+
+		void Advance(float delta)
+		{
+			Accumulated += delta;
+			if (Accumulated < TICK)
+				return;
+			Step();
+		}
+
+	private:
+		static constexpr std::uint64_t SLOTS = 64;
+		static constexpr std::uint64_t LEVEL1_SPAN = SLOTS * SLOTS;
+
+		struct Task
+		{
+			std::string name;
+			Callback callback;
+			float interval = 0.0f;
+			std::uint64_t expiry = 0;
+			bool periodic = true;
+			bool active = false;
+			std::atomic<bool> restartRequested{ false };
+		};
+
+		// A bucket entry is stale once its task was cancelled or rearmed, i.e. the expiry it was filed
+		// under is no longer the task's.
+		struct Entry
+		{
+			TaskID id;
+			std::uint64_t expiry;
+		};
+
+		void Step()
+		{
+			if (IsPaused()) {
+				Accumulated = 0.0f;
+				return;
+			}
+			if (AnyRestartRequested.exchange(false, std::memory_order_acquire)) {
+				for (TaskID id = 0; id < Tasks.size(); ++id) {
+					if (Tasks[id]->restartRequested.exchange(false, std::memory_order_relaxed))
+						Arm(id);
+				}
+			}
+			while (Accumulated >= TICK) {
+				Accumulated -= TICK;
+				Tick();
+			}
+		}
+
+		void Tick()
+		{
+			++Now;
+			if (Now % LEVEL1_SPAN == 0)
+				Rebucket(Overflow);
+			if (Now % SLOTS == 0)
+				Rebucket(Level1[(Now / SLOTS) % SLOTS]);
+
+			auto& slot = Level0[Now % SLOTS];
+			if (slot.empty())
+				return;
+			std::swap(slot, Firing);
+			for (auto const& [id, expiry] : Firing) {
+				auto& task = *Tasks[id];
+				// Entries of cancelled or rearmed tasks are stale and simply dropped
+				if (!task.active || task.expiry != expiry)
+					continue;
+				task.callback();
+				if (task.expiry != Now)
+					continue;
+				if (task.periodic)
+					Arm(id);
+				else
+					task.active = false;
+			}
+			Firing.clear();
+		}
+
+		void Arm(TaskID id)
+		{
+			auto& task = *Tasks[id];
+			task.active = true;
+			task.expiry = Now + TicksFor(task.interval);
+			Insert(id);
+		}
+
+		void Insert(TaskID id)
+		{
+			const auto& expiry = Tasks[id]->expiry;
+			const auto& delta = expiry - Now;
+			if (delta < SLOTS)
+				Level0[expiry % SLOTS].push_back({ id, expiry });
+			else if (delta < LEVEL1_SPAN)
+				Level1[(expiry / SLOTS) % SLOTS].push_back({ id, expiry });
+			else
+				Overflow.push_back({ id, expiry });
+		}
+
+		// Moves the live entries of a bucket one level down, stale ones are dropped instead of carried along.
+		void Rebucket(std::vector<Entry>& bucket)
+		{
+			std::vector<Entry> pending;
+			std::swap(bucket, pending);
+			for (auto const& [id, expiry] : pending) {
+				auto const& task = *Tasks[id];
+				if (task.active && task.expiry == expiry && expiry >= Now)
+					Insert(id);
+			}
+		}
+
+		std::uint64_t TicksFor(float interval)
+		{
+			auto scaled = interval;
+			if (Jitter > 0.0f)
+				scaled *= 1.0f + Jitter * (2.0f * NextRandom() - 1.0f);
+			return std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::lround(scaled / TICK)));
+		}
+
+		// xorshift32, good enough to spread out task phases
+		float NextRandom()
+		{
+			RandomState ^= RandomState << 13;
+			RandomState ^= RandomState >> 17;
+			RandomState ^= RandomState << 5;
+			return static_cast<float>(RandomState) / static_cast<float>(UINT32_MAX);
+		}
+
+		std::vector<std::unique_ptr<Task>> Tasks;
+		std::array<std::vector<Entry>, SLOTS> Level0;
+		std::array<std::vector<Entry>, SLOTS> Level1;
+		std::vector<Entry> Overflow;
+		std::vector<Entry> Firing;
+
+		std::uint64_t Now = 0;
+		float Accumulated = 0.0f;
+		float Jitter = 0.0f;
+		std::uint32_t RandomState = 0x9E3779B9u;
+		std::atomic<bool> AnyRestartRequested{ false };
+		std::atomic<std::uint8_t> Paused{ 0 };
+	};
+}
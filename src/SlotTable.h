@@ -0,0 +1,255 @@
+#pragma once
+
+// Dense table of maintained spells, one row per spell with its data in parallel arrays, so the validation,
+// experience and save paths walk a few contiguous arrays instead of a tree of pointers. Rows are referenced
+// through handles that carry the generation of their slot: erasing a row or clearing the table bumps it, so a
+// handle kept past a removal or a load is rejected instead of silently landing on whatever took its place.
+
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+namespace MAINT
+{
+	struct SlotHandle
+	{
+		static constexpr std::uint32_t NONE = (std::numeric_limits<std::uint32_t>::max)();
+
+		std::uint32_t slot = NONE;
+		std::uint32_t generation = 0;
+
+		bool operator==(SlotHandle const&) const = default;
+	};
+
+	template <class Form, class Skill>
+	class SlotTable
+	{
+	public:
+		static constexpr std::size_t NPOS = (std::numeric_limits<std::size_t>::max)();
+
+		enum Flag : std::uint8_t
+		{
+			kNone = 0,
+			kRestored = 1 << 0  // claimed from a savegame mapping, the duration is unknown if the mapping predates it
+		};
+
+		struct Row
+		{
+			Form* base = nullptr;
+			Form* maintained = nullptr;
+			Form* debuff = nullptr;  // null while the upkeep is carried by the aggregate debuff
+			float cost = 0.0f;
+			float duration = 0.0f;  // effect duration when it was maintained, 0 if unknown
+			Skill skill{};
+			std::uint8_t flags = kNone;
+		};
+
+		// Adds a row for row.base, or overwrites the one it already has and keeps its handle.
+		SlotHandle Insert(Row const& row)
+		{
+			if (const auto& existing = IndexOf(row.base); existing != NPOS) {
+				Set(existing, row);
+				return HandleAt(existing);
+			}
+
+			std::uint32_t slot;
+			if (!FreeSlots.empty()) {
+				slot = FreeSlots.back();
+				FreeSlots.pop_back();
+			} else {
+				slot = static_cast<std::uint32_t>(SlotToIndex.size());
+				SlotToIndex.push_back(0);
+				Generations.push_back(1);
+			}
+			SlotToIndex[slot] = static_cast<std::uint32_t>(IndexToSlot.size());
+			IndexToSlot.push_back(slot);
+			BaseColumn.push_back(row.base);
+			MaintainedColumn.push_back(row.maintained);
+			DebuffColumn.push_back(row.debuff);
+			CostColumn.push_back(row.cost);
+			DurationColumn.push_back(row.duration);
+			SkillColumn.push_back(row.skill);
+			FlagColumn.push_back(row.flags);
+			return { slot, Generations[slot] };
+		}
+
+		// Row index of a handle, NPOS if its row has been erased since.
+		std::size_t Find(SlotHandle const& handle) const
+		{
+			if (handle.slot >= Generations.size() || Generations[handle.slot] != handle.generation)
+				return NPOS;
+			return SlotToIndex[handle.slot];
+		}
+
+		// Row index of a base spell, NPOS if it isn't maintained. A linear scan, the table holds a few dozen rows at most.
+		std::size_t IndexOf(Form const* base) const
+		{
+			for (std::size_t i = 0; i < BaseColumn.size(); ++i) {
+				if (BaseColumn[i] == base)
+					return i;
+			}
+			return NPOS;
+		}
+
+		bool Contains(Form const* base) const
+		{
+			return IndexOf(base) != NPOS;
+		}
+
+		SlotHandle HandleAt(std::size_t index) const
+		{
+			const auto& slot = IndexToSlot[index];
+			return { slot, Generations[slot] };
+		}
+
+		Row RowAt(std::size_t index) const
+		{
+			return { BaseColumn[index], MaintainedColumn[index], DebuffColumn[index], CostColumn[index], DurationColumn[index], SkillColumn[index], FlagColumn[index] };
+		}
+
+		// Moves the last row into the hole, so row indices are only stable until the next erase.
+		bool Erase(SlotHandle const& handle)
+		{
+			const auto& index = Find(handle);
+			if (index == NPOS)
+				return false;
+			const auto& last = IndexToSlot.size() - 1;
+			if (index != last) {
+				IndexToSlot[index] = IndexToSlot[last];
+				SlotToIndex[IndexToSlot[index]] = static_cast<std::uint32_t>(index);
+				Set(index, RowAt(last));
+			}
+			PopBack();
+			++Generations[handle.slot];
+			FreeSlots.push_back(handle.slot);
+			return true;
+		}
+
+		bool EraseBase(Form const* base)
+		{
+			const auto& index = IndexOf(base);
+			return index != NPOS && Erase(HandleAt(index));
+		}
+
+		// Invalidates every handle given out so far, unlike assigning an empty table.
+		void Clear()
+		{
+			for (const auto& slot : IndexToSlot) {
+				++Generations[slot];
+				FreeSlots.push_back(slot);
+			}
+			IndexToSlot.clear();
+			BaseColumn.clear();
+			MaintainedColumn.clear();
+			DebuffColumn.clear();
+			CostColumn.clear();
+			DurationColumn.clear();
+			SkillColumn.clear();
+			FlagColumn.clear();
+		}
+
+		std::size_t size() const
+		{
+			return BaseColumn.size();
+		}
+
+		bool empty() const
+		{
+			return BaseColumn.empty();
+		}
+
+		std::span<Form* const> Bases() const
+		{
+			return BaseColumn;
+		}
+
+		std::span<Form* const> Maintained() const
+		{
+			return MaintainedColumn;
+		}
+
+		std::span<Form* const> Debuffs() const
+		{
+			return DebuffColumn;
+		}
+
+		std::span<const float> Costs() const
+		{
+			return CostColumn;
+		}
+
+		std::span<const float> Durations() const
+		{
+			return DurationColumn;
+		}
+
+		std::span<const Skill> Skills() const
+		{
+			return SkillColumn;
+		}
+
+		std::span<const std::uint8_t> Flags() const
+		{
+			return FlagColumn;
+		}
+
+		// The base and maintained forms identify a row and only change through Insert.
+		std::span<Form*> Debuffs()
+		{
+			return DebuffColumn;
+		}
+
+		std::span<float> Costs()
+		{
+			return CostColumn;
+		}
+
+		std::span<float> Durations()
+		{
+			return DurationColumn;
+		}
+
+		std::span<std::uint8_t> Flags()
+		{
+			return FlagColumn;
+		}
+
+	private:
+		void Set(std::size_t index, Row const& row)
+		{
+			BaseColumn[index] = row.base;
+			MaintainedColumn[index] = row.maintained;
+			DebuffColumn[index] = row.debuff;
+			CostColumn[index] = row.cost;
+			DurationColumn[index] = row.duration;
+			SkillColumn[index] = row.skill;
+			FlagColumn[index] = row.flags;
+		}
+
+		void PopBack()
+		{
+			IndexToSlot.pop_back();
+			BaseColumn.pop_back();
+			MaintainedColumn.pop_back();
+			DebuffColumn.pop_back();
+			CostColumn.pop_back();
+			DurationColumn.pop_back();
+			SkillColumn.pop_back();
+			FlagColumn.pop_back();
+		}
+
+		std::vector<Form*> BaseColumn;
+		std::vector<Form*> MaintainedColumn;
+		std::vector<Form*> DebuffColumn;
+		std::vector<float> CostColumn;
+		std::vector<float> DurationColumn;
+		std::vector<Skill> SkillColumn;
+		std::vector<std::uint8_t> FlagColumn;
+
+		std::vector<std::uint32_t> IndexToSlot;
+		std::vector<std::uint32_t> SlotToIndex;  // meaningless for free slots
+		std::vector<std::uint32_t> Generations;
+		std::vector<std::uint32_t> FreeSlots;
+	};
+}
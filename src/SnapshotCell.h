@@ -0,0 +1,143 @@
+#pragma once
+
+// Single value published as immutable snapshots. Readers pin the current version without taking a lock and
+// keep a consistent view for as long as they hold it, writers copy, modify and atomically publish the next
+// version. Replaced versions are reclaimed once no reader pinned before the replacement is still around.
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace MAINT
+{
+	template <class T>
+	class SnapshotCell
+	{
+		struct Version
+		{
+			T value;
+			std::uint64_t generation;
+		};
+
+		using Pin = std::atomic<std::uint64_t>;
+
+	public:
+		// Concurrently pinned views, further readers spin until one is released.
+		static constexpr std::size_t READER_SLOTS = 64;
+
+		class View
+		{
+		public:
+			View(View&& other) noexcept :
+				Value(std::exchange(other.Value, nullptr)),
+				Slot(std::exchange(other.Slot, nullptr))
+			{}
+			View(const View&) = delete;
+			View& operator=(const View&) = delete;
+			View& operator=(View&&) = delete;
+
+			~View()
+			{
+				if (Slot)
+					Slot->store(0, std::memory_order_release);
+			}
+
+			const T* operator->() const { return &Value->value; }
+			const T& operator*() const { return Value->value; }
+
+			// Incremented by every published update.
+			std::uint64_t Generation() const { return Value->generation; }
+
+		private:
+			friend class SnapshotCell;
+
+			View(const Version* value, Pin* slot) :
+				Value(value),
+				Slot(slot)
+			{}
+
+			const Version* Value;
+			Pin* Slot;
+		};
+
+		explicit SnapshotCell(T initial = T()) :
+			Current(new Version{ std::move(initial), 0 })
+		{}
+
+		~SnapshotCell()
+		{
+			delete Current.load();
+		}
+
+		SnapshotCell(const SnapshotCell&) = delete;
+		SnapshotCell& operator=(const SnapshotCell&) = delete;
+
+		View Read() const
+		{
+			static thread_local const std::size_t hint = NextHint.fetch_add(1, std::memory_order_relaxed);
+			while (true) {
+				for (std::size_t i = 0; i < READER_SLOTS; ++i) {
+					auto& slot = Pins[(hint + i) % READER_SLOTS];
+					std::uint64_t expected = 0;
+					// The pin has to be visible before Current is loaded, writers scan the pins after swapping Current
+					if (slot.compare_exchange_strong(expected, Epoch.load()))
+						return View(Current.load(), &slot);
+				}
+				std::this_thread::yield();
+			}
+		}
+
+		// Applies func to a copy of the current value and publishes the result. Writers are serialized.
+		template <class Func>
+		std::uint64_t Update(Func&& func)
+		{
+			std::lock_guard<std::mutex> guard(WriterMutex);
+			const auto* current = Current.load();
+			auto next = std::make_unique<Version>(Version{ current->value, current->generation + 1 });
+			func(next->value);
+			const auto& generation = next->generation;
+			Retire(Current.exchange(next.release()));
+			return generation;
+		}
+
+		std::uint64_t Publish(T value)
+		{
+			return Update([&](T& next) { next = std::move(value); });
+		}
+
+		// Versions replaced but still pinned by a reader.
+		std::size_t RetiredCount() const
+		{
+			std::lock_guard<std::mutex> guard(WriterMutex);
+			return Retired.size();
+		}
+
+	private:
+		void Retire(const Version* old)
+		{
+			Retired.emplace_back(Epoch.fetch_add(1) + 1, std::unique_ptr<const Version>(old));
+
+			auto oldestPin = (std::numeric_limits<std::uint64_t>::max)();
+			for (auto const& pin : Pins) {
+				if (const auto& epoch = pin.load(); epoch != 0 && epoch < oldestPin)
+					oldestPin = epoch;
+			}
+			// Readers pinned at or after the retire epoch loaded Current after it was swapped
+			std::erase_if(Retired, [&](auto const& entry) { return entry.first <= oldestPin; });
+		}
+
+		std::atomic<const Version*> Current;
+		std::atomic<std::uint64_t> Epoch{ 1 };
+		mutable std::array<Pin, READER_SLOTS> Pins{};
+		std::vector<std::pair<std::uint64_t, std::unique_ptr<const Version>>> Retired;
+		mutable std::mutex WriterMutex;
+
+		static inline std::atomic<std::size_t> NextHint{ 0 };
+	};
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+// Engine independent parts of cloning a spell into its maintained and debuff versions. The engine's AddKeyword
+// copies the array into a temporary and reallocates it for every single keyword; merging the source keywords and
+// the extra ones into an array sized once costs a single allocation per spell. Names are interned once per base
+// spell, so cloning the same spell again allocates no name at all.
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+namespace MAINT
+{
+	namespace KEYWORDS
+	{
+		// Copies source and appends the extra keywords it doesn't have yet, skipping nulls. allocate(n) returns an
+		// array of n keywords, which is sized for the worst case and may end up partially used.
+		template <class Keyword, class Allocate>
+		std::pair<Keyword**, std::uint32_t> Merge(std::span<Keyword* const> source, std::type_identity_t<std::initializer_list<Keyword*>> extra, Allocate&& allocate)
+		{
+			Keyword** keywords = allocate(source.size() + extra.size());
+			std::uint32_t count = 0;
+			for (const auto& kywd : source) {
+				if (kywd)
+					keywords[count++] = kywd;
+			}
+			for (const auto& kywd : extra) {
+				if (kywd && std::find(keywords, keywords + count, kywd) == keywords + count)
+					keywords[count++] = kywd;
+			}
+			return { keywords, count };
+		}
+	}
+
+	// "Maintained <name>" per base spell, shared by its maintained and debuff spell. Pooled strings compare by
+	// pointer, so an entry is rebuilt only if the base spell got renamed since.
+	template <class Key, class FixedString>
+	class NameCache
+	{
+	public:
+		FixedString const& Get(Key const& key, FixedString const& source, std::string_view prefix)
+		{
+			auto& [sourceName, name] = Names[key];
+			if (name.empty() || sourceName.data() != source.data()) {
+				Buffer.assign(prefix);
+				Buffer.append(source.data());
+				sourceName = source;
+				name = Buffer;
+			}
+			return name;
+		}
+
+	private:
+		std::unordered_map<Key, std::pair<FixedString, FixedString>> Names;
+		std::string Buffer;
+	};
+}
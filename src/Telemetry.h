@@ -0,0 +1,316 @@
+#pragma once
+
+// Optional local endpoint serving the plugin's runtime statistics to external monitors. The game thread
+// publishes a snapshot now and then, a background thread answers each connection with the latest one, so
+// a client can never stall the game. On Windows the endpoint is a named pipe (\\.\pipe\<name>), elsewhere a
+// Unix domain socket.
+//
+// Protocol: the client sends one line, "stats" (or an empty line) for the snapshot as JSON, "ping" for
+// "pong", or the name of a command added with AddCommand. Every answer is a single line, after which the
+// server closes the connection.
+
+#include "SnapshotCell.h"
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#ifdef _WIN32
+#	include <Windows.h>
+#else
+#	include <poll.h>
+#	include <sys/socket.h>
+#	include <sys/un.h>
+#	include <unistd.h>
+#endif
+
+namespace MAINT
+{
+	namespace TELEMETRY
+	{
+		struct Snapshot
+		{
+			std::uint64_t sequence = 0;  // bumped by every publish
+			std::uint32_t maintained = 0;
+			float totalDrain = 0.0f;
+			float validationInterval = 0.0f;
+			float lastValidationMs = 0.0f;
+			float maxValidationMs = 0.0f;
+			std::uint32_t removalsLastMinute = 0;
+			std::uint32_t pendingCasts = 0;
+			std::uint64_t castsSeen = 0;
+			std::uint64_t castsFiltered = 0;
+			std::uint64_t castsCoalesced = 0;
+			std::uint64_t castsMaintained = 0;
+			std::uint64_t mappingSaves = 0;
+			std::uint64_t mappingSkipped = 0;  // saves that left the map file alone
+			std::uint64_t mappingAliased = 0;
+			std::uint64_t mappingFileWrites = 0;
+		};
+
+		inline std::string ToJson(Snapshot const& s, double uptime)
+		{
+			char buffer[768];
+			const auto& length = std::snprintf(buffer, sizeof(buffer),
+				"{\"sequence\":%" PRIu64 ",\"uptime\":%.3f,\"maintained\":%" PRIu32 ",\"totalDrain\":%.2f,"
+				"\"validationInterval\":%.2f,\"lastValidationMs\":%.3f,\"maxValidationMs\":%.3f,\"removalsLastMinute\":%" PRIu32 ","
+				"\"pendingCasts\":%" PRIu32 ",\"casts\":{\"seen\":%" PRIu64 ",\"filtered\":%" PRIu64 ",\"coalesced\":%" PRIu64 ",\"maintained\":%" PRIu64 "},"
+				"\"mapping\":{\"saves\":%" PRIu64 ",\"skipped\":%" PRIu64 ",\"aliased\":%" PRIu64 ",\"fileWrites\":%" PRIu64 "}}\n",
+				s.sequence, uptime, s.maintained, s.totalDrain,
+				s.validationInterval, s.lastValidationMs, s.maxValidationMs, s.removalsLastMinute,
+				s.pendingCasts, s.castsSeen, s.castsFiltered, s.castsCoalesced, s.castsMaintained,
+				s.mappingSaves, s.mappingSkipped, s.mappingAliased, s.mappingFileWrites);
+			return std::string(buffer, static_cast<std::size_t>((std::max)(0, (std::min)(length, static_cast<int>(sizeof(buffer) - 1)))));
+		}
+
+		class Endpoint
+		{
+		public:
+			static constexpr std::size_t MAX_REQUEST = 64;
+
+			Endpoint() = default;
+			Endpoint(const Endpoint&) = delete;
+			Endpoint& operator=(const Endpoint&) = delete;
+
+			~Endpoint()
+			{
+				Close();
+			}
+
+			// Starts serving at path, or stops if path is empty. Reopening the same path is a no-op.
+			// Returns false and describes the problem in error if the endpoint could not be created.
+			bool Open(std::string const& path, std::string& error)
+			{
+				if (path == Path)
+					return true;
+				Close();
+				if (path.empty())
+					return true;
+				if (!Listen(path, error))
+					return false;
+				Path = path;
+				Stop.store(false, std::memory_order_relaxed);
+				Started = std::chrono::steady_clock::now();
+				Worker = std::thread([this]() { Serve(); });
+				return true;
+			}
+
+			void Close()
+			{
+				if (!Worker.joinable())
+					return;
+				Stop.store(true, std::memory_order_relaxed);
+#ifdef _WIN32
+				// Aborts whatever overlapped wait the worker is in, a connected client can't keep it busy
+				SetEvent(StopEvent);
+#endif
+				Worker.join();
+				Path.clear();
+			}
+
+			bool IsOpen() const
+			{
+				return Worker.joinable();
+			}
+
+			std::string const& GetPath() const
+			{
+				return Path;
+			}
+
+			// Called from the game thread. Never waits for a client.
+			void Publish(Snapshot snapshot)
+			{
+				snapshot.sequence = ++Sequence;
+				Current.Publish(std::move(snapshot));
+			}
+
+			std::uint64_t Served() const
+			{
+				return ServedCount.load(std::memory_order_relaxed);
+			}
+
+			// Answers request name with whatever handler returns, called on the endpoint's thread. Add commands
+			// before the first Open, the table is read without a lock.
+			void AddCommand(std::string name, std::function<std::string()> handler)
+			{
+				Commands.insert_or_assign(std::move(name), std::move(handler));
+			}
+
+		private:
+			std::string Respond(std::string_view request) const
+			{
+				while (!request.empty() && (request.back() == '\n' || request.back() == '\r'))
+					request.remove_suffix(1);
+				if (request.empty() || request == "stats") {
+					const auto& uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - Started).count();
+					return ToJson(*Current.Read(), uptime);
+				}
+				if (request == "ping")
+					return "pong\n";
+				if (const auto& command = Commands.find(request); command != Commands.end())
+					return command->second();
+				return "{\"error\":\"unknown request\"}\n";
+			}
+
+#ifdef _WIN32
+			bool Listen(std::string const& path, std::string& error)
+			{
+				Pipe = CreateInstance(path);
+				if (Pipe == INVALID_HANDLE_VALUE) {
+					error = "CreateNamedPipe failed with " + std::to_string(GetLastError());
+					return false;
+				}
+				IoEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+				StopEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+				if (!IoEvent || !StopEvent) {
+					error = "CreateEvent failed with " + std::to_string(GetLastError());
+					Release();
+					return false;
+				}
+				return true;
+			}
+
+			static HANDLE CreateInstance(std::string const& path)
+			{
+				return CreateNamedPipeA(path.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+					1, 4096, 4096, 0, nullptr);
+			}
+
+			void Release()
+			{
+				for (auto* handle : { &Pipe, &IoEvent, &StopEvent }) {
+					if (*handle && *handle != INVALID_HANDLE_VALUE)
+						CloseHandle(*handle);
+				}
+				Pipe = INVALID_HANDLE_VALUE;
+				IoEvent = StopEvent = nullptr;
+			}
+
+			// Finishes an overlapped operation that was just started. Gives up after timeout or as soon as Close
+			// asks the worker to stop, cancelling the operation before its OVERLAPPED goes out of scope.
+			bool Await(BOOL started, OVERLAPPED& overlapped, DWORD timeout, DWORD& transferred)
+			{
+				if (!started && GetLastError() != ERROR_IO_PENDING)
+					return false;
+				const HANDLE handles[] = { overlapped.hEvent, StopEvent };
+				if (WaitForMultipleObjects(2, handles, FALSE, timeout) != WAIT_OBJECT_0) {
+					CancelIoEx(Pipe, &overlapped);
+					GetOverlappedResult(Pipe, &overlapped, &transferred, TRUE);
+					return false;
+				}
+				return GetOverlappedResult(Pipe, &overlapped, &transferred, FALSE);
+			}
+
+			void Serve()
+			{
+				while (!Stop.load(std::memory_order_relaxed)) {
+					OVERLAPPED overlapped{};
+					overlapped.hEvent = IoEvent;
+					DWORD transferred = 0;
+					const auto& started = ConnectNamedPipe(Pipe, &overlapped);
+					const auto& connected = (!started && GetLastError() == ERROR_PIPE_CONNECTED) || Await(started, overlapped, INFINITE, transferred);
+					if (connected && !Stop.load(std::memory_order_relaxed)) {
+						// A client gets one second to send its request
+						char request[MAX_REQUEST];
+						std::size_t length = 0;
+						while (length < sizeof(request)) {
+							overlapped = {};
+							overlapped.hEvent = IoEvent;
+							DWORD read = 0;
+							if (!Await(ReadFile(Pipe, request + length, static_cast<DWORD>(sizeof(request) - length), nullptr, &overlapped), overlapped, 1000, read) || read == 0)
+								break;
+							length += read;
+							if (request[length - 1] == '\n')
+								break;
+						}
+						const auto& response = Respond({ request, length });
+						overlapped = {};
+						overlapped.hEvent = IoEvent;
+						DWORD written = 0;
+						if (Await(WriteFile(Pipe, response.data(), static_cast<DWORD>(response.size()), nullptr, &overlapped), overlapped, 1000, written) && written == response.size())
+							ServedCount.fetch_add(1, std::memory_order_relaxed);
+					}
+					DisconnectNamedPipe(Pipe);
+				}
+				Release();
+			}
+
+			HANDLE Pipe = INVALID_HANDLE_VALUE;
+			HANDLE IoEvent = nullptr;
+			HANDLE StopEvent = nullptr;  // set by Close
+#else
+			bool Listen(std::string const& path, std::string& error)
+			{
+				sockaddr_un address{};
+				if (path.size() >= sizeof(address.sun_path)) {
+					error = "socket path is too long";
+					return false;
+				}
+				address.sun_family = AF_UNIX;
+				path.copy(address.sun_path, path.size());
+
+				Socket = socket(AF_UNIX, SOCK_STREAM, 0);
+				::unlink(path.c_str());
+				if (Socket < 0 || bind(Socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(Socket, 4) != 0) {
+					error = "cannot listen on " + path;
+					if (Socket >= 0)
+						::close(Socket);
+					Socket = -1;
+					return false;
+				}
+				return true;
+			}
+
+			void Serve()
+			{
+				while (!Stop.load(std::memory_order_relaxed)) {
+					pollfd listener{ Socket, POLLIN, 0 };
+					if (poll(&listener, 1, 200) <= 0)
+						continue;
+					const auto client = accept(Socket, nullptr, nullptr);
+					if (client < 0)
+						continue;
+
+					// A client gets one second to send its request
+					char request[MAX_REQUEST];
+					std::size_t length = 0;
+					pollfd readable{ client, POLLIN, 0 };
+					while (length < sizeof(request) && poll(&readable, 1, 1000) > 0) {
+						const auto& got = ::read(client, request + length, sizeof(request) - length);
+						if (got <= 0)
+							break;
+						length += static_cast<std::size_t>(got);
+						if (request[length - 1] == '\n')
+							break;
+					}
+					const auto& response = Respond({ request, length });
+					if (::write(client, response.data(), response.size()) == static_cast<ssize_t>(response.size()))
+						ServedCount.fetch_add(1, std::memory_order_relaxed);
+					::close(client);
+				}
+				::close(Socket);
+				Socket = -1;
+				::unlink(Path.c_str());
+			}
+
+			int Socket = -1;
+#endif
+
+			std::string Path;
+			std::thread Worker;
+			std::atomic<bool> Stop{ false };
+			std::chrono::steady_clock::time_point Started;
+			SnapshotCell<Snapshot> Current;
+			std::map<std::string, std::function<std::string()>, std::less<>> Commands;
+			std::uint64_t Sequence = 0;
+			std::atomic<std::uint64_t> ServedCount{ 0 };
+		};
+	}
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+// Optional timeline of hook activity, written as Chrome trace-event JSON that opens in chrome://tracing or
+// Perfetto. Each thread records complete events into its own fixed size ring, which the game thread drains
+// into the file periodically. While disabled a scope costs a single relaxed load.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace MAINT
+{
+	class Timeline
+	{
+	public:
+		static Timeline& GetSingleton()
+		{
+			static Timeline instance;
+			return instance;
+		}
+
+		// Starts a new timeline at path, or stops if path is empty. Reopening the same path is a no-op.
+		// capacity bounds the events buffered per thread between two flushes, later events are dropped.
+		void Open(std::string const& path, std::size_t capacity)
+		{
+			std::lock_guard<std::mutex> guard(theMutex);
+			Capacity.store(capacity, std::memory_order_relaxed);
+			if (path == Path)
+				return;
+			Close();
+			Path = path;
+			if (Path.empty())
+				return;
+
+			File.open(Path, std::ios::trunc);
+			if (!File) {
+				logger::error("Failed to open timeline {}", Path);
+				return;
+			}
+			logger::info("Recording timeline to {}", Path);
+			File << "[\n";
+			Drain(false);
+			Start = Now();
+			Enabled.store(true, std::memory_order_release);
+		}
+
+		bool IsEnabled() const
+		{
+			return Enabled.load(std::memory_order_relaxed);
+		}
+
+		// Writes out everything recorded since the last flush. Called from the game thread.
+		void Flush()
+		{
+			if (!IsEnabled())
+				return;
+			std::lock_guard<std::mutex> guard(theMutex);
+			Drain(true);
+		}
+
+		class Scope
+		{
+		public:
+			explicit Scope(const char* name) :
+				Name(name),
+				Begin(Timeline::GetSingleton().IsEnabled() ? Now() : 0)
+			{}
+
+			~Scope()
+			{
+				if (Begin != 0)
+					Timeline::GetSingleton().Push(Name, Begin, Now());
+			}
+
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+		private:
+			const char* Name;
+			std::uint64_t Begin;
+		};
+
+	private:
+		struct Event
+		{
+			const char* name;
+			std::uint64_t begin;
+			std::uint64_t end;
+		};
+
+		// Single producer (the owning thread), single consumer (Drain under theMutex).
+		struct ThreadBuffer
+		{
+			ThreadBuffer(std::size_t capacity, std::uint32_t tid) :
+				Events(capacity),
+				Tid(tid)
+			{}
+
+			std::vector<Event> Events;
+			std::atomic<std::uint64_t> Head{ 0 };
+			std::atomic<std::uint64_t> Tail{ 0 };
+			std::atomic<std::uint64_t> Dropped{ 0 };
+			std::atomic<bool> Retired{ false };
+			const std::uint32_t Tid;
+		};
+
+		// Flags the thread's buffer for removal once the thread exits.
+		struct Registration
+		{
+			ThreadBuffer* buffer = nullptr;
+
+			~Registration()
+			{
+				if (buffer)
+					buffer->Retired.store(true, std::memory_order_release);
+			}
+		};
+
+		Timeline() {}
+		Timeline(const Timeline&) = delete;
+		Timeline& operator=(const Timeline&) = delete;
+
+		// Nanoseconds on the steady clock, never 0 so Scope can use 0 for "not recording".
+		static std::uint64_t Now()
+		{
+			return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()) | 1;
+		}
+
+		void Push(const char* name, std::uint64_t begin, std::uint64_t end)
+		{
+			if (!IsEnabled())
+				return;
+			static thread_local Registration local;
+			if (!local.buffer)
+				local.buffer = Register();
+
+			auto& buffer = *local.buffer;
+			const auto& head = buffer.Head.load(std::memory_order_relaxed);
+			if (head - buffer.Tail.load(std::memory_order_acquire) >= buffer.Events.size()) {
+				buffer.Dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			buffer.Events[head % buffer.Events.size()] = { name, begin, end };
+			buffer.Head.store(head + 1, std::memory_order_release);
+		}
+
+		ThreadBuffer* Register()
+		{
+			std::lock_guard<std::mutex> guard(theMutex);
+			const auto capacity = std::max<std::size_t>(1, Capacity.load(std::memory_order_relaxed));
+			return Buffers.emplace_back(std::make_unique<ThreadBuffer>(capacity, NextTid++)).get();
+		}
+
+		void Drain(bool write)
+		{
+			Text.clear();
+			for (auto it = Buffers.begin(); it != Buffers.end();) {
+				auto& buffer = **it;
+				// Checked before Head, so the last events of an exited thread are never lost
+				const auto& retired = buffer.Retired.load(std::memory_order_acquire);
+				const auto& head = buffer.Head.load(std::memory_order_acquire);
+				for (auto i = buffer.Tail.load(std::memory_order_relaxed); write && i < head; ++i) {
+					auto const& e = buffer.Events[i % buffer.Events.size()];
+					std::format_to(std::back_inserter(Text), "{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}},\n",
+						e.name, buffer.Tid, (static_cast<double>(e.begin) - static_cast<double>(Start)) / 1000.0, static_cast<double>(e.end - e.begin) / 1000.0);
+				}
+				buffer.Tail.store(head, std::memory_order_release);
+				if (const auto& dropped = buffer.Dropped.exchange(0, std::memory_order_relaxed); dropped > 0)
+					logger::warn("Timeline buffer of thread {} was full, dropped {} events", buffer.Tid, dropped);
+
+				if (retired)
+					it = Buffers.erase(it);
+				else
+					++it;
+			}
+			if (write && !Text.empty()) {
+				File << Text;
+				File.flush();
+			}
+		}
+
+		void Close()
+		{
+			if (!Enabled.exchange(false, std::memory_order_acq_rel))
+				return;
+			Drain(true);
+			File << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"MaintainedMagicNG\"}}]\n";
+			File.close();
+		}
+
+		std::ofstream File;
+		std::string Path;
+		std::string Text;
+		std::uint64_t Start = 0;
+		std::atomic<std::size_t> Capacity{ 0 };
+		std::atomic<bool> Enabled{ false };
+		std::vector<std::unique_ptr<ThreadBuffer>> Buffers;
+		std::uint32_t NextTid = 1;
+		mutable std::mutex theMutex;
+	};
+}
+
+#define MAINT_TIMELINE_SCOPE(name) const MAINT::Timeline::Scope maintTimelineScope(name)
@@ -0,0 +1,220 @@
+#pragma once
+
+// Binary event trace shared by the in-game recorder and the offline replay tool.
+//
+// A trace starts with MAGIC and VERSION, followed by records of
+//   u8 type, u32 microseconds since the previous record, payload
+// All values are little endian, strings are u16 length + bytes.
+
+#include "Validation.h"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace MAINT
+{
+	namespace TRACE
+	{
+		inline constexpr std::array<char, 8> MAGIC{ 'M', 'M', 'N', 'G', 'T', 'R', 'C', 'E' };
+		inline constexpr std::uint32_t VERSION = 1;
+
+		enum class RecordType : std::uint8_t
+		{
+			kTick = 1,        // f32 frame delta of UpdatePCMod
+			kCast = 2,        // u32 spell FormID of a player cast
+			kMaintained = 3,  // u32 count, MaintainedFact[count]
+			kEffects = 4,     // u32 count, ActiveEffectFact[count]
+			kVerdicts = 5,    // u32 count, { u32 maintained FormID, u8 Verdict }[count]
+			kMessage = 6      // u32 SKSE message type, string save name
+		};
+
+		struct Record
+		{
+			RecordType type;
+			std::uint64_t timestamp;  // microseconds since the start of the trace
+			float delta;
+			std::uint32_t formID;
+			std::uint32_t messageType;
+			std::string name;
+			std::vector<VALIDATION::MaintainedFact> maintained;
+			std::vector<VALIDATION::ActiveEffectFact> effects;
+			std::vector<std::pair<std::uint32_t, VALIDATION::Verdict>> verdicts;
+		};
+
+		class Writer
+		{
+		public:
+			explicit Writer(std::ostream& out) :
+				Out(out)
+			{
+				Out.write(MAGIC.data(), MAGIC.size());
+				Put(VERSION);
+			}
+
+			void Tick(std::uint64_t now, float delta)
+			{
+				Begin(RecordType::kTick, now);
+				Put(delta);
+			}
+
+			void Cast(std::uint64_t now, std::uint32_t spell)
+			{
+				Begin(RecordType::kCast, now);
+				Put(spell);
+			}
+
+			void Maintained(std::uint64_t now, std::span<const VALIDATION::MaintainedFact> spells)
+			{
+				Begin(RecordType::kMaintained, now);
+				Put(static_cast<std::uint32_t>(spells.size()));
+				for (auto const& s : spells) {
+					Put(s.base);
+					Put(s.maintained);
+					Put(s.debuff);
+					Put(s.effectCount);
+					Put(s.exclusiveCount);
+				}
+			}
+
+			void Effects(std::uint64_t now, std::span<const VALIDATION::ActiveEffectFact> effects)
+			{
+				Begin(RecordType::kEffects, now);
+				Put(static_cast<std::uint32_t>(effects.size()));
+				for (auto const& e : effects) {
+					Put(e.spell);
+					Put(e.duration);
+					Put(e.elapsed);
+					Put(e.flags);
+				}
+			}
+
+			void Verdicts(std::uint64_t now, std::span<const std::pair<std::uint32_t, VALIDATION::Verdict>> verdicts)
+			{
+				Begin(RecordType::kVerdicts, now);
+				Put(static_cast<std::uint32_t>(verdicts.size()));
+				for (auto const& [formID, verdict] : verdicts) {
+					Put(formID);
+					Put(static_cast<std::uint8_t>(verdict));
+				}
+			}
+
+			void Message(std::uint64_t now, std::uint32_t type, std::string_view name)
+			{
+				Begin(RecordType::kMessage, now);
+				Put(type);
+				Put(static_cast<std::uint16_t>(name.size()));
+				Out.write(name.data(), static_cast<std::streamsize>(name.size()));
+			}
+
+		private:
+			void Begin(RecordType type, std::uint64_t now)
+			{
+				Put(static_cast<std::uint8_t>(type));
+				Put(static_cast<std::uint32_t>(now - Last));
+				Last = now;
+			}
+
+			template <class T>
+			void Put(T const& value)
+			{
+				Out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+			}
+
+			std::ostream& Out;
+			std::uint64_t Last = 0;
+		};
+
+		class Reader
+		{
+		public:
+			explicit Reader(std::istream& in) :
+				In(in)
+			{
+				std::array<char, 8> magic{};
+				In.read(magic.data(), magic.size());
+				std::uint32_t version = 0;
+				Valid = In && magic == MAGIC && Get(version) && version == VERSION;
+			}
+
+			bool IsValid() const { return Valid; }
+
+			// Returns false at the end of the trace or on a truncated record.
+			bool Next(Record& record)
+			{
+				std::uint8_t type = 0;
+				std::uint32_t elapsed = 0;
+				if (!Valid || !Get(type) || !Get(elapsed))
+					return false;
+				Now += elapsed;
+				record.type = static_cast<RecordType>(type);
+				record.timestamp = Now;
+
+				std::uint32_t count = 0;
+				switch (record.type) {
+				case RecordType::kTick:
+					return Get(record.delta);
+				case RecordType::kCast:
+					return Get(record.formID);
+				case RecordType::kMaintained:
+					if (!Get(count))
+						return false;
+					record.maintained.resize(count);
+					for (auto& s : record.maintained) {
+						if (!Get(s.base) || !Get(s.maintained) || !Get(s.debuff) || !Get(s.effectCount) || !Get(s.exclusiveCount))
+							return false;
+					}
+					return true;
+				case RecordType::kEffects:
+					if (!Get(count))
+						return false;
+					record.effects.resize(count);
+					for (auto& e : record.effects) {
+						if (!Get(e.spell) || !Get(e.duration) || !Get(e.elapsed) || !Get(e.flags))
+							return false;
+					}
+					return true;
+				case RecordType::kVerdicts:
+					if (!Get(count))
+						return false;
+					record.verdicts.resize(count);
+					for (auto& [formID, verdict] : record.verdicts) {
+						std::uint8_t raw = 0;
+						if (!Get(formID) || !Get(raw))
+							return false;
+						verdict = static_cast<VALIDATION::Verdict>(raw);
+					}
+					return true;
+				case RecordType::kMessage:
+					{
+						std::uint16_t length = 0;
+						if (!Get(record.messageType) || !Get(length))
+							return false;
+						record.name.resize(length);
+						return static_cast<bool>(In.read(record.name.data(), length));
+					}
+				default:
+					return false;
+				}
+			}
+
+		private:
+			template <class T>
+			bool Get(T& value)
+			{
+				return static_cast<bool>(In.read(reinterpret_cast<char*>(&value), sizeof(T)));
+			}
+
+			std::istream& In;
+			std::uint64_t Now = 0;
+			bool Valid = false;
+		};
+	}
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+// Engine independent part of the maintained spell validation. The plugin reduces the active effect list to
+// plain facts and feeds them through here, so the same decisions can be replayed offline from a trace.
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace MAINT
+{
+	namespace VALIDATION
+	{
+		using FormID = std::uint32_t;
+
+		struct ActiveEffectFact
+		{
+			enum Flag : std::uint8_t
+			{
+				kNone = 0,
+				kFromSpell = 1 << 0,
+				kUpkeepDebuff = 1 << 1,
+				kMaintainedKeyword = 1 << 2,
+				kInactive = 1 << 3
+			};
+
+			FormID spell;
+			float duration;
+			float elapsed;
+			std::uint8_t flags;
+		};
+
+		struct MaintainedFact
+		{
+			FormID base;
+			FormID maintained;
+			FormID debuff;
+			std::uint16_t effectCount;
+			std::uint16_t exclusiveCount;
+		};
+
+		enum class Verdict : std::uint8_t
+		{
+			kKeep,
+			kNotFound,
+			kTooManyEffects,
+			kSourceMismatch,
+			kMissingExclusives,
+			kWrongDuration,
+			kNoActiveEffects
+		};
+
+		constexpr std::string_view ToString(Verdict verdict)
+		{
+			switch (verdict) {
+			case Verdict::kKeep:
+				return "Keep";
+			case Verdict::kNotFound:
+				return "NotFound";
+			case Verdict::kTooManyEffects:
+				return "TooManyEffects";
+			case Verdict::kSourceMismatch:
+				return "SourceMismatch";
+			case Verdict::kMissingExclusives:
+				return "MissingExclusives";
+			case Verdict::kWrongDuration:
+				return "WrongDuration";
+			case Verdict::kNoActiveEffects:
+				return "NoActiveEffects";
+			default:
+				return "Unknown";
+			}
+		}
+
+		// Active effect indices grouped by the maintained spell they count towards. Reused between sweeps.
+		using Grouping = std::unordered_map<FormID, std::vector<std::uint32_t>>;
+
+		// Effects of a base spell count towards its maintained version, effects of any spell carrying the
+		// maintained keyword count towards that spell. Upkeep debuffs are ignored.
+		// Grouping by FormID is safe even though the IDs of discarded spells are reused: a pass discards its
+		// spells only after all verdicts are in, and the plugin reports effects of deleted forms without
+		// kFromSpell, so a dead spell's lingering effects never count towards the one that took over its ID.
+		inline void GroupEffects(std::span<const ActiveEffectFact> effects, std::unordered_map<FormID, FormID> const& baseToMaintained, Grouping& out)
+		{
+			for (auto& [_, indices] : out)
+				indices.clear();
+			for (std::uint32_t i = 0; i < effects.size(); ++i) {
+				auto const& e = effects[i];
+				if (!(e.flags & ActiveEffectFact::kFromSpell) || (e.flags & ActiveEffectFact::kUpkeepDebuff))
+					continue;
+				if (auto const& it = baseToMaintained.find(e.spell); it != baseToMaintained.end())
+					out[it->second].push_back(i);
+				else if (e.flags & ActiveEffectFact::kMaintainedKeyword)
+					out[e.spell].push_back(i);
+			}
+		}
+
+		inline Verdict Evaluate(MaintainedFact const& spell, std::span<const ActiveEffectFact> effects, std::span<const std::uint32_t> group)
+		{
+			constexpr std::uint32_t HUGE_DUR = 60 * 60 * 24 * 356;
+
+			if (group.empty())
+				return Verdict::kNotFound;
+
+			if (spell.effectCount < group.size())
+				return Verdict::kTooManyEffects;
+
+			if (spell.effectCount > group.size()) {
+				for (auto const& i : group) {
+					if (effects[i].spell != spell.maintained)
+						return Verdict::kSourceMismatch;
+				}
+				if (spell.exclusiveCount > group.size())
+					return Verdict::kMissingExclusives;
+			} else {
+				for (auto const& i : group) {
+					auto const& e = effects[i];
+					if (e.duration > 0.0 && static_cast<std::uint32_t>(e.duration - e.elapsed) < HUGE_DUR)
+						return Verdict::kWrongDuration;
+				}
+			}
+
+			for (auto const& i : group) {
+				if (!(effects[i].flags & ActiveEffectFact::kInactive))
+					return Verdict::kKeep;
+			}
+			return Verdict::kNoActiveEffects;
+		}
+	}
+}
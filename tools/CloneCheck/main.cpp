@@ -0,0 +1,219 @@
+// Runs the engine independent part of cloning a spell (keyword merge, name interning and the effect array copy)
+// against a fake form type and counts every operator new on the way. Checks that a clone stays within a fixed
+// number of allocations, that cloning the same base spell again allocates no name, and compares the keyword
+// merge against a model of the engine's AddKeyword.
+// Usage: CloneCheck [--keywords N] [--spells N]
+
+#include "SpellClone.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+	std::size_t Allocations = 0;
+}
+
+void* operator new(std::size_t size)
+{
+	++Allocations;
+	if (void* ptr = std::malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+namespace
+{
+	// Keyword array, form creation, effect array and, on first use of a base spell, its name. The name costs
+	// the cache entry, a bucket array when the cache grows, the buffer and the pooled string.
+	constexpr std::size_t CLONE_ALLOCATIONS = 3;
+	constexpr std::size_t FIRST_CLONE_ALLOCATIONS = CLONE_ALLOCATIONS + 5;
+
+	struct Keyword
+	{
+		int id;
+	};
+
+	struct Effect
+	{
+		int id;
+	};
+
+	// Pooled like the engine's strings: equal text shares one pointer, so names compare by data().
+	class FixedString
+	{
+	public:
+		FixedString() = default;
+
+		FixedString(std::string const& text) :
+			Text(Pool().insert(text).first->c_str())
+		{}
+
+		const char* data() const
+		{
+			return Text;
+		}
+
+		bool empty() const
+		{
+			return *Text == '\0';
+		}
+
+	private:
+		static std::unordered_set<std::string>& Pool()
+		{
+			static std::unordered_set<std::string> pool;
+			return pool;
+		}
+
+		const char* Text = "";
+	};
+
+	// Same layout as the engine's spell where it matters: a raw keyword array and its length.
+	struct Spell
+	{
+		std::uint32_t formID = 0;
+		FixedString fullName;
+		Keyword** keywords = nullptr;
+		std::uint32_t numKeywords = 0;
+		std::vector<Effect*> effects;
+
+		~Spell()
+		{
+			delete[] keywords;
+		}
+	};
+
+	Spell* Clone(Spell const& base, MAINT::NameCache<std::uint32_t, FixedString>& names, Keyword* const& maintained)
+	{
+		auto clone = new Spell();
+		clone->fullName = names.Get(base.formID, base.fullName, "Maintained ");
+		const auto& [keywords, count] = MAINT::KEYWORDS::Merge(std::span<Keyword* const>(base.keywords, base.numKeywords), { nullptr, maintained }, [](std::size_t size) { return new Keyword*[size]; });
+		clone->keywords = keywords;
+		clone->numKeywords = count;
+		clone->effects = base.effects;
+		return clone;
+	}
+
+	void AddKeyword(Spell& form, Keyword* const& keyword)
+	{
+		std::vector<Keyword*> copied{ form.keywords, form.keywords + form.numKeywords };
+		if (std::find(copied.begin(), copied.end(), keyword) != copied.end())
+			return;
+		copied.push_back(keyword);
+		auto grown = new Keyword*[copied.size()];
+		std::copy(copied.begin(), copied.end(), grown);
+		delete[] form.keywords;
+		form.keywords = grown;
+		form.numKeywords = static_cast<std::uint32_t>(copied.size());
+	}
+
+	int Failures = 0;
+
+	void Check(bool condition, const char* what)
+	{
+		if (!condition) {
+			++Failures;
+			std::printf("FAILED: %s\n", what);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::size_t keywordCount = 12;
+	std::size_t spellCount = 64;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--keywords") == 0 && i + 1 < argc)
+			keywordCount = std::strtoull(argv[++i], nullptr, 10);
+		else if (std::strcmp(argv[i], "--spells") == 0 && i + 1 < argc)
+			spellCount = std::strtoull(argv[++i], nullptr, 10);
+	}
+
+	std::vector<Keyword> pool(keywordCount + 1);
+	for (std::size_t i = 0; i < pool.size(); ++i)
+		pool[i].id = static_cast<int>(i);
+	Keyword* const maintained = &pool[keywordCount];
+	std::vector<Effect> effects(3);
+
+	std::vector<std::unique_ptr<Spell>> bases;
+	for (std::size_t s = 0; s < spellCount; ++s) {
+		auto& base = *bases.emplace_back(std::make_unique<Spell>());
+		base.formID = static_cast<std::uint32_t>(0x12000 + s);
+		base.fullName = std::string("A base spell with a name longer than any small string ") + std::to_string(s);
+		base.keywords = new Keyword*[keywordCount];
+		base.numKeywords = static_cast<std::uint32_t>(keywordCount);
+		for (std::size_t i = 0; i < keywordCount; ++i)
+			base.keywords[i] = i == keywordCount / 2 ? nullptr : &pool[i];
+		for (auto& effect : effects)
+			base.effects.push_back(&effect);
+	}
+
+	// First clone of every base spell, then all of them again: only the second round may reuse the names
+	MAINT::NameCache<std::uint32_t, FixedString> names;
+	std::vector<std::unique_ptr<Spell>> clones;
+	clones.reserve(spellCount * 3);
+	std::size_t firstWorst = 0;
+	std::size_t againWorst = 0;
+	for (int round = 0; round < 2; ++round) {
+		for (auto const& base : bases) {
+			const auto before = Allocations;
+			clones.emplace_back(Clone(*base, names, maintained));
+			auto& worst = round == 0 ? firstWorst : againWorst;
+			worst = (std::max)(worst, Allocations - before);
+		}
+	}
+	Check(firstWorst <= FIRST_CLONE_ALLOCATIONS, "A first clone stays within its allocation bound");
+	Check(againWorst == CLONE_ALLOCATIONS, "Cloning a base spell again allocates no name");
+
+	const auto& first = *clones.front();
+	const auto& again = *clones[spellCount];
+	Check(first.fullName.data() == again.fullName.data(), "Both clones share the interned name");
+	Check(std::string_view(first.fullName.data()).starts_with("Maintained A base spell"), "The name is prefixed");
+	Check(first.numKeywords == keywordCount - (keywordCount > 0 ? 1 : 0) + 1, "Nulls are dropped and the maintained keyword added");
+	Check(first.effects == bases.front()->effects, "Effects are copied");
+
+	// A renamed base spell gets a new name instead of the cached one
+	bases.front()->fullName = std::string("Renamed");
+	clones.emplace_back(Clone(*bases.front(), names, maintained));
+	Check(std::strcmp(clones.back()->fullName.data(), "Maintained Renamed") == 0, "A renamed base spell is renamed in its clone");
+
+	// The engine path for the keywords alone: one AddKeyword per keyword of the base spell, then the extra one
+	Spell added;
+	auto before = Allocations;
+	for (std::uint32_t i = 0; i < bases.back()->numKeywords; ++i) {
+		if (bases.back()->keywords[i])
+			AddKeyword(added, bases.back()->keywords[i]);
+	}
+	AddKeyword(added, maintained);
+	const auto addKeywordAllocations = Allocations - before;
+	const auto& merged = *clones[spellCount - 1];
+	Check(std::equal(merged.keywords, merged.keywords + merged.numKeywords, added.keywords, added.keywords + added.numKeywords), "Merge keeps the keywords and order of AddKeyword");
+
+	std::printf("%zu keywords: first clone at most %zu allocations, again %zu, keywords through AddKeyword alone %zu\n",
+		keywordCount, firstWorst, againWorst, addKeywordAllocations);
+
+	if (Failures > 0) {
+		std::printf("%d checks failed\n", Failures);
+		return 1;
+	}
+	std::printf("All checks passed\n");
+	return 0;
+}
@@ -0,0 +1,96 @@
+// Hammers the flight recorder from several producer threads while a reader keeps taking snapshots, and
+// checks that every snapshot only holds whole records in order. Then prints a small dump as a sample.
+// Meant to be run with -fsanitize=thread as well (see tools/CMakeLists.txt).
+// Usage: FlightCheck [--producers N] [--records N]
+
+#include "FlightRecorder.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+	using namespace MAINT;
+
+	std::size_t producers = 4;
+	std::size_t records = 200000;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--producers") == 0 && i + 1 < argc)
+			producers = static_cast<std::size_t>(std::atoll(argv[++i]));
+		else if (std::strcmp(argv[i], "--records") == 0 && i + 1 < argc)
+			records = static_cast<std::size_t>(std::atoll(argv[++i]));
+		else {
+			std::fprintf(stderr, "Usage: %s [--producers N] [--records N]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	// Every record carries its producer and a per-producer counter in three places, a torn copy would disagree
+	static FLIGHT::Recorder<1024> recorder;
+	std::atomic<std::size_t> running{ producers };
+	std::vector<std::thread> threads;
+	for (std::size_t p = 0; p < producers; ++p) {
+		threads.emplace_back([&, p]() {
+			for (std::uint32_t n = 0; n < records; ++n) {
+				FLIGHT::Record record;
+				record.subject = n;
+				record.other = n;
+				record.value = static_cast<float>(n & 0xFFFF);
+				record.count = static_cast<std::uint16_t>(n);
+				record.extra = static_cast<std::uint16_t>(p);
+				record.detail = static_cast<std::uint8_t>(p);
+				record.kind = FLIGHT::Kind::kCast;
+				recorder.Push(record);
+			}
+			running.fetch_sub(1);
+		});
+	}
+
+	int failures = 0;
+	std::size_t snapshots = 0;
+	std::size_t seen = 0;
+	while (running.load() > 0) {
+		const auto& snapshot = recorder.Snapshot();
+		++snapshots;
+		seen += snapshot.size();
+		std::vector<std::int64_t> last(producers, -1);
+		for (std::size_t i = 0; i < snapshot.size(); ++i) {
+			auto const& r = snapshot[i];
+			const auto& torn = r.subject != r.other || r.value != static_cast<float>(r.subject & 0xFFFF) || r.count != static_cast<std::uint16_t>(r.subject) || r.extra != r.detail || r.detail >= producers;
+			const auto& unordered = !torn && static_cast<std::int64_t>(r.subject) <= last[r.detail];
+			if (torn || unordered || (i > 0 && r.time + 1000000 < snapshot[i - 1].time)) {
+				if (++failures <= 5)
+					std::printf("%s record at %zu\n", torn ? "torn" : "out of order", i);
+			}
+			if (!torn)
+				last[r.detail] = r.subject;
+		}
+	}
+	for (auto& thread : threads)
+		thread.join();
+
+	const auto& final = recorder.Snapshot();
+	if (recorder.Recorded() != producers * records || final.size() != (std::min)(recorder.GetCapacity(), producers * records)) {
+		++failures;
+		std::printf("final snapshot holds %zu of %llu records\n", final.size(), static_cast<unsigned long long>(recorder.Recorded()));
+	}
+	std::printf("%llu records, %zu snapshots averaging %zu records, %d failures\n", static_cast<unsigned long long>(recorder.Recorded()), snapshots,
+		snapshots ? seen / snapshots : 0, failures);
+
+	FLIGHT::Recorder<16> sample;
+	sample.Push({ .kind = FLIGHT::Kind::kMessage, .detail = static_cast<std::uint8_t>(FLIGHT::Message::kPostLoad) });
+	sample.Push({ .subject = 0x0001C789, .kind = FLIGHT::Kind::kCast });
+	sample.Push({ .subject = 0x0001C789, .other = 0xFE000801, .value = 42.0f, .kind = FLIGHT::Kind::kMaintain });
+	sample.Push({ .subject = 0x0001C789, .other = 0xFE000801, .count = 2, .count2 = 1, .kind = FLIGHT::Kind::kVerdict, .detail = static_cast<std::uint8_t>(VALIDATION::Verdict::kWrongDuration) });
+	sample.Push({ .subject = 0x0001C789, .other = 0xFE000801, .value = 60.0f, .value2 = 60.5f, .kind = FLIGHT::Kind::kEffect, .detail = VALIDATION::ActiveEffectFact::kFromSpell });
+	sample.Push({ .subject = 0x0001C789, .other = 0xFE000801, .kind = FLIGHT::Kind::kRemoval, .detail = static_cast<std::uint8_t>(VALIDATION::Verdict::kWrongDuration) });
+	sample.Push({ .other = 12, .value = 0.042f, .count = 1, .count2 = 1, .kind = FLIGHT::Kind::kSweep });
+	const auto& dump = sample.Snapshot();
+	FLIGHT::WriteText(std::cout, dump, "sample", sample.Now(), [](std::uint32_t formID) { return std::string(formID == 0x0001C789 ? "Oakflesh" : ""); });
+	return failures > 0 ? 1 : 0;
+}
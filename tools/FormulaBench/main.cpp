@@ -0,0 +1,92 @@
+// Compiles the default upkeep cost formula and races the interpreted program against the native curve the plugin
+// runs for it, over a batch of random spells. Also checks that both agree on every spell.
+// Usage: FormulaBench [--spells N] [--rounds N] [--formula TEXT]
+
+#include "Formula.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace
+{
+	using namespace MAINT::FORMULA;
+
+	template <class Func>
+	double NanosecondsPerSpell(std::size_t rounds, std::size_t spells, Func&& func)
+	{
+		const auto& start = std::chrono::steady_clock::now();
+		for (std::size_t round = 0; round < rounds; ++round)
+			func();
+		const auto& elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		return elapsed / static_cast<double>(rounds * spells);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::size_t spells = 1000;
+	std::size_t rounds = 2000;
+	std::string_view text = DEFAULT_UPKEEP_COST;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--spells") == 0 && i + 1 < argc)
+			spells = static_cast<std::size_t>(std::atoll(argv[++i]));
+		else if (std::strcmp(argv[i], "--rounds") == 0 && i + 1 < argc)
+			rounds = static_cast<std::size_t>(std::atoll(argv[++i]));
+		else if (std::strcmp(argv[i], "--formula") == 0 && i + 1 < argc)
+			text = argv[++i];
+		else {
+			std::fprintf(stderr, "Usage: %s [--spells N] [--rounds N] [--formula TEXT]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	Program program;
+	std::string error;
+	if (!Compiler::Compile(text, program, error)) {
+		std::fprintf(stderr, "Formula does not compile: %s\n", error.c_str());
+		return 1;
+	}
+	std::printf("%zu instructions%s\n", program.Size(), program.IsNative() ? ", native" : "");
+	// Races the interpreter, whatever the plugin would pick
+	program.Interpret();
+
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> cost(5.0f, 500.0f);
+	std::uniform_int_distribution<int> duration(1, 600);
+	std::uniform_int_distribution<int> stretch(0, 3);
+	constexpr float EXPONENTS[]{ 0.0f, 1.0f, 2.0f, -1.0f };
+	constexpr float NEUTRALS[]{ 0.0f, 60.0f, 120.0f };
+	std::vector<Inputs> inputs(spells);
+	for (auto& in : inputs) {
+		in[kBaseCost] = std::round(cost(rng));
+		in[kBaseDuration] = static_cast<float>(duration(rng));
+		in[kDuration] = in[kBaseDuration] * (stretch(rng) == 0 ? 1.5f : 1.0f);
+		in[kSkill] = 50.0f;
+		in[kCount] = static_cast<float>(spells);
+		in[kNeutralDuration] = NEUTRALS[rng() % std::size(NEUTRALS)];
+		in[kExponent] = EXPONENTS[rng() % std::size(EXPONENTS)];
+	}
+
+	std::vector<float> compiled(spells);
+	std::vector<float> native(spells);
+	const auto& compiledNs = NanosecondsPerSpell(rounds, spells, [&]() { program.EvaluateBatch(inputs, compiled); });
+	const auto& nativeNs = NanosecondsPerSpell(rounds, spells, [&]() {
+		for (std::size_t i = 0; i < spells; ++i)
+			native[i] = DefaultUpkeepCost(inputs[i]);
+	});
+
+	std::size_t mismatches = 0;
+	for (std::size_t i = 0; i < spells; ++i) {
+		if (compiled[i] != native[i] && ++mismatches <= 5)
+			std::printf("mismatch: cost %.0f duration %.0f/%.0f neutral %.0f exponent %.0f -> %f vs %f\n",
+				inputs[i][kBaseCost], inputs[i][kBaseDuration], inputs[i][kDuration], inputs[i][kNeutralDuration], inputs[i][kExponent], compiled[i], native[i]);
+	}
+
+	std::printf("compiled: %.1f ns/spell\nnative:   %.1f ns/spell\n%zu of %zu spells differ\n", compiledNs, nativeNs, mismatches, spells);
+	return text == DEFAULT_UPKEEP_COST && mismatches > 0 ? 1 : 0;
+}
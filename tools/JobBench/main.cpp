@@ -0,0 +1,159 @@
+// Checks the job pool's guarantees (results, continuations, the main queue, cancellation, nested waits) and then
+// measures how upkeep cost math spread over ParallelFor scales from 1 to N workers.
+// Usage: JobBench [--workers N] [--batches N] [--spells N] [--rounds N]
+
+#include "Formula.h"
+#include "Jobs.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	using namespace MAINT;
+
+	int Failures = 0;
+
+	void Check(bool condition, const char* what)
+	{
+		if (!condition) {
+			std::printf("FAILED: %s\n", what);
+			++Failures;
+		}
+	}
+
+	void CheckSemantics(std::size_t workers)
+	{
+		JOBS::Pool pool;
+		pool.Start(workers);
+
+		const auto& answer = pool.Submit([]() { return 6; }).Then([](int value) { return value * 7; });
+		Check(answer.Get() == 42, "continuation sees the result");
+
+		const auto& failing = pool.Submit([]() -> int { throw std::runtime_error("boom"); }).Then([](int value) { return value + 1; });
+		failing.Wait();
+		bool thrown = false;
+		try {
+			failing.Get();
+		} catch (std::runtime_error const&) {
+			thrown = true;
+		}
+		Check(thrown, "exceptions travel down the chain");
+
+		// Main thread continuations only run when drained
+		std::thread::id ranOn;
+		const auto& onMain = pool.Submit([]() { return 1; }).Then([&](int) { ranOn = std::this_thread::get_id(); }, JOBS::Affinity::kMain);
+		const auto& deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+		while (!onMain.IsDone() && std::chrono::steady_clock::now() < deadline) {
+			pool.DrainMain();
+			std::this_thread::yield();
+		}
+		Check(ranOn == std::this_thread::get_id(), "main queue runs on the draining thread");
+
+		// A load cancels unstarted cancellable work and whatever hangs off it, but nothing else
+		const auto& queued = pool.Submit([]() { return 1; }, JOBS::Affinity::kMain, JOBS::Cancel::kOnLoad);
+		const auto& chained = queued.Then([](int value) { return value + 1; });
+		const auto& kept = pool.Submit([]() { return 2; }, JOBS::Affinity::kMain);
+		pool.CancelOnLoad();
+		pool.DrainMain();
+		chained.Wait();
+		Check(queued.IsCancelled() && chained.IsCancelled(), "cancelled on load");
+		Check(!kept.IsCancelled() && kept.Get() == 2, "uncancellable job survives a load");
+		const auto& fresh = pool.Submit([]() { return 3; }, JOBS::Affinity::kWorker, JOBS::Cancel::kOnLoad);
+		Check(fresh.Get() == 3, "jobs submitted after a load run");
+
+		// Waiting inside a job, even with a single worker, must not deadlock
+		const auto& nested = pool.Submit([&pool]() {
+			std::atomic<int> sum{ 0 };
+			pool.ParallelFor(100, [&](std::size_t i) { sum += static_cast<int>(i); });
+			return sum.load() + pool.Submit([]() { return 1; }).Get();
+		});
+		Check(nested.Get() == 4951, "nested ParallelFor and Wait");
+	}
+
+	struct Workload
+	{
+		FORMULA::Program program;
+		std::vector<std::vector<FORMULA::Inputs>> inputs;
+		std::vector<std::vector<float>> costs;
+	};
+
+	Workload MakeWorkload(std::size_t batches, std::size_t spells)
+	{
+		Workload ret;
+		std::string error;
+		FORMULA::Compiler::Compile(FORMULA::DEFAULT_UPKEEP_COST, ret.program, error);
+		std::mt19937 rng(42);
+		std::uniform_real_distribution<float> cost(5.0f, 500.0f);
+		std::uniform_real_distribution<float> duration(1.0f, 600.0f);
+		ret.inputs.resize(batches, std::vector<FORMULA::Inputs>(spells));
+		ret.costs.resize(batches, std::vector<float>(spells));
+		for (auto& batch : ret.inputs) {
+			for (auto& in : batch) {
+				in[FORMULA::kBaseCost] = cost(rng);
+				in[FORMULA::kBaseDuration] = duration(rng);
+				in[FORMULA::kDuration] = in[FORMULA::kBaseDuration];
+				in[FORMULA::kSkill] = 50.0f;
+				in[FORMULA::kCount] = static_cast<float>(spells);
+				in[FORMULA::kNeutralDuration] = 60.0f;
+				in[FORMULA::kExponent] = 1.0f;
+			}
+		}
+		return ret;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::size_t maxWorkers = (std::max)(4u, std::thread::hardware_concurrency());
+	std::size_t batches = 512;
+	std::size_t spells = 256;
+	std::size_t rounds = 20;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+			maxWorkers = static_cast<std::size_t>(std::atoll(argv[++i]));
+		else if (std::strcmp(argv[i], "--batches") == 0 && i + 1 < argc)
+			batches = static_cast<std::size_t>(std::atoll(argv[++i]));
+		else if (std::strcmp(argv[i], "--spells") == 0 && i + 1 < argc)
+			spells = static_cast<std::size_t>(std::atoll(argv[++i]));
+		else if (std::strcmp(argv[i], "--rounds") == 0 && i + 1 < argc)
+			rounds = static_cast<std::size_t>(std::atoll(argv[++i]));
+		else {
+			std::fprintf(stderr, "Usage: %s [--workers N] [--batches N] [--spells N] [--rounds N]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	for (std::size_t workers : { std::size_t{ 0 }, std::size_t{ 1 }, maxWorkers })
+		CheckSemantics(workers);
+	std::printf("semantics: %d failures\n", Failures);
+
+	auto workload = MakeWorkload(batches, spells);
+	std::printf("%u hardware threads, %zu batches of %zu spells, %zu rounds\n", std::thread::hardware_concurrency(), batches, spells, rounds);
+	std::printf("workers      ms   speedup  efficiency   stolen\n");
+	double baseline = 0.0;
+	for (std::size_t workers = 1; workers <= maxWorkers; ++workers) {
+		JOBS::Pool pool;
+		// The calling thread joins in, so workers - 1 pool threads give workers threads of computation
+		pool.Start(workers - 1);
+		const auto& start = std::chrono::steady_clock::now();
+		for (std::size_t round = 0; round < rounds; ++round) {
+			pool.ParallelFor(batches, [&](std::size_t batch) {
+				workload.program.EvaluateBatch(workload.inputs[batch], workload.costs[batch]);
+			});
+		}
+		const auto& ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (workers == 1)
+			baseline = ms;
+		const auto& speedup = baseline / ms;
+		std::printf("%7zu %7.1f %9.2f %10.0f%% %8llu\n", workers, ms, speedup, 100.0 * speedup / static_cast<double>(workers),
+			static_cast<unsigned long long>(pool.GetCounters().stolen));
+	}
+	return Failures > 0 ? 1 : 0;
+}
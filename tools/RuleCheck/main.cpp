@@ -0,0 +1,92 @@
+// Compiles the default [RULES] and checks them against the eligibility chain the plugin used to hard-code,
+// over every combination of casting type, delivery and archetype plus the duration, cost and keyword edges.
+// Usage: RuleCheck
+
+#include "Rules.h"
+
+#include <cstdio>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+	using namespace MAINT::RULES;
+
+	constexpr std::uint8_t FIRE_AND_FORGET = 1;
+	constexpr std::uint8_t SELF = 0;
+	constexpr std::uint8_t BOUND_WEAPON = 17;
+	constexpr std::uint8_t SUMMON_CREATURE = 18;
+
+	// The chain as it was written in IsMaintainable before the rules existed.
+	bool Legacy(SpellFacts const& spell, bool excludedKeyword)
+	{
+		if (spell.isScroll || spell.isEnchantment || spell.effectCount == 0)
+			return false;
+		if (spell.castingType != FIRE_AND_FORGET)
+			return false;
+		if (spell.duration <= 5.0f)
+			return false;
+		if (spell.cost <= 5.0f && spell.baseCost <= 5.0f)
+			return false;
+		if (excludedKeyword)
+			return false;
+		if (spell.delivery != SELF)
+			return spell.archetype == SUMMON_CREATURE;
+		return spell.archetype != BOUND_WEAPON;
+	}
+}
+
+int main()
+{
+	const RuleText text{
+		DEFAULT_CASTING_TYPES,
+		DEFAULT_DELIVERIES,
+		DEFAULT_ANY_DELIVERY_ARCHETYPES,
+		DEFAULT_EXCLUDED_ARCHETYPES,
+		DEFAULT_EXCLUDED_KEYWORDS,
+		DEFAULT_KEEP_FX_ARCHETYPES,
+		DEFAULT_MIN_DURATION,
+		DEFAULT_MIN_COST
+	};
+	std::vector<std::string> problems;
+	const auto& rules = Compile<const char*>(text, [](std::string_view name) -> const char* {
+		return name == "_m3HealerDummySpell" ? "_m3HealerDummySpell" : nullptr;
+	}, problems);
+	for (auto const& problem : problems)
+		std::printf("problem: %s\n", problem.c_str());
+
+	std::size_t checked = 0;
+	std::size_t failures = 0;
+	for (std::uint8_t castingType = 0; castingType < CASTING_TYPES.size(); ++castingType)
+		for (std::uint8_t delivery = 0; delivery < DELIVERIES.size(); ++delivery)
+			for (std::uint8_t archetype = 0; archetype < ARCHETYPES.size(); ++archetype)
+				for (auto const& duration : { 0.0f, 5.0f, 5.5f, 60.0f })
+					for (auto const& cost : { 0.0f, 5.0f, 30.0f })
+						for (auto const& baseCost : { 5.0f, 30.0f })
+							for (auto const& keyworded : { false, true })
+								for (auto const& kind : { 0, 1, 2, 3 }) {
+									const SpellFacts spell{ kind == 1, kind == 2, kind == 3 ? 0u : 2u, castingType, delivery, archetype, duration, cost, baseCost };
+									const auto& verdict = rules.Evaluate(spell, [&](const char* const&) { return keyworded; });
+									++checked;
+									if ((verdict == Verdict::kMaintainable) != Legacy(spell, keyworded)) {
+										if (++failures <= 10)
+											std::printf("mismatch: %s %s %s duration %.1f cost %.1f/%.1f keyword %d kind %d -> %.*s\n",
+												CASTING_TYPES[castingType].data(), DELIVERIES[delivery].data(), ARCHETYPES[archetype].data(),
+												duration, cost, baseCost, keyworded, kind, static_cast<int>(ToString(verdict).size()), ToString(verdict).data());
+									}
+								}
+
+	// Mirrors the archetype switch SilenceSpellFX used to have
+	constexpr std::string_view kept[]{ "Light", "BoundWeapon", "Disguise", "SummonCreature", "NightEye", "Invisibility", "Guide", "Werewolf", "WerewolfFeed" };
+	for (std::uint8_t archetype = 0; archetype < ARCHETYPES.size(); ++archetype) {
+		const auto& expected = std::find(std::begin(kept), std::end(kept), ARCHETYPES[archetype]) != std::end(kept);
+		++checked;
+		if (rules.KeepsFX(archetype) != expected) {
+			++failures;
+			std::printf("mismatch: KeepsFX(%s)\n", ARCHETYPES[archetype].data());
+		}
+	}
+
+	std::printf("%zu cases, %zu mismatches, %zu problems\n", checked, failures, problems.size());
+	return failures == 0 && problems.empty() ? 0 : 1;
+}
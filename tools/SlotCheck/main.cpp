@@ -0,0 +1,143 @@
+// Runs random inserts and erases against the slot table and a plain map side by side, checks that both agree
+// and that handles of erased or cleared rows are rejected, then times a summing pass over both layouts.
+// Usage: SlotCheck [--operations N] [--rows N]
+
+#include "SlotTable.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace
+{
+	struct Spell
+	{
+		int id;
+	};
+
+	using Table = MAINT::SlotTable<Spell, int>;
+
+	int Failures = 0;
+
+	void Check(bool condition, const char* what)
+	{
+		if (!condition) {
+			if (++Failures <= 5)
+				std::printf("FAILED: %s\n", what);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::size_t operations = 200000;
+	std::size_t rows = 48;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--operations") == 0 && i + 1 < argc)
+			operations = static_cast<std::size_t>(std::atoll(argv[++i]));
+		else if (std::strcmp(argv[i], "--rows") == 0 && i + 1 < argc)
+			rows = static_cast<std::size_t>(std::atoll(argv[++i]));
+		else {
+			std::fprintf(stderr, "Usage: %s [--operations N] [--rows N]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	std::vector<Spell> spells(rows * 2);
+	for (std::size_t i = 0; i < spells.size(); ++i)
+		spells[i].id = static_cast<int>(i);
+
+	Table table;
+	std::map<Spell*, std::pair<MAINT::SlotHandle, float>> model;
+	std::vector<MAINT::SlotHandle> stale;
+	std::mt19937 rng(7);
+	for (std::size_t op = 0; op < operations; ++op) {
+		auto& spell = spells[rng() % spells.size()];
+		switch (rng() % 8) {
+		case 0:
+		case 1:
+		case 2:
+			{
+				const auto& cost = static_cast<float>(rng() % 1000);
+				const auto& handle = table.Insert({ &spell, &spells[0], nullptr, cost, 1.0f, spell.id, Table::kNone });
+				if (const auto& it = model.find(&spell); it != model.end())
+					Check(it->second.first == handle, "reinsert keeps the handle");
+				model[&spell] = { handle, cost };
+				break;
+			}
+		case 3:
+		case 4:
+			if (const auto& it = model.find(&spell); it != model.end()) {
+				const auto handle = it->second.first;
+				Check(table.Erase(handle), "erase by handle");
+				Check(!table.Erase(handle), "second erase rejected");
+				stale.push_back(handle);
+				model.erase(it);
+			} else {
+				Check(!table.EraseBase(&spell), "erase of a missing base");
+			}
+			break;
+		case 5:
+			if (const auto& it = model.find(&spell); it != model.end()) {
+				const auto& index = table.Find(it->second.first);
+				Check(index != Table::NPOS && table.Bases()[index] == &spell, "handle finds its row");
+				table.Costs()[index] += 1.0f;
+				it->second.second += 1.0f;
+			}
+			break;
+		case 6:
+			if (!stale.empty()) {
+				Check(table.Find(stale[rng() % stale.size()]) == Table::NPOS, "stale handle rejected");
+			}
+			break;
+		default:
+			if (rng() % 1000 == 0) {
+				for (auto const& [_, entry] : model)
+					stale.push_back(entry.first);
+				table.Clear();
+				model.clear();
+			}
+			break;
+		}
+	}
+
+	Check(table.size() == model.size(), "sizes agree");
+	for (auto const& [spell, entry] : model) {
+		const auto& index = table.IndexOf(spell);
+		Check(index != Table::NPOS && table.Find(entry.first) == index, "base and handle agree");
+		Check(index != Table::NPOS && table.Costs()[index] == entry.second && table.Skills()[index] == spell->id, "columns moved along");
+	}
+	for (auto const& handle : stale)
+		Check(table.Find(handle) == Table::NPOS, "stale handle rejected after the run");
+	std::printf("%zu operations, %zu rows left, %zu stale handles, %d failures\n", operations, table.size(), stale.size(), Failures);
+
+	// What the validation and telemetry paths do every sweep: walk every row and sum a value
+	Table full;
+	std::map<Spell*, std::pair<Spell*, Spell*>> forward;
+	std::map<Spell*, float> costs;
+	for (std::size_t i = 0; i < rows; ++i) {
+		full.Insert({ &spells[i], &spells[rows + i], nullptr, static_cast<float>(i), 1.0f, 0, Table::kNone });
+		forward.emplace(&spells[i], std::make_pair(&spells[rows + i], nullptr));
+		costs.emplace(&spells[i], static_cast<float>(i));
+	}
+	constexpr int PASSES = 100000;
+	float sink = 0.0f;
+	auto start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < PASSES; ++pass) {
+		for (std::size_t i = 0; i < full.size(); ++i)
+			sink += full.Costs()[i] + static_cast<float>(full.Maintained()[i]->id);
+	}
+	const auto& tableNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / PASSES;
+	start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < PASSES; ++pass) {
+		for (auto const& [base, pair] : forward)
+			sink += costs.at(base) + static_cast<float>(pair.first->id);
+	}
+	const auto& mapNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / PASSES;
+	std::printf("%zu rows: table %.0fns, maps %.0fns per pass (checksum %.0f)\n", rows, tableNs, mapNs, static_cast<double>(sink));
+	return Failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+// Hammers SnapshotCell with concurrent readers and writers and checks that every view stays consistent
+// while it is held. Meant to be built with -fsanitize=thread (see tools/CMakeLists.txt).
+// Usage: SnapshotStress [--readers N] [--writers N] [--seconds S]
+
+#include "SnapshotCell.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	// Mirrors the plugin's state: a map whose entries all have to agree with the snapshot's stamp.
+	struct State
+	{
+		std::map<std::uint32_t, std::uint64_t> entries;
+		std::uint64_t stamp = 0;
+	};
+
+	bool IsConsistent(State const& state)
+	{
+		for (auto const& [_, value] : state.entries) {
+			if (value != state.stamp)
+				return false;
+		}
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	unsigned readers = 8;
+	unsigned writers = 2;
+	double seconds = 5.0;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--readers") == 0 && i + 1 < argc)
+			readers = static_cast<unsigned>(std::atoi(argv[++i]));
+		else if (std::strcmp(argv[i], "--writers") == 0 && i + 1 < argc)
+			writers = static_cast<unsigned>(std::atoi(argv[++i]));
+		else if (std::strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+			seconds = std::atof(argv[++i]);
+		else {
+			std::fprintf(stderr, "Usage: %s [--readers N] [--writers N] [--seconds S]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	MAINT::SnapshotCell<State> cell;
+	std::atomic<bool> stop{ false };
+	std::atomic<std::uint64_t> reads{ 0 };
+	std::atomic<std::uint64_t> writes{ 0 };
+	std::atomic<std::uint64_t> failures{ 0 };
+
+	std::vector<std::thread> threads;
+	for (unsigned r = 0; r < readers; ++r) {
+		threads.emplace_back([&]() {
+			std::uint64_t lastGeneration = 0;
+			while (!stop.load(std::memory_order_relaxed)) {
+				const auto& view = cell.Read();
+				if (!IsConsistent(*view) || view.Generation() < lastGeneration)
+					failures.fetch_add(1, std::memory_order_relaxed);
+				lastGeneration = view.Generation();
+				// Hold the view for a while so writers have to retire versions around it
+				std::this_thread::yield();
+				if (!IsConsistent(*view))
+					failures.fetch_add(1, std::memory_order_relaxed);
+				reads.fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+	}
+	for (unsigned w = 0; w < writers; ++w) {
+		threads.emplace_back([&, w]() {
+			std::uint32_t key = w;
+			while (!stop.load(std::memory_order_relaxed)) {
+				cell.Update([&](State& state) {
+					++state.stamp;
+					if (state.entries.size() < 256)
+						state.entries.emplace(key, 0);
+					else
+						state.entries.erase(state.entries.begin());
+					for (auto& [_, value] : state.entries)
+						value = state.stamp;
+				});
+				key += writers;
+				writes.fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+	}
+
+	std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+	stop.store(true);
+	for (auto& t : threads)
+		t.join();
+
+	std::printf("%llu reads, %llu writes, %zu versions still retired, %llu inconsistent views\n",
+		static_cast<unsigned long long>(reads.load()), static_cast<unsigned long long>(writes.load()),
+		cell.RetiredCount(), static_cast<unsigned long long>(failures.load()));
+	return failures.load() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
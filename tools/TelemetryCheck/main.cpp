@@ -0,0 +1,123 @@
+// Drives the telemetry endpoint through a local client while a stand-in game thread keeps publishing, and
+// checks every answer. Meant to be run with -fsanitize=thread as well (see tools/CMakeLists.txt).
+// Usage: TelemetryCheck [--requests N] [--path PATH]
+
+#include "Telemetry.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace
+{
+	// One request, one answer, like any external monitor would do it.
+	std::string Ask(std::string const& path, std::string_view request)
+	{
+		std::string answer;
+#ifdef _WIN32
+		const auto& pipe = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+		if (pipe == INVALID_HANDLE_VALUE)
+			return answer;
+		DWORD count = 0;
+		WriteFile(pipe, request.data(), static_cast<DWORD>(request.size()), &count, nullptr);
+		char buffer[1024];
+		while (ReadFile(pipe, buffer, sizeof(buffer), &count, nullptr) && count > 0)
+			answer.append(buffer, count);
+		CloseHandle(pipe);
+#else
+		sockaddr_un address{};
+		address.sun_family = AF_UNIX;
+		path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+		const auto client = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (client < 0 || connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+			if (client >= 0)
+				::close(client);
+			return answer;
+		}
+		if (::write(client, request.data(), request.size()) < 0)
+			return answer;
+		char buffer[1024];
+		for (ssize_t got; (got = ::read(client, buffer, sizeof(buffer))) > 0;)
+			answer.append(buffer, static_cast<std::size_t>(got));
+		::close(client);
+#endif
+		return answer;
+	}
+
+	std::uint64_t FieldOf(std::string const& json, std::string const& name)
+	{
+		const auto& at = json.find("\"" + name + "\":");
+		return at == std::string::npos ? 0 : std::strtoull(json.c_str() + at + name.size() + 3, nullptr, 10);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int requests = 200;
+#ifdef _WIN32
+	std::string path = "\\\\.\\pipe\\MaintainedMagicNG.TelemetryCheck";
+#else
+	std::string path = "/tmp/MaintainedMagicNG.TelemetryCheck.sock";
+#endif
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--requests") == 0 && i + 1 < argc)
+			requests = std::atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "--path") == 0 && i + 1 < argc)
+			path = argv[++i];
+		else {
+			std::fprintf(stderr, "Usage: %s [--requests N] [--path PATH]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	MAINT::TELEMETRY::Endpoint endpoint;
+	endpoint.AddCommand("echo", []() { return std::string("{\"echo\":true}\n"); });
+	std::string error;
+	if (!endpoint.Open(path, error)) {
+		std::fprintf(stderr, "Cannot open %s: %s\n", path.c_str(), error.c_str());
+		return 1;
+	}
+
+	// The stand-in game thread publishes as fast as it can, the maintained count always equals the drain
+	std::atomic<bool> stop{ false };
+	std::thread game([&]() {
+		for (std::uint32_t frame = 1; !stop.load(std::memory_order_relaxed); ++frame) {
+			MAINT::TELEMETRY::Snapshot snapshot;
+			snapshot.maintained = frame;
+			snapshot.totalDrain = static_cast<float>(frame);
+			snapshot.castsSeen = frame;
+			endpoint.Publish(snapshot);
+			std::this_thread::yield();
+		}
+	});
+
+	int failures = 0;
+	std::uint64_t lastSequence = 0;
+	for (int i = 0; i < requests; ++i) {
+		const auto& answer = Ask(path, i % 2 == 0 ? "stats\n" : "\n");
+		const auto& sequence = FieldOf(answer, "sequence");
+		const auto& maintained = FieldOf(answer, "maintained");
+		if (answer.empty() || answer.back() != '\n' || sequence < lastSequence || maintained != FieldOf(answer, "totalDrain") || maintained != FieldOf(answer, "seen")) {
+			if (++failures <= 5)
+				std::printf("bad answer: %s", answer.empty() ? "(none)\n" : answer.c_str());
+		}
+		lastSequence = sequence;
+	}
+	if (Ask(path, "ping\n") != "pong\n" || Ask(path, "echo\n") != "{\"echo\":true}\n" || Ask(path, "bogus\n").find("error") == std::string::npos) {
+		++failures;
+		std::printf("ping, command or unknown request answered wrong\n");
+	}
+
+	stop.store(true);
+	game.join();
+	const auto& served = endpoint.Served();
+	endpoint.Close();
+	if (!Ask(path, "stats\n").empty()) {
+		++failures;
+		std::printf("endpoint still answers after Close\n");
+	}
+
+	std::printf("%llu requests served, last sequence %llu, %d failures\n", static_cast<unsigned long long>(served), static_cast<unsigned long long>(lastSequence), failures);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,291 @@
+// Replays a trace recorded with EventTraceFile through the validation logic and reports
+// the decisions and per-phase timings. Usage: TraceReplay <trace> [--repeat N] [--verbose]
+// With --self-test instead of a trace, replays a synthetic trace written with TRACE::Writer.
+
+#include "TraceFormat.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+namespace
+{
+	using namespace MAINT;
+	using Clock = std::chrono::steady_clock;
+
+	struct PhaseTiming
+	{
+		const char* name;
+		double total = 0.0;
+		double max = 0.0;
+		std::uint64_t count = 0;
+
+		void Add(Clock::duration elapsed)
+		{
+			const double us = std::chrono::duration<double, std::micro>(elapsed).count();
+			total += us;
+			max = std::max(max, us);
+			++count;
+		}
+
+		void Print() const
+		{
+			std::printf("  %-10s %10llu runs  %12.3f us total  %9.3f us avg  %9.3f us max\n", name,
+				static_cast<unsigned long long>(count), total, count ? total / count : 0.0, max);
+		}
+	};
+
+	struct Replay
+	{
+		int repeat = 1;
+		bool verbose = false;
+
+		std::vector<VALIDATION::MaintainedFact> maintained;
+		std::unordered_map<VALIDATION::FormID, VALIDATION::FormID> baseToMaintained;
+		VALIDATION::Grouping groups;
+		std::vector<std::pair<std::uint32_t, VALIDATION::Verdict>> lastVerdicts;
+
+		std::map<TRACE::RecordType, std::uint64_t> records;
+		std::map<VALIDATION::Verdict, std::uint64_t> decisions;
+		std::uint64_t sweeps = 0;
+		std::uint64_t compared = 0;
+		std::uint64_t mismatches = 0;
+		double gameTime = 0.0;
+
+		PhaseTiming decode{ "decode" };
+		PhaseTiming group{ "group" };
+		PhaseTiming evaluate{ "evaluate" };
+
+		void Sweep(TRACE::Record const& record)
+		{
+			lastVerdicts.clear();
+			for (int i = 0; i < repeat; ++i) {
+				auto start = Clock::now();
+				VALIDATION::GroupEffects(record.effects, baseToMaintained, groups);
+				auto grouped = Clock::now();
+				group.Add(grouped - start);
+
+				lastVerdicts.clear();
+				for (auto const& spell : maintained) {
+					auto const& it = groups.find(spell.maintained);
+					auto const& indices = it != groups.end() ? std::span<const std::uint32_t>(it->second) : std::span<const std::uint32_t>();
+					lastVerdicts.emplace_back(spell.maintained, VALIDATION::Evaluate(spell, record.effects, indices));
+				}
+				evaluate.Add(Clock::now() - grouped);
+			}
+			++sweeps;
+			for (auto const& [formID, verdict] : lastVerdicts) {
+				++decisions[verdict];
+				if (verbose && verdict != VALIDATION::Verdict::kKeep)
+					std::printf("[%10.3fs] 0x%08X -> %.*s\n", record.timestamp / 1e6, formID,
+						static_cast<int>(VALIDATION::ToString(verdict).size()), VALIDATION::ToString(verdict).data());
+			}
+		}
+
+		void Compare(TRACE::Record const& record)
+		{
+			++compared;
+			if (record.verdicts == lastVerdicts)
+				return;
+			++mismatches;
+			std::printf("[%10.3fs] replayed decisions differ from the recorded ones\n", record.timestamp / 1e6);
+		}
+
+		void Handle(TRACE::Record const& record)
+		{
+			++records[record.type];
+			switch (record.type) {
+			case TRACE::RecordType::kTick:
+				gameTime += record.delta;
+				break;
+			case TRACE::RecordType::kCast:
+				if (verbose)
+					std::printf("[%10.3fs] cast 0x%08X\n", record.timestamp / 1e6, record.formID);
+				break;
+			case TRACE::RecordType::kMaintained:
+				maintained = record.maintained;
+				baseToMaintained.clear();
+				for (auto const& spell : maintained)
+					baseToMaintained.emplace(spell.base, spell.maintained);
+				break;
+			case TRACE::RecordType::kEffects:
+				Sweep(record);
+				break;
+			case TRACE::RecordType::kVerdicts:
+				Compare(record);
+				break;
+			case TRACE::RecordType::kMessage:
+				if (verbose)
+					std::printf("[%10.3fs] message %u %s\n", record.timestamp / 1e6, record.messageType, record.name.c_str());
+				break;
+			}
+		}
+
+		void Report() const
+		{
+			std::printf("Records:\n");
+			for (auto const& [type, count] : records)
+				std::printf("  type %u: %llu\n", static_cast<unsigned>(type), static_cast<unsigned long long>(count));
+			std::printf("Game time: %.1fs, sweeps: %llu\n", gameTime, static_cast<unsigned long long>(sweeps));
+			std::printf("Decisions:\n");
+			for (auto const& [verdict, count] : decisions)
+				std::printf("  %-18.*s %llu\n", static_cast<int>(VALIDATION::ToString(verdict).size()), VALIDATION::ToString(verdict).data(),
+					static_cast<unsigned long long>(count));
+			std::printf("Compared with recording: %llu sweeps, %llu mismatches\n", static_cast<unsigned long long>(compared),
+				static_cast<unsigned long long>(mismatches));
+			std::printf("Timings (x%d):\n", repeat);
+			decode.Print();
+			group.Print();
+			evaluate.Print();
+		}
+	};
+
+	// Decodes the whole trace into replay. Returns false if the stream is not a trace.
+	bool ReplayTrace(std::istream& in, Replay& replay)
+	{
+		TRACE::Reader reader(in);
+		if (!reader.IsValid())
+			return false;
+
+		TRACE::Record record;
+		while (true) {
+			auto start = Clock::now();
+			if (!reader.Next(record))
+				break;
+			replay.decode.Add(Clock::now() - start);
+			replay.Handle(record);
+		}
+		return true;
+	}
+
+	// SKSE's kPreLoadGame, the only message the recorder stores a save name for.
+	constexpr std::uint32_t PRE_LOAD_GAME = 2;
+
+	// One maintained spell per verdict with the effects that lead to it, plus the verdicts the plugin would have
+	// recorded. A second sweep only keeps the spell that passed. flipVerdict records a wrong verdict for the kept spell.
+	void WriteSyntheticTrace(std::ostream& out, bool flipVerdict)
+	{
+		using VALIDATION::ActiveEffectFact;
+		using VALIDATION::Verdict;
+		constexpr std::uint8_t MAINTAINED = ActiveEffectFact::kFromSpell | ActiveEffectFact::kMaintainedKeyword;
+
+		const std::vector<VALIDATION::MaintainedFact> spells{
+			{ 0x0801, 0xFF000801, 0xFF001801, 1, 0 },  // Keep
+			{ 0x0802, 0xFF000802, 0xFF001802, 1, 0 },  // NotFound, only its debuff is active
+			{ 0x0803, 0xFF000803, 0xFF001803, 1, 0 },  // TooManyEffects
+			{ 0x0804, 0xFF000804, 0xFF001804, 2, 0 },  // SourceMismatch, the base spell's effect is still up
+			{ 0x0805, 0xFF000805, 0xFF001805, 3, 3 },  // MissingExclusives
+			{ 0x0806, 0xFF000806, 0xFF001806, 1, 0 },  // WrongDuration
+			{ 0x0807, 0xFF000807, 0xFF001807, 1, 0 }   // NoActiveEffects
+		};
+		const std::vector<ActiveEffectFact> effects{
+			{ 0xFF000801, 0.0f, 12.0f, MAINTAINED },
+			{ 0xFF001802, 0.0f, 12.0f, ActiveEffectFact::kFromSpell | ActiveEffectFact::kUpkeepDebuff },
+			{ 0xFF000803, 0.0f, 12.0f, MAINTAINED },
+			{ 0xFF000803, 0.0f, 12.0f, MAINTAINED },
+			{ 0x0804, 60.0f, 12.0f, ActiveEffectFact::kFromSpell },
+			{ 0xFF000805, 0.0f, 12.0f, MAINTAINED },
+			{ 0xFF000805, 0.0f, 12.0f, MAINTAINED },
+			{ 0xFF000806, 60.0f, 12.0f, MAINTAINED },
+			{ 0xFF000807, 0.0f, 12.0f, MAINTAINED | ActiveEffectFact::kInactive }
+		};
+		const std::vector<std::pair<std::uint32_t, Verdict>> verdicts{
+			{ 0xFF000801, flipVerdict ? Verdict::kNotFound : Verdict::kKeep },
+			{ 0xFF000802, Verdict::kNotFound },
+			{ 0xFF000803, Verdict::kTooManyEffects },
+			{ 0xFF000804, Verdict::kSourceMismatch },
+			{ 0xFF000805, Verdict::kMissingExclusives },
+			{ 0xFF000806, Verdict::kWrongDuration },
+			{ 0xFF000807, Verdict::kNoActiveEffects }
+		};
+
+		TRACE::Writer trace(out);
+		std::uint64_t now = 0;
+		trace.Message(now, PRE_LOAD_GAME, "Synthetic");
+		for (std::uint32_t i = 0; i < spells.size(); ++i) {
+			now += 16667;
+			trace.Tick(now, 1.0f / 60.0f);
+			trace.Cast(now, spells[i].base);
+		}
+		now += 1000000;
+		trace.Maintained(now, spells);
+		trace.Effects(now, effects);
+		trace.Verdicts(now, verdicts);
+
+		now += 1000000;
+		trace.Maintained(now, std::span(spells).first(1));
+		trace.Effects(now, std::span(effects).first(1));
+		trace.Verdicts(now, std::span(verdicts).first(1));
+	}
+
+	int Failures = 0;
+
+	void Check(bool condition, const char* what)
+	{
+		if (!condition) {
+			++Failures;
+			std::printf("FAILED: %s\n", what);
+		}
+	}
+
+	int SelfTest(Replay& replay)
+	{
+		std::stringstream trace;
+		WriteSyntheticTrace(trace, false);
+		Check(ReplayTrace(trace, replay), "The synthetic trace is read back as a trace");
+		replay.Report();
+		Check(replay.records[TRACE::RecordType::kMessage] == 1 && replay.records[TRACE::RecordType::kTick] == 7 && replay.records[TRACE::RecordType::kCast] == 7,
+			"Every record is read back");
+		Check(replay.compared == 2, "Both sweeps are compared");
+		Check(replay.mismatches == 0, "Replayed decisions match the recorded ones");
+		Check(replay.decisions.size() == 7, "Every verdict is reached");
+		Check(replay.decisions[VALIDATION::Verdict::kKeep] == 2, "The kept spell passes both sweeps");
+
+		// A recorded verdict that differs from the replayed one has to be reported
+		Replay flipped;
+		std::stringstream wrong;
+		WriteSyntheticTrace(wrong, true);
+		std::printf("Replaying with a wrong recorded verdict:\n");
+		Check(ReplayTrace(wrong, flipped) && flipped.mismatches == 2, "A wrong recorded verdict is a mismatch in both sweeps");
+
+		if (Failures > 0) {
+			std::printf("%d checks failed\n", Failures);
+			return 1;
+		}
+		std::printf("All checks passed\n");
+		return 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		std::fprintf(stderr, "Usage: %s <trace>|--self-test [--repeat N] [--verbose]\n", argv[0]);
+		return 2;
+	}
+
+	Replay replay;
+	for (int i = 2; i < argc; ++i) {
+		const std::string_view arg = argv[i];
+		if (arg == "--repeat" && i + 1 < argc)
+			replay.repeat = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "--verbose")
+			replay.verbose = true;
+	}
+
+	if (std::string_view(argv[1]) == "--self-test")
+		return SelfTest(replay);
+
+	std::ifstream file(argv[1], std::ios::binary);
+	if (!ReplayTrace(file, replay)) {
+		std::fprintf(stderr, "%s is not a MaintainedMagicNG trace\n", argv[1]);
+		return 1;
+	}
+
+	replay.Report();
+	return replay.mismatches == 0 ? 0 : 1;
+}